@@ -1,3 +1,3 @@
 from ._version import __version__
 
-from .camera import Camera, PixelFormat, Backend, register_backend
+from .camera import Camera, CameraGroup, PixelFormat, Backend, register_backend, list_devices
@@ -1,5 +1,6 @@
-from typing import Optional, Dict, Type, Union, List
+from typing import Any, Optional, Dict, Type, Union, List, Sequence, Tuple
 from abc import ABC, abstractmethod
+import os
 import platform
 import time
 import warnings
@@ -8,6 +9,7 @@ from enum import Enum
 import numpy as np
 
 from pyvirtualcam.util import FPSCounter, encode_fourcc, decode_fourcc
+from pyvirtualcam._native_common import FramePacer
 
 class Backend(ABC):
     """
@@ -47,6 +49,32 @@ class Backend(ABC):
             If no device name is given (``None``) and no device is available
             then an exception must be raised.
         :param kw: Extra keyword arguments passed through from user code.
+
+            The built-in backends additionally accept the following
+            keyword arguments which are only passed when the user
+            asks for the corresponding feature:
+
+            - ``asynchronous``, ``queue_size``, ``queue_policy``:
+              See the arguments of the same name of :class:`~pyvirtualcam.Camera`.
+            - ``threads``: See the argument of the same name of :class:`~pyvirtualcam.Camera`.
+            - ``input_width``, ``input_height``, ``scale_filter``: Size of the frames
+              passed to :meth:`send` if it differs from ``width`` and ``height``,
+              and the filter to scale them with, see ``input_size`` and
+              ``scale_filter`` of :class:`~pyvirtualcam.Camera`.
+            - ``skip_unchanged``: See the argument of the same name of
+              :class:`~pyvirtualcam.Camera`. :meth:`send` is then also called
+              with a ``dirty_rects`` keyword argument if one was given to
+              :meth:`Camera.send <pyvirtualcam.Camera.send>`.
+            - ``colorspace``, ``color_range``: See the arguments of the same name of
+              :class:`~pyvirtualcam.Camera`.
+
+        Backends may additionally implement ``acquire_frame()``, ``commit_frame()``,
+        ``stats()``, ``device_stats()``, ``send_cvpixelbuffer()``,
+        ``send_iosurface()``, ``send_dmabuf()``, ``start_relay()`` and
+        ``stop_relay()``, see the methods of the same name of
+        :class:`~pyvirtualcam.Camera`. ``send_cvpixelbuffer()`` and
+        ``send_iosurface()`` get the address of the buffer or surface
+        as an ``int``, ``start_relay()`` gets the source as a ``str``.
         """
     
     @abstractmethod
@@ -63,6 +91,16 @@ class Backend(ABC):
 
         :param frame: A 1D C-contiguous uint8 numpy array corresponding
             to the chosen pixel format and frame width and height.
+
+            If the backend class has an ``accepts_strided_frames`` attribute
+            which is true, then frames are instead passed as given to
+            :meth:`Camera.send <pyvirtualcam.Camera.send>` after checking
+            their shape, which may include padded rows and tuples of planes.
+
+            If the backend class has an ``accepts_timestamps`` attribute
+            which is true, then :meth:`send` is also called with a
+            ``timestamp_ns`` keyword argument if one was given to
+            :meth:`Camera.send <pyvirtualcam.Camera.send>`.
         """
     
     @abstractmethod
@@ -120,6 +158,35 @@ elif platform.system() == 'Linux':
     from pyvirtualcam import _native_linux_v4l2loopback
     register_backend('v4l2loopback', _native_linux_v4l2loopback.Camera)
 
+def list_devices(backend: Optional[str]=None) -> List[Dict[str, Any]]:
+    """
+    List the devices that backends can output to.
+
+    Only supported by ``v4l2loopback``, which lists v4l2loopback devices
+    from sysfs without opening any device. The list is cached for the
+    process and refreshed when device nodes are added or removed.
+
+    Each entry has the keys ``backend``, ``device`` (like ``'/dev/video0'``),
+    ``name`` (the card label of the device) and ``in_use`` (whether a camera
+    of this process outputs to it).
+
+    :param backend: Name of the backend, by default all registered backends
+        that support listing devices.
+    :raises NotImplementedError: If ``backend`` does not support it.
+    """
+    if backend:
+        backends = [(backend, BACKENDS[backend])]
+    else:
+        backends = [(name, clazz) for name, clazz in BACKENDS.items()
+                    if hasattr(clazz, 'list_devices')]
+    devices = []
+    for name, clazz in backends:
+        list_backend_devices = getattr(clazz, 'list_devices', None)
+        if list_backend_devices is None:
+            raise NotImplementedError(f"'{name}' backend does not support list_devices()")
+        devices += [dict(device, backend=name) for device in list_backend_devices()]
+    return devices
+
 class PixelFormat(Enum):
     """ Pixel formats.
 
@@ -137,6 +204,9 @@ class PixelFormat(Enum):
     RGBA = 'ABGR'
     """ Shape: ``(h,w,4)`` """
 
+    BGRA = 'ARGB'
+    """ Shape: ``(h,w,4)`` """
+
     GRAY = 'J400'
     """ Shape: ``(h,w)`` """
 
@@ -146,6 +216,15 @@ class PixelFormat(Enum):
     NV12 = 'NV12'
     """ Shape: any of size ``w * h * 3/2`` """
 
+    NV21 = 'NV21'
+    """ Shape: any of size ``w * h * 3/2`` """
+
+    P010 = 'P010'
+    """ Shape: any of size ``w * h * 3/2`` if uint16, or ``w * h * 3`` if uint8
+
+    10-bit samples in the high bits of 16 bits, reduced to 8 bits when converted.
+    """
+
     YUYV = 'YUY2'
     """ Shape: any of size ``w * h * 2`` """
 
@@ -162,13 +241,62 @@ FrameShapes = {
     PixelFormat.RGB: lambda w, h: (h, w, 3),
     PixelFormat.BGR: lambda w, h: (h, w, 3),
     PixelFormat.RGBA: lambda w, h: (h, w, 4),
+    PixelFormat.BGRA: lambda w, h: (h, w, 4),
     PixelFormat.GRAY: lambda w, h: (h, w),
     PixelFormat.I420: lambda w, h: w * h * 3 // 2,
     PixelFormat.NV12: lambda w, h: w * h * 3 // 2,
+    PixelFormat.NV21: lambda w, h: w * h * 3 // 2,
+    # in bytes, see _as_bytes()
+    PixelFormat.P010: lambda w, h: w * h * 3,
     PixelFormat.YUYV: lambda w, h: w * h * 2,
     PixelFormat.UYVY: lambda w, h: w * h * 2,
 }
 
+# Rows and bytes per row of each plane if a frame is given as tuple of planes.
+FramePlaneShapes = {
+    PixelFormat.I420: lambda w, h: [(h, w), (h // 2, w // 2), (h // 2, w // 2)],
+    PixelFormat.NV12: lambda w, h: [(h, w), (h // 2, w)],
+    PixelFormat.NV21: lambda w, h: [(h, w), (h // 2, w)],
+    PixelFormat.P010: lambda w, h: [(h, w * 2), (h // 2, w * 2)],
+}
+
+# Formats with 16-bit samples, passed to backends as the bytes of the samples.
+WideFormats = {PixelFormat.P010}
+
+def _as_bytes(array: np.ndarray, fmt: PixelFormat) -> np.ndarray:
+    if fmt in WideFormats and array.dtype == np.uint16:
+        # Doubles the last dimension, which must be contiguous.
+        return array.view(np.uint8)
+    return array
+
+def _v4l2loopback_device_spec(device):
+    # The native backend takes a fourcc instead of a PixelFormat.
+    if isinstance(device, dict) and 'fmt' in device:
+        device = dict(device)
+        device['fourcc'] = encode_fourcc(PixelFormat(device.pop('fmt')).value)
+    return device
+
+def _as_array(frame) -> np.ndarray:
+    if isinstance(frame, np.ndarray):
+        return frame
+    if hasattr(frame, '__dlpack__') and hasattr(np, 'from_dlpack'):
+        # Shares the memory of tensors on the CPU.
+        return np.from_dlpack(frame)
+    # Shares the memory of objects supporting the buffer protocol.
+    return np.asarray(frame)
+
+def _object_address(obj) -> int:
+    # PyObjC objects, like CVPixelBuffer, IOSurface or the surface of
+    # a Metal texture, give their pointer through __c_void_p__().
+    if hasattr(obj, '__c_void_p__'):
+        return obj.__c_void_p__().value or 0
+    return int(obj)
+
+def _contiguous_frame(frame) -> np.ndarray:
+    if isinstance(frame, tuple):
+        return np.concatenate([plane.reshape(-1) for plane in frame])
+    return np.ascontiguousarray(frame).reshape(-1)
+
 class Camera:
     """
     :param width: Frame width in pixels.
@@ -181,7 +309,17 @@ class Camera:
         For ``v4l2loopback`` (Linux), can be a string for a single device
         or a list of strings for multiple devices. When multiple devices
         are specified, frames are duplicated to all devices with a single
-        format conversion, reducing memory usage.
+        format conversion, reducing memory usage, and written to concurrently.
+
+        Instead of a string, a device can be given as a dict to output
+        a different format or size on it, for example
+        ``{'device': '/dev/video1', 'fmt': PixelFormat.GRAY, 'width': 640, 'height': 360}``.
+        ``fmt`` is one of ``I420``, ``NV12``, ``GRAY``, ``YUYV``, ``UYVY``,
+        ``RGB``, ``BGR`` or ``BGRA`` and defaults to the format the device would otherwise use,
+        ``width`` and ``height`` default to the frame size.
+        Conversions are shared across devices: each distinct format and size
+        is produced once, and resized outputs are scaled from a single
+        I420 conversion of the input.
 
         Built-in backends:
 
@@ -197,15 +335,95 @@ class Camera:
         - ``obs`` (macOS/Windows)
         - ``unitycapture`` (Windows)
     :param print_fps: Print frame rate every second.
+    :param asynchronous: Convert and output frames on a native worker thread.
+        :meth:`send` then only copies the frame into a queue and returns.
+        Note that ``async`` cannot be used as argument name as it is a Python keyword.
+    :param queue_size: Maximum number of frames waiting to be sent
+        if ``asynchronous=True``.
+    :param queue_policy: What :meth:`send` does if ``asynchronous=True``
+        and the queue is full: ``'drop_oldest'`` replaces the oldest queued frame,
+        ``'block'`` waits until the worker thread has sent a frame.
+    :param threads: Number of threads used for pixel format conversion,
+        including the thread calling :meth:`send` (or the worker thread if
+        ``asynchronous=True``). Frames are split into horizontal bands which
+        are converted in parallel by a pool of threads created once.
+        Mostly useful for high resolutions like 4K.
+    :param input_size: Size ``(width, height)`` of the frames passed to :meth:`send`
+        if it differs from the camera size. Frames are then scaled natively
+        to ``width`` and ``height`` as part of the format conversion.
+        Formats that libyuv can scale directly, like I420, NV12 and GRAY,
+        are scaled without an intermediate conversion.
+    :param scale_filter: Filter used if ``input_size`` is given:
+        ``'none'`` (nearest neighbor, fastest), ``'linear'``, ``'bilinear'``
+        or ``'box'`` (best quality when downscaling).
+    :param skip_unchanged: Keep the last converted frame and only convert
+        the parts of a frame that changed since the previous one, for mostly
+        static content like slides. Frames are compared in bands of 16 rows
+        by a fast hash, or the changes are given as ``dirty_rects``
+        to :meth:`send`. Frames that did not change at all are not converted
+        and are counted in ``frames_unchanged`` of :meth:`stats`.
+        The previous output is still sent, so apps keep getting frames
+        at the frame rate.
+        Frames are then no longer converted straight into device memory, which
+        adds a copy of each frame for ``v4l2loopback`` with streaming I/O and
+        ``obs`` on Windows, and ``in_place`` of ``unitycapture`` is ignored.
+        Outputs that are scaled, like with ``input_size``, are redone
+        as a whole if anything changed.
+    :param colorspace: Color matrix of YUV frames, used wherever frames are
+        converted between RGB and YUV: ``'bt601'`` (default, SD video),
+        ``'bt709'`` (HD video) or ``'bt2020'`` (UHD video).
+    :param color_range: Range of YUV samples: ``'limited'`` (default, 16-235)
+        or ``'full'`` (0-255).
+        ``v4l2loopback`` tells apps the chosen colorspace and range in the
+        format of the device, and the macOS backends attach them to each
+        frame, where only ``'limited'`` is supported. The ``obs`` backend on
+        Windows cannot tell apps, which have to be set to the same matrix.
     :param kw: Extra keyword arguments forwarded to the backend.
         Should only be given if a backend is specified.
-        Note that the built-in backends do not have extra arguments.
+
+        Extra arguments of the built-in backends:
+
+        - ``v4l2loopback``: ``io_method`` selects how frames are handed to the device.
+          ``'mmap'`` uses V4L2 streaming I/O where frames are converted directly
+          into memory-mapped kernel buffers, ``'write'`` uses ``write()`` calls
+          which is slower but works with all v4l2loopback versions.
+          The default ``'auto'`` uses ``'mmap'`` if the device supports it.
+          ``native_rgb=True`` outputs ``RGB``, ``BGR`` and ``BGRA`` frames as
+          they are, and ``RGBA`` frames as ``BGRA``, instead of converting them
+          to ``I420``. This skips the YUV conversion for apps that accept RGB
+          formats, which not all do. ``NV21`` and ``P010`` frames are always
+          output as ``NV12``.
+        - ``obs`` (Windows): ``backpressure`` decides what happens to a frame
+          sent less than one frame interval after the previous one, which the
+          OBS DirectShow filter may then never read. ``'none'`` (default)
+          replaces the previous frame, ``'wait'`` makes :meth:`send` wait until
+          the previous frame had one interval to be read, and ``'drop'`` drops
+          the new frame, counted in ``frames_dropped`` of :meth:`stats`.
+          Intervals are measured between calls of :meth:`send`, with 1 ms
+          of jitter allowed, so frames paced at ``fps`` pass unhindered.
+        - ``unitycapture``: ``on_demand=True`` only converts and sends frames that
+          the receiving app asked for, other frames passed to :meth:`send` are
+          skipped and counted in ``frames_skipped`` of :meth:`stats`. Combine it
+          with :meth:`wait_for_demand` to only render frames that are read.
+          ``in_place=True`` converts frames straight into the shared memory of
+          the capture filter, which saves a copy of each frame but keeps the
+          receiving app from reading while a frame is converted. RGBA frames are
+          always copied in place.
     """
     def __init__(self, width: int, height: int, fps: float, *,
                  fmt: PixelFormat=PixelFormat.RGB,
                  device: Optional[Union[str, List[str]]]=None,
                  backend: Optional[str]=None,
                  print_fps: bool=False,
+                 asynchronous: bool=False,
+                 queue_size: int=2,
+                 queue_policy: str='drop_oldest',
+                 threads: int=1,
+                 input_size: Optional[Tuple[int, int]]=None,
+                 scale_filter: str='box',
+                 skip_unchanged: bool=False,
+                 colorspace: str='bt601',
+                 color_range: str='limited',
                  **kw) -> None:
         # Normalize device parameter to list for v4l2loopback backend
         # Keep as-is for other backends for backward compatibility
@@ -213,6 +431,26 @@ class Camera:
         if backend == 'v4l2loopback' or (backend is None and platform.system() == 'Linux'):
             if device is not None and not isinstance(device, list):
                 device_normalized = [device]
+            if device_normalized is not None:
+                device_normalized = [_v4l2loopback_device_spec(d) for d in device_normalized]
+
+        # Only passed when used so that custom backends without support
+        # for these features keep working.
+        if asynchronous:
+            kw = dict(kw, asynchronous=True,
+                      queue_size=queue_size, queue_policy=queue_policy)
+        if threads != 1:
+            kw = dict(kw, threads=threads)
+        if input_size is not None and tuple(input_size) != (width, height):
+            input_width, input_height = input_size
+            kw = dict(kw, input_width=input_width, input_height=input_height,
+                      scale_filter=scale_filter)
+        else:
+            input_width, input_height = width, height
+        if skip_unchanged:
+            kw = dict(kw, skip_unchanged=True)
+        if colorspace != 'bt601' or color_range != 'limited':
+            kw = dict(kw, colorspace=colorspace, color_range=color_range)
 
         if backend:
             backends = [(backend, BACKENDS[backend])]
@@ -239,11 +477,13 @@ class Camera:
 
         self._width = width
         self._height = height
+        self._input_size = (input_width, input_height)
         self._fps = fps
         self._fmt = fmt
         self._print_fps = print_fps
+        self._skip_unchanged = skip_unchanged
 
-        frame_shape = FrameShapes[fmt](width, height)
+        frame_shape = FrameShapes[fmt](input_width, input_height)
         if isinstance(frame_shape, int):
             def check_frame_shape(frame: np.ndarray):
                 if frame.size != frame_shape:
@@ -254,12 +494,18 @@ class Camera:
                     raise ValueError(f"unexpected frame shape: {frame.shape} != {frame_shape}")
 
         self._check_frame_shape = check_frame_shape
+        self._plane_shapes = FramePlaneShapes[fmt](input_width, input_height) if fmt in FramePlaneShapes else None
+        self._strided_frames = getattr(self._backend, 'accepts_strided_frames', False)
 
         self._fps_counter = FPSCounter(fps)
         self._fps_last_printed = time.perf_counter()
         self._frames_sent = 0
         self._last_frame_t = None
-        self._extra_time_per_frame = 0
+        self._pacer = FramePacer(fps)
+        self._missed_slots = 0
+        # Smoothed fraction of the frame interval spent outside of
+        # wait_for_next_slot(), None until it is first called.
+        self._busy_ratio = None
 
     def __enter__(self):
         return self
@@ -295,6 +541,13 @@ class Camera:
         """
         return self._height
 
+    @property
+    def input_size(self) -> Tuple[int, int]:
+        """ Size ``(width, height)`` of the frames accepted by :meth:`send`,
+        which differs from :attr:`width` and :attr:`height` if frames are scaled.
+        """
+        return self._input_size
+
     @property
     def fps(self) -> float:
         """ Target frame rate in frames per second.
@@ -337,17 +590,267 @@ class Camera:
             self._backend.close()
             self._backend = None
 
-    def send(self, frame: np.ndarray) -> None:
+    def send(self, frame: Union[np.ndarray, Tuple[np.ndarray, ...]],
+             timestamp_ns: Optional[int]=None,
+             dirty_rects: Optional[Sequence[Tuple[int, int, int, int]]]=None) -> None:
         """Send a frame to the virtual camera device.
 
         :param frame: Frame to send. The shape of the array must match
-            the chosen :class:`~pyvirtualcam.PixelFormat`.
+            the chosen :class:`~pyvirtualcam.PixelFormat` at :attr:`input_size`.
+
+            Rows may be padded or otherwise strided, such as for a
+            cropped view of a larger image, as long as pixels within a row
+            are packed. Such frames are not copied before conversion.
+            Apart from numpy arrays, objects which support DLPack
+            (``__dlpack__``, for example CPU tensors of PyTorch) or the
+            buffer protocol are accepted without copying.
+
+            :data:`~pyvirtualcam.PixelFormat.I420`,
+            :data:`~pyvirtualcam.PixelFormat.NV12`,
+            :data:`~pyvirtualcam.PixelFormat.NV21` and
+            :data:`~pyvirtualcam.PixelFormat.P010` frames can also be given
+            as a tuple of one array per plane, each of shape ``(rows, row bytes)``:
+            ``(Y, U, V)`` for I420, ``(Y, UV)`` for NV12 and P010,
+            and ``(Y, VU)`` for NV21.
+            NV12, NV21 and P010 frames with padded rows can also be given as
+            a single 2D array of ``h*3/2`` rows whose Y and chroma rows have
+            the same stride, that is ``(h*3/2, w)`` for NV12 and NV21.
+
+            P010 frames, planes and 2D arrays are either uint16 arrays of the
+            samples, such as ``(h*3/2, w)``, or uint8 arrays of their little-endian
+            bytes, with twice the bytes per row, such as
+            ``(h*3/2, w*2)``. uint16 arrays are passed on as their bytes, so
+            their last dimension must be contiguous. Other dtypes raise
+            :class:`TypeError`.
+        :param timestamp_ns: Presentation timestamp of the frame, on the clock
+            of :func:`time.perf_counter_ns`. By default, frames are stamped
+            with the time they are output. Only supported by the ``obs``
+            backend on Windows.
+        :param dirty_rects: Rectangles ``(x, y, width, height)`` at :attr:`input_size`
+            that cover everything that changed since the previous frame,
+            instead of comparing the frames, if ``skip_unchanged=True``.
+            An empty list means that nothing changed.
+            Not used if ``asynchronous=True``, as frames may be dropped from
+            the queue.
+        :raises NotImplementedError: If ``timestamp_ns`` is given but
+            the backend does not support timestamps.
+        :raises ValueError: If ``dirty_rects`` is given without ``skip_unchanged=True``,
+            or a rectangle does not lie within the frame.
         """
-        if frame.dtype != np.uint8:
-            raise TypeError(f'unexpected frame dtype: {frame.dtype} != uint8')
-        
-        self._check_frame_shape(frame)
+        if timestamp_ns is not None and not getattr(self._backend, 'accepts_timestamps', False):
+            raise NotImplementedError(f"'{self._backend_name}' backend does not support timestamp_ns")
+        if dirty_rects is not None and not self._skip_unchanged:
+            raise ValueError('dirty_rects requires skip_unchanged=True')
+
+        frame = self._prepare_frame(frame)
+        self._count_frame()
+        kw = {}
+        if timestamp_ns is not None:
+            kw['timestamp_ns'] = timestamp_ns
+        if dirty_rects is not None:
+            kw['dirty_rects'] = [tuple(rect) for rect in dirty_rects]
+        self._backend.send(frame, **kw)
+
+    def _prepare_frame(self, frame):
+        # Checks a frame given to send(), returns what to pass to the backend.
+        if isinstance(frame, tuple):
+            frame = tuple(_as_bytes(_as_array(plane), self._fmt) for plane in frame)
+            self._check_frame_planes(frame)
+        else:
+            frame = _as_bytes(_as_array(frame), self._fmt)
+            if frame.dtype != np.uint8:
+                raise TypeError(f'unexpected frame dtype: {frame.dtype} != uint8')
+            self._check_frame_shape(frame)
+
+        if not self._strided_frames:
+            frame = _contiguous_frame(frame)
+        return frame
+
+    def _check_frame_planes(self, planes: Tuple[np.ndarray, ...]) -> None:
+        if self._plane_shapes is None:
+            raise ValueError(f'frames in {self._fmt} format cannot be given as planes')
+        if len(planes) != len(self._plane_shapes):
+            raise ValueError(f'unexpected number of planes: {len(planes)} != {len(self._plane_shapes)}')
+        for i, (plane, (rows, row_bytes)) in enumerate(zip(planes, self._plane_shapes)):
+            if plane.dtype != np.uint8:
+                raise TypeError(f'unexpected dtype of plane {i}: {plane.dtype} != uint8')
+            if plane.size != rows * row_bytes or (plane.ndim > 1 and plane.shape[0] != rows):
+                raise ValueError(f'unexpected shape of plane {i}: {plane.shape}, '
+                                 f'expected {rows} rows of {row_bytes} bytes')
+
+    def acquire_frame(self) -> np.ndarray:
+        """Get a writable view onto the backend's next output frame.
+
+        The frame can be filled in place and then be sent with :meth:`commit_frame`,
+        which avoids the copy and pixel format conversion that :meth:`send` does.
+        The view is laid out in :attr:`native_fmt`, not :attr:`fmt`,
+        and has the shape documented for that :class:`~pyvirtualcam.PixelFormat`.
+        Rows may be padded, in which case the view is strided.
+
+        The view must not be used after :meth:`commit_frame` or :meth:`close`.
+        Calling :meth:`acquire_frame` again before :meth:`commit_frame` returns
+        the same frame.
+        Cannot be used with ``asynchronous=True``.
+
+        :raises NotImplementedError: If the backend does not support it.
+        """
+        return self._backend_method('acquire_frame')()
+
+    def commit_frame(self) -> None:
+        """Send the frame returned by :meth:`acquire_frame`.
+        """
+        commit = self._backend_method('commit_frame')
+        self._count_frame()
+        commit()
+
+    def send_cvpixelbuffer(self, buffer) -> None:
+        """Send a CoreVideo pixel buffer without converting or copying it.
+
+        Only supported by the ``obs`` backend on macOS. This avoids reading
+        back frames that are rendered on the GPU: clients of the camera map
+        the IOSurface of the buffer directly.
+
+        The buffer must be backed by an IOSurface, in
+        :data:`~pyvirtualcam.PixelFormat.UYVY` format (``'2vuy'``), and
+        of size :attr:`width` x :attr:`height`. As it is read after this
+        returns, it must not be rendered into again while it may still be
+        shown, for example by taking buffers from a ``CVPixelBufferPool``
+        of a few buffers in turn.
+        Cannot be used with ``asynchronous=True``.
+
+        :param buffer: A ``CVPixelBufferRef`` as a PyObjC object or an
+            ``int`` address.
+        :raises NotImplementedError: If the backend does not support it.
+        :raises ValueError: If the buffer does not have the format described above.
+        """
+        send = self._backend_method('send_cvpixelbuffer')
+        self._count_frame()
+        send(_object_address(buffer))
+
+    def send_iosurface(self, surface) -> None:
+        """Send an IOSurface without converting or copying it,
+        like the ``iosurface`` of a Metal texture.
+
+        Same as :meth:`send_cvpixelbuffer`, for an ``IOSurfaceRef``
+        as a PyObjC object or an ``int`` address.
+        """
+        send = self._backend_method('send_iosurface')
+        self._count_frame()
+        send(_object_address(surface))
+
+    def send_dmabuf(self, fd: int, stride: Optional[int]=None) -> None:
+        """Send a frame from a DMABUF, like one exported by a decoder,
+        without going through a numpy array.
+
+        Only supported by ``v4l2loopback``. The buffer is mapped and read
+        by the CPU while the frame is sent, it is not imported by the device.
+        It must hold a frame in :attr:`fmt` at :attr:`input_size`, with the
+        planes following each other as in single-planar V4L2 formats.
+
+        :param fd: File descriptor of the DMABUF, which stays open.
+        :param stride: Bytes per row of the first plane, if rows are padded.
+            Rows of chroma planes are padded in proportion.
+        :raises NotImplementedError: If the backend does not support it.
+        :raises ValueError: If the buffer cannot be mapped or is smaller than a frame.
+        """
+        send = self._backend_method('send_dmabuf')
+        self._count_frame()
+        send(fd, stride or 0)
+
+    def start_relay(self, source: Union[str, os.PathLike]) -> None:
+        """Forward frames of a V4L2 capture device, like a webcam or
+        a decoder, to the camera on a native thread.
+
+        Only supported by ``v4l2loopback``. Frames are read from the
+        memory-mapped buffers of the source and converted to the devices
+        of this camera without Python in the loop, until :meth:`stop_relay`.
+        The source is set to capture frames in :attr:`fmt` at :attr:`input_size`.
+        Relayed frames are not counted in :attr:`frames_sent`, but in :meth:`stats`.
+        Nothing else can be sent while relaying.
+        Cannot be used with ``asynchronous=True``.
+
+        :param source: The capture device, like ``'/dev/video0'``.
+        :raises NotImplementedError: If the backend does not support it.
+        :raises ValueError: If the source is not a capture device or cannot
+            capture frames in :attr:`fmt` at :attr:`input_size`.
+        """
+        self._backend_method('start_relay')(os.fspath(source))
+
+    def stop_relay(self) -> int:
+        """Stop forwarding frames started with :meth:`start_relay`.
+
+        :return: The number of frames relayed.
+        :raises RuntimeError: If the relay had stopped early,
+            like when the source was unplugged.
+        :raises NotImplementedError: If the backend does not support it.
+        """
+        return self._backend_method('stop_relay')()
+
+    def wait_for_demand(self, timeout: Optional[float]=None) -> bool:
+        """Wait until the receiving app asks for a new frame.
+
+        Only supported by ``unitycapture``, where the capture filter signals
+        each time it wants a frame. With ``on_demand=True``, the next
+        :meth:`send` is then converted and sent, so a producer running faster
+        than the receiver can render only the frames that are read.
+
+        :param timeout: Maximum time to wait in seconds, ``None`` waits
+            until a frame is requested.
+        :return: ``True`` if a frame was requested, ``False`` on timeout or
+            if no app is capturing the camera, in which case this returns
+            immediately.
+        :raises NotImplementedError: If the backend does not support it.
+        """
+        return self._backend_method('wait_for_demand')(timeout)
+
+    def device_stats(self) -> List[Dict[str, Any]]:
+        """Write statistics of each device in use.
+
+        Only supported by ``v4l2loopback``, which writes to all devices
+        concurrently from one thread per device. Each entry has the keys
+        ``device``, ``frames_written``, ``errors``, ``last_error``
+        (``None`` if there were no errors), and the write latencies
+        ``last_write_ms``, ``mean_write_ms`` and ``max_write_ms``.
 
+        :raises NotImplementedError: If the backend does not support it.
+        """
+        return self._backend_method('device_stats')()
+
+    def stats(self) -> Dict[str, Any]:
+        """Get native send statistics, collected for all frames.
+
+        Returns a dict with the counters ``frames_output``, ``frames_dropped``
+        (frames that did not reach the device, for example because no app
+        was capturing yet, the receiving app skipped them, a device write
+        failed, or they were replaced in the ``asynchronous`` queue),
+        ``frames_skipped`` (frames that were deliberately not converted, like
+        with ``on_demand`` of ``unitycapture``), ``frames_unchanged`` (frames
+        that were not converted as they did not change, see ``skip_unchanged``,
+        but were still output), ``pool_exhausted`` (output buffers that had
+        to be allocated as all buffers of the prewarmed pool were in use,
+        only counted by the macOS backends) and ``bytes_output``, and latency
+        summaries of each stage of sending:
+
+        - ``convert``: pixel format conversion into the native format,
+        - ``output``: handing frames to the device, like device writes,
+          shared memory copies, or posting frames to the Mach server thread
+          of the macOS DAL backend,
+        - ``send``: whole :meth:`send` calls, end to end.
+
+        Each summary is a dict with ``count``, ``mean_ms``, ``p50_ms``,
+        ``p99_ms`` and ``max_ms``. Percentiles are accurate to about 12 %.
+
+        :raises NotImplementedError: If the backend does not support it.
+        """
+        return self._backend_method('stats')()
+
+    def _backend_method(self, name: str):
+        method = getattr(self._backend, name, None)
+        if method is None:
+            raise NotImplementedError(f"'{self._backend_name}' backend does not support {name}()")
+        return method
+
+    def _count_frame(self) -> None:
         self._frames_sent += 1
         self._last_frame_t = time.perf_counter()
         self._fps_counter.measure()
@@ -356,37 +859,137 @@ class Camera:
             self._fps_last_printed = self._last_frame_t
             s = f'{self._fps_counter.avg_fps:.1f} fps'
             
-            # If sleep_until_next_frame() is used, show percentage of frame time
+            # If frames are paced, show percentage of frame time
             # spent in computation (vs sleeping).
-            if self._extra_time_per_frame > 0:
-                busy_ratio = min(1, self._extra_time_per_frame * self._fps)
-                s += f' | {100*busy_ratio:.0f} %'
+            if self._busy_ratio is not None:
+                s += f' | {100*self._busy_ratio:.0f} %'
             
             print(s)
         
-        frame = np.asarray(frame.reshape(-1), order='C')
-        self._backend.send(frame)
-        
     @property
     def current_fps(self) -> float:
         """ Current measured frames per second. """
         return self._fps_counter.avg_fps
 
     def sleep_until_next_frame(self) -> None:
-        """ Adaptively sleep until the next frame is due.
+        """ Sleep until the next frame is due.
 
-        This method continuously adapts the sleep duration
-        in order to reach the target frame rate.
+        Same as :meth:`wait_for_next_slot` but without a return value.
         As a side effect, it estimates the time spent in computation
         which is printed as a percentage if ``print_fps=True``
         is given as argument in the constructor.
         """
-        next_frame_t = self._last_frame_t + 1 / self._fps
-        current_t = time.perf_counter()
-        if current_t < next_frame_t:
-            factor = self._fps / self._fps_counter.avg_fps - 1
-            self._extra_time_per_frame += 0.01 * factor
-            self._extra_time_per_frame = max(0, self._extra_time_per_frame)
-            t_sleep = next_frame_t - current_t - self._extra_time_per_frame
-            if t_sleep > 0:
-                time.sleep(t_sleep)
+        self.wait_for_next_slot()
+
+    def wait_for_next_slot(self) -> int:
+        """ Wait until the next frame is due at the target frame rate.
+
+        Frame deadlines are spaced ``1 / fps`` apart on the monotonic clock,
+        starting with the first call, so that the time spent producing
+        a frame does not accumulate as drift. Waiting happens natively
+        with the GIL released, using precise OS timers followed by a
+        short spin to meet the deadline to within microseconds.
+
+        If the deadline has already passed, this returns immediately
+        and the schedule continues from the latest missed deadline
+        instead of sending a burst of frames to catch up.
+
+        :return: Number of deadlines missed since the previous call,
+            ``0`` if the caller was on time.
+        """
+        missed, waited_ns, _ = self._pacer.wait_for_next_slot()
+        self._missed_slots += missed
+        busy_ratio = max(0, 1 - waited_ns / self._pacer.interval_ns)
+        if self._busy_ratio is None:
+            self._busy_ratio = busy_ratio
+        else:
+            self._busy_ratio += (busy_ratio - self._busy_ratio) * 0.2
+        return missed
+
+    @property
+    def missed_slots(self) -> int:
+        """ Total number of frame deadlines missed in :meth:`wait_for_next_slot`.
+        """
+        return self._missed_slots
+
+class CameraGroup:
+    """
+    Sends one frame to each of several cameras per call.
+
+    Cameras of a backend with a ``send_batch`` static method, which all
+    built-in backends have, receive their frames in a single native call:
+    frames are converted and output for all cameras in parallel on native
+    threads, with the GIL released once. Frames of other cameras are sent
+    one after the other with :meth:`Camera.send`.
+
+    The group closes its cameras when it is closed, like when using ``with``:
+
+    .. code-block:: python
+
+        cams = [pyvirtualcam.Camera(width=1280, height=720, fps=30, device=d)
+                for d in ['/dev/video0', '/dev/video1']]
+        with pyvirtualcam.CameraGroup(cams) as group:
+            while True:
+                group.send([frame0, frame1])
+                group.wait_for_next_slot()
+
+    :param cameras: Distinct cameras, in the order of the frames given to :meth:`send`.
+    """
+    def __init__(self, cameras: List[Camera]) -> None:
+        if not cameras:
+            raise ValueError('a group needs at least one camera')
+        if len(set(map(id, cameras))) != len(cameras):
+            raise ValueError('cameras must be distinct')
+        self._cameras = list(cameras)
+        # Indices of the cameras of each backend class.
+        batches: Dict[type, List[int]] = {}
+        for i, cam in enumerate(self._cameras):
+            batches.setdefault(type(cam._backend), []).append(i)
+        self._batches = list(batches.items())
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback) -> bool:
+        self.close()
+        return False
+
+    @property
+    def cameras(self) -> List[Camera]:
+        """ The cameras of the group.
+        """
+        return self._cameras
+
+    def close(self) -> None:
+        """ Close all cameras of the group.
+        """
+        for cam in self._cameras:
+            cam.close()
+
+    def send(self, frames: Sequence[Union[np.ndarray, Tuple[np.ndarray, ...]]]) -> None:
+        """ Send a frame to each camera.
+
+        :param frames: One frame per camera, in the order of the cameras.
+            Each frame is given like to :meth:`Camera.send` of its camera.
+        :raises ValueError: If the number of frames does not match.
+        """
+        if len(frames) != len(self._cameras):
+            raise ValueError(f'expected {len(self._cameras)} frames, got {len(frames)}')
+        # All frames are checked before any is sent.
+        prepared = [cam._prepare_frame(frame) for cam, frame in zip(self._cameras, frames)]
+        for cam in self._cameras:
+            cam._count_frame()
+        for clazz, indices in self._batches:
+            send_batch = getattr(clazz, 'send_batch', None)
+            if send_batch is not None and len(indices) > 1:
+                send_batch([self._cameras[i]._backend for i in indices],
+                           [prepared[i] for i in indices])
+            else:
+                for i in indices:
+                    self._cameras[i]._backend.send(prepared[i])
+
+    def wait_for_next_slot(self) -> int:
+        """ Wait until the next frame is due at the frame rate of the first camera,
+        see :meth:`Camera.wait_for_next_slot`.
+        """
+        return self._cameras[0].wait_for_next_slot()
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <libyuv.h>
+#include "../native_shared/yuv_matrix.h"
+
+// Timings of one conversion, see ConversionBench::run().
+struct BenchResult {
+    // "copy", "direct", or "via I420" for conversions that backends
+    // and the conversion graph chain through an I420 frame.
+    std::string path;
+    uint64_t iterations;
+    double median_ns;
+    double min_ns;
+    double ns_per_pixel;
+    // Bytes read and written per second at the median time.
+    double gb_per_s;
+};
+
+// Repeatedly converts a frame between two formats the way backends do,
+// optionally into vertically flipped destination planes. Conversions
+// between RGB and YUV use `matrix`, see find_converter() in yuv_matrix.h.
+class ConversionBench {
+  public:
+    ConversionBench(uint32_t src_fourcc, uint32_t dst_fourcc,
+                    int32_t width, int32_t height, bool flip,
+                    YuvMatrix matrix = YuvMatrix::BT601Limited)
+     : _src_fourcc {libyuv::CanonicalFourCC(src_fourcc)},
+       _dst_fourcc {libyuv::CanonicalFourCC(dst_fourcc)},
+       _width {width}, _height {height}, _flip {flip} {
+        if (width <= 0 || height <= 0 || width % 2 || height % 2) {
+            throw std::invalid_argument("width and height must be positive and even");
+        }
+        int32_t src_size = fourcc_frame_size(_src_fourcc, width, height);
+        int32_t dst_size = fourcc_frame_size(_dst_fourcc, width, height);
+        if (src_size == 0 || dst_size == 0) {
+            throw std::invalid_argument("Unsupported pixel format.");
+        }
+        if (_src_fourcc == _dst_fourcc) {
+            _path = "copy";
+        } else if ((_convert = find_converter(_src_fourcc, _dst_fourcc, matrix))) {
+            _path = "direct";
+        } else {
+            _to_i420 = find_converter(_src_fourcc, libyuv::FOURCC_I420, matrix);
+            _convert = find_converter(libyuv::FOURCC_I420, _dst_fourcc, matrix);
+            if (!_to_i420 || !_convert) {
+                throw std::invalid_argument("Unsupported conversion.");
+            }
+            _path = "via I420";
+            _i420.resize(i420_frame_size(width, height));
+        }
+        _src.resize(src_size);
+        _dst.resize(dst_size);
+        // Content does not change the speed of libyuv, but keeps
+        // pages from being shared zero pages.
+        uint32_t x = 12345;
+        for (uint8_t& byte : _src) {
+            x = x * 1103515245 + 12345;
+            byte = static_cast<uint8_t>(x >> 24);
+        }
+        _bytes = static_cast<uint64_t>(src_size) + dst_size;
+    }
+
+    const std::string& path() const {
+        return _path;
+    }
+
+    // Converts at least `min_iterations` times and for at least `min_seconds`.
+    BenchResult run(uint64_t min_iterations, double min_seconds) {
+        // Warm up caches, page mappings and libyuv's CPU detection.
+        for (int i = 0; i < 3; i++) {
+            convert();
+        }
+        std::vector<int64_t> times;
+        auto start = std::chrono::steady_clock::now();
+        auto min_duration = std::chrono::duration<double>(min_seconds);
+        while (times.size() < min_iterations ||
+               std::chrono::steady_clock::now() - start < min_duration) {
+            auto t0 = std::chrono::steady_clock::now();
+            convert();
+            auto t1 = std::chrono::steady_clock::now();
+            times.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+        }
+        std::sort(times.begin(), times.end());
+
+        BenchResult result;
+        result.path = _path;
+        result.iterations = times.size();
+        result.median_ns = static_cast<double>(times[times.size() / 2]);
+        result.min_ns = static_cast<double>(times[0]);
+        result.ns_per_pixel = result.median_ns / (static_cast<double>(_width) * _height);
+        result.gb_per_s = result.median_ns > 0 ? _bytes / result.median_ns : 0;
+        return result;
+    }
+
+  private:
+    uint32_t _src_fourcc;
+    uint32_t _dst_fourcc;
+    int32_t _width;
+    int32_t _height;
+    bool _flip;
+    std::string _path;
+    Converter _to_i420 = nullptr;
+    Converter _convert = nullptr;
+    std::vector<uint8_t> _src;
+    std::vector<uint8_t> _i420;
+    std::vector<uint8_t> _dst;
+    uint64_t _bytes;
+
+    void convert() {
+        Planes src = fourcc_planes(_src_fourcc, _src.data(), _width, _height);
+        Planes dst = fourcc_planes(_dst_fourcc, _dst.data(), _width, _height);
+        if (_flip) {
+            dst = flip_planes(_dst_fourcc, dst, _height);
+        }
+        if (!_convert) {
+            copy_frame(_src_fourcc, src, dst, _width, _height);
+            return;
+        }
+        if (_to_i420) {
+            Planes i420 = fourcc_planes(libyuv::FOURCC_I420, _i420.data(), _width, _height);
+            _to_i420(src, i420, _width, _height);
+            src = i420;
+        }
+        _convert(src, dst, _width, _height);
+    }
+};
+
+// libyuv's run-time CPU feature detection, which picks the SIMD kernels.
+static std::vector<std::pair<std::string, bool>> cpu_features() {
+    const std::pair<const char*, int> flags[] = {
+        {"x86", libyuv::kCpuHasX86},
+        {"sse2", libyuv::kCpuHasSSE2},
+        {"ssse3", libyuv::kCpuHasSSSE3},
+        {"sse41", libyuv::kCpuHasSSE41},
+        {"avx2", libyuv::kCpuHasAVX2},
+        {"avx512bw", libyuv::kCpuHasAVX512BW},
+        {"arm", libyuv::kCpuHasARM},
+        {"neon", libyuv::kCpuHasNEON},
+    };
+    std::vector<std::pair<std::string, bool>> features;
+    for (const auto& flag : flags) {
+        features.emplace_back(flag.first, libyuv::TestCpuFlag(flag.second) != 0);
+    }
+    return features;
+}
@@ -0,0 +1,43 @@
+#include <cstdint>
+#include <string>
+#include <pybind11/pybind11.h>
+#include "conversion_bench.h"
+
+namespace py = pybind11;
+
+// Microbenchmarks of the conversions in native_shared/image_formats.h,
+// only built with PYVIRTUALCAM_BUILD_BENCHMARKS=1, see test/benchmark_conversions.py.
+PYBIND11_MODULE(_native_bench, m) {
+    m.def("cpu_features", []() {
+        py::dict d;
+        for (const auto& feature : cpu_features()) {
+            d[py::str(feature.first)] = feature.second;
+        }
+        return d;
+    });
+
+    m.def("bench_conversion", [](uint32_t src_fourcc, uint32_t dst_fourcc,
+                                 int32_t width, int32_t height, bool flip,
+                                 uint64_t min_iterations, double min_seconds,
+                                 const std::string& colorspace, const std::string& color_range) {
+            ConversionBench bench {src_fourcc, dst_fourcc, width, height, flip,
+                                   parse_yuv_matrix(colorspace, color_range)};
+            BenchResult r;
+            {
+                py::gil_scoped_release release;
+                r = bench.run(min_iterations, min_seconds);
+            }
+            py::dict d;
+            d["path"] = r.path;
+            d["iterations"] = r.iterations;
+            d["median_ns"] = r.median_ns;
+            d["min_ns"] = r.min_ns;
+            d["ns_per_pixel"] = r.ns_per_pixel;
+            d["gb_per_s"] = r.gb_per_s;
+            return d;
+        },
+        py::arg("src_fourcc"), py::arg("dst_fourcc"),
+        py::arg("width"), py::arg("height"), py::arg("flip") = false,
+        py::arg("min_iterations") = 20, py::arg("min_seconds") = 0.5,
+        py::arg("colorspace") = "bt601", py::arg("color_range") = "limited");
+}
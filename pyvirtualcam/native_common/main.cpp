@@ -0,0 +1,23 @@
+#include <cstdint>
+#include <pybind11/pybind11.h>
+#include "../native_shared/pacer.h"
+
+namespace py = pybind11;
+
+// Native helpers that do not depend on a backend.
+PYBIND11_MODULE(_native_common, m) {
+    py::class_<FramePacer>(m, "FramePacer")
+        .def(py::init<double, int64_t>(),
+             py::arg("fps"), py::arg("spin_ns") = -1)
+        .def_property_readonly("interval_ns", &FramePacer::interval_ns)
+        .def("reset", &FramePacer::reset)
+        // Returns (missed, waited_ns, late_ns), see FramePacer::Slot.
+        .def("wait_for_next_slot", [](FramePacer& pacer) {
+                FramePacer::Slot slot;
+                {
+                    py::gil_scoped_release release;
+                    slot = pacer.wait();
+                }
+                return py::make_tuple(slot.missed, slot.waited_ns, slot.late_ns);
+            });
+}
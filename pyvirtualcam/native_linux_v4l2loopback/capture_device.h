@@ -0,0 +1,263 @@
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../native_shared/image_formats.h"
+
+// Number of buffers requested from capture devices.
+static constexpr uint32_t CAPTURE_BUFFER_COUNT = 4;
+
+// V4L2 pixel format of frames of an input format, or 0 if there is none.
+static uint32_t v4l2_input_format(uint32_t fourcc) {
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_RAW:
+            return V4L2_PIX_FMT_RGB24;
+        case libyuv::FOURCC_24BG:
+            return V4L2_PIX_FMT_BGR24;
+        case libyuv::FOURCC_ARGB:
+            return V4L2_PIX_FMT_BGR32;
+        case libyuv::FOURCC_J400:
+            return V4L2_PIX_FMT_GREY;
+        case libyuv::FOURCC_I420:
+            return V4L2_PIX_FMT_YUV420;
+        case libyuv::FOURCC_NV12:
+            return V4L2_PIX_FMT_NV12;
+        case libyuv::FOURCC_NV21:
+            return V4L2_PIX_FMT_NV21;
+        case libyuv::FOURCC_YUY2:
+            return V4L2_PIX_FMT_YUYV;
+        case libyuv::FOURCC_UYVY:
+            return V4L2_PIX_FMT_UYVY;
+        default:
+            return 0;
+    }
+}
+
+// An open V4L2 capture device, like a webcam or a decoder, that streams
+// frames of a fixed format and size into memory-mapped buffers.
+//
+// Frames are read straight from the buffers the driver filled and are
+// handed back to it afterwards, see dequeue() and requeue().
+class CaptureDevice {
+  public:
+    // A filled buffer, valid until it is requeued.
+    struct Frame {
+        uint32_t index;
+        Planes planes;
+    };
+
+    // Opens `name` and sets it to capture frames of `fourcc` at the given size.
+    CaptureDevice(const std::string& name, uint32_t fourcc, int32_t width, int32_t height)
+     : _name {name}, _fourcc {libyuv::CanonicalFourCC(fourcc)}, _width {width}, _height {height} {
+        uint32_t pixelformat = v4l2_input_format(_fourcc);
+        if (!pixelformat) {
+            throw std::invalid_argument("Frames cannot be captured in the format of the camera.");
+        }
+
+        // Non-blocking, so that the relay thread waits in poll() and can be woken.
+        _fd = open(name.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (_fd == -1) {
+            if (errno == EACCES) {
+                throw std::runtime_error(
+                    "Could not access " + name + " due to missing permissions. "
+                    "Did you add your user to the 'video' group?"
+                );
+            } else if (errno == ENOENT) {
+                throw std::invalid_argument("Device " + name + " does not exist.");
+            }
+            throw std::invalid_argument(
+                "Device " + name + " could not be opened: " + std::string(strerror(errno)));
+        }
+
+        try {
+            v4l2_capability cap;
+            if (xioctl(VIDIOC_QUERYCAP, &cap) == -1) {
+                throw std::invalid_argument(
+                    "Device capabilities of " + name + " could not be queried.");
+            }
+            uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+            if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+                throw std::invalid_argument(
+                    "Device " + name + " is not a video capture device with streaming I/O.");
+            }
+
+            struct v4l2_format fmt;
+            memset(&fmt, 0, sizeof(fmt));
+            fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            fmt.fmt.pix.width = static_cast<uint32_t>(width);
+            fmt.fmt.pix.height = static_cast<uint32_t>(height);
+            fmt.fmt.pix.pixelformat = pixelformat;
+            fmt.fmt.pix.field = V4L2_FIELD_NONE;
+            if (xioctl(VIDIOC_S_FMT, &fmt) == -1) {
+                throw std::invalid_argument(
+                    "Device " + name + " could not be configured: " + std::string(strerror(errno)));
+            }
+            // Drivers adjust what they cannot do instead of failing.
+            if (fmt.fmt.pix.pixelformat != pixelformat ||
+                fmt.fmt.pix.width != static_cast<uint32_t>(width) ||
+                fmt.fmt.pix.height != static_cast<uint32_t>(height)) {
+                throw std::invalid_argument(
+                    "Device " + name + " cannot capture " + std::to_string(width) + "x" +
+                    std::to_string(height) + " frames in the format of the camera.");
+            }
+            int32_t stride = static_cast<int32_t>(fmt.fmt.pix.bytesperline);
+            if (stride < plane_row_bytes(_fourcc, 0, width)) {
+                stride = plane_row_bytes(_fourcc, 0, width);
+            }
+            _stride = stride;
+
+            start_streaming();
+        } catch (...) {
+            release_buffers();
+            close(_fd);
+            throw;
+        }
+    }
+
+    CaptureDevice(const CaptureDevice&) = delete;
+    CaptureDevice& operator=(const CaptureDevice&) = delete;
+
+    ~CaptureDevice() {
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(VIDIOC_STREAMOFF, &type);
+        release_buffers();
+        close(_fd);
+    }
+
+    const std::string& name() const {
+        return _name;
+    }
+
+    // Readable with poll() when a frame was captured.
+    int fd() const {
+        return _fd;
+    }
+
+    // Takes the next filled buffer. Returns false and sets errno on failure,
+    // EAGAIN if no frame is ready yet. Buffers that the driver flagged as
+    // corrupt or that hold less than a frame are requeued and skipped.
+    bool dequeue(Frame& frame) {
+        while (true) {
+            v4l2_buffer buf;
+            memset(&buf, 0, sizeof(buf));
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            if (xioctl(VIDIOC_DQBUF, &buf) == -1) {
+                return false;
+            }
+            const MappedBuffer& mapped = _buffers[buf.index];
+            size_t size;
+            Planes planes = strided_planes(_fourcc, mapped.data, _width, _height, _stride, size);
+            if ((buf.flags & V4L2_BUF_FLAG_ERROR) || buf.bytesused < size) {
+                if (!requeue(buf.index)) {
+                    return false;
+                }
+                continue;
+            }
+            frame.index = buf.index;
+            frame.planes = planes;
+            return true;
+        }
+    }
+
+    // Hands a buffer from dequeue() back to the driver.
+    bool requeue(uint32_t index) {
+        v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = index;
+        return xioctl(VIDIOC_QBUF, &buf) != -1;
+    }
+
+  private:
+    struct MappedBuffer {
+        uint8_t* data;
+        size_t length;
+    };
+
+    std::string _name;
+    int _fd = -1;
+    uint32_t _fourcc;
+    int32_t _width;
+    int32_t _height;
+    // Bytes per row of the first plane.
+    int32_t _stride = 0;
+    std::vector<MappedBuffer> _buffers;
+
+    int xioctl(unsigned long request, void* arg) {
+        int r;
+        do {
+            r = ioctl(_fd, request, arg);
+        } while (r == -1 && errno == EINTR);
+        return r;
+    }
+
+    void start_streaming() {
+        v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(req));
+        req.count = CAPTURE_BUFFER_COUNT;
+        req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(VIDIOC_REQBUFS, &req) == -1 || req.count == 0) {
+            throw std::runtime_error(
+                "Device " + _name + " does not support streaming I/O with mapped buffers.");
+        }
+        for (uint32_t i = 0; i < req.count; i++) {
+            v4l2_buffer buf;
+            memset(&buf, 0, sizeof(buf));
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = i;
+            if (xioctl(VIDIOC_QUERYBUF, &buf) == -1) {
+                throw std::runtime_error(
+                    "Buffers of " + _name + " could not be queried: " + std::string(strerror(errno)));
+            }
+            void* data = mmap(nullptr, buf.length, PROT_READ, MAP_SHARED, _fd, buf.m.offset);
+            if (data == MAP_FAILED) {
+                throw std::runtime_error(
+                    "Buffers of " + _name + " could not be mapped: " + std::string(strerror(errno)));
+            }
+            _buffers.push_back({static_cast<uint8_t*>(data), buf.length});
+            size_t frame_size;
+            strided_planes(_fourcc, _buffers.back().data, _width, _height, _stride, frame_size);
+            if (buf.length < frame_size) {
+                throw std::runtime_error("Buffers of " + _name + " are smaller than a frame.");
+            }
+            if (!requeue(i)) {
+                throw std::runtime_error(
+                    "Buffers of " + _name + " could not be queued: " + std::string(strerror(errno)));
+            }
+        }
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(VIDIOC_STREAMON, &type) == -1) {
+            throw std::runtime_error(
+                "Device " + _name + " could not start streaming: " + std::string(strerror(errno)));
+        }
+    }
+
+    void release_buffers() {
+        for (auto& buffer : _buffers) {
+            munmap(buffer.data, buffer.length);
+        }
+        if (_buffers.empty()) {
+            return;
+        }
+        _buffers.clear();
+        v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(req));
+        req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory = V4L2_MEMORY_MMAP;
+        xioctl(VIDIOC_REQBUFS, &req);
+    }
+};
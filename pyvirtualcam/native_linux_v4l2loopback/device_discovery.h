@@ -0,0 +1,171 @@
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// A video4linux device node.
+struct DeviceInfo {
+    // Like "/dev/video0".
+    std::string device;
+    // The card label, like "OBS Cam" for v4l2loopback devices
+    // created with card_label="OBS Cam".
+    std::string name;
+    // Whether the node belongs to v4l2loopback.
+    bool loopback;
+};
+
+static constexpr const char* SYSFS_VIDEO4LINUX = "/sys/class/video4linux";
+
+// Number of the node, to sort video10 after video9.
+static int video_number(const std::string& node) {
+    return atoi(node.c_str() + strlen("video"));
+}
+
+// Lists video4linux nodes from sysfs without opening any of them,
+// so that unrelated capture devices are never touched.
+// Returns nothing if sysfs is not available, like in some containers.
+static std::optional<std::vector<DeviceInfo>> sysfs_devices() {
+    DIR* dir = opendir(SYSFS_VIDEO4LINUX);
+    if (!dir) {
+        return std::nullopt;
+    }
+    std::vector<std::string> nodes;
+    while (dirent* entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "video", 5) == 0) {
+            nodes.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(nodes.begin(), nodes.end(), [](const std::string& a, const std::string& b) {
+        return video_number(a) < video_number(b);
+    });
+
+    std::vector<DeviceInfo> devices;
+    for (const std::string& node : nodes) {
+        std::string sysfs_path = std::string(SYSFS_VIDEO4LINUX) + "/" + node;
+        DeviceInfo info;
+        info.device = "/dev/" + node;
+        std::ifstream name_file(sysfs_path + "/name");
+        std::getline(name_file, info.name);
+        // v4l2loopback is the only driver with these device attributes.
+        info.loopback = access((sysfs_path + "/max_openers").c_str(), F_OK) == 0;
+        devices.push_back(info);
+    }
+    return devices;
+}
+
+// Lists video4linux nodes by opening /dev/video[0-99] and querying
+// their capabilities, for systems without sysfs.
+static std::vector<DeviceInfo> probed_devices() {
+    std::vector<DeviceInfo> devices;
+    for (int i = 0; i < 100; i++) {
+        std::string device = "/dev/video" + std::to_string(i);
+        int fd = open(device.c_str(), O_WRONLY | O_SYNC);
+        if (fd == -1) {
+            continue;
+        }
+        struct v4l2_capability cap;
+        if (ioctl(fd, VIDIOC_QUERYCAP, &cap) != -1) {
+            DeviceInfo info;
+            info.device = device;
+            info.name = reinterpret_cast<const char*>(cap.card);
+            info.loopback = (cap.capabilities & V4L2_CAP_VIDEO_OUTPUT) &&
+                strcmp(reinterpret_cast<const char*>(cap.driver), "v4l2 loopback") == 0;
+            devices.push_back(info);
+        }
+        close(fd);
+    }
+    return devices;
+}
+
+// Process-wide table of video4linux devices.
+//
+// The table is listed once and kept until device nodes in /dev are
+// created or removed, which udev does when devices come and go, as
+// reported by inotify. Without inotify, it is listed on every use.
+class DeviceTable {
+  public:
+    static DeviceTable& instance() {
+        static DeviceTable table;
+        return table;
+    }
+
+    DeviceTable(const DeviceTable&) = delete;
+    DeviceTable& operator=(const DeviceTable&) = delete;
+
+    std::vector<DeviceInfo> devices() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_valid || nodes_changed()) {
+            std::optional<std::vector<DeviceInfo>> devices = sysfs_devices();
+            _devices = devices ? std::move(*devices) : probed_devices();
+            _valid = _inotify_fd != -1;
+        }
+        return _devices;
+    }
+
+    std::vector<DeviceInfo> loopback_devices() {
+        std::vector<DeviceInfo> devices = this->devices();
+        devices.erase(std::remove_if(devices.begin(), devices.end(),
+            [](const DeviceInfo& info) { return !info.loopback; }), devices.end());
+        return devices;
+    }
+
+    // For when a listed device turned out to be gone.
+    void invalidate() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _valid = false;
+    }
+
+  private:
+    std::mutex _mutex;
+    std::vector<DeviceInfo> _devices;
+    bool _valid = false;
+    int _inotify_fd = -1;
+
+    DeviceTable() {
+        _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_inotify_fd != -1 &&
+            inotify_add_watch(_inotify_fd, "/dev",
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) == -1) {
+            close(_inotify_fd);
+            _inotify_fd = -1;
+        }
+    }
+
+    ~DeviceTable() {
+        if (_inotify_fd != -1) {
+            close(_inotify_fd);
+        }
+    }
+
+    // Drains pending inotify events, returns whether any was about a video node.
+    bool nodes_changed() {
+        bool changed = false;
+        alignas(inotify_event) char buffer[4096];
+        ssize_t n;
+        while ((n = read(_inotify_fd, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + n; ) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                if ((event->mask & IN_Q_OVERFLOW) ||
+                    (event->len && strncmp(event->name, "video", 5) == 0)) {
+                    changed = true;
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+};
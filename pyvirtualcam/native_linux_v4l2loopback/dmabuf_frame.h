@@ -0,0 +1,79 @@
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "../native_shared/image_formats.h"
+
+// A frame in a DMABUF, like one exported by a decoder or a capture device,
+// mapped for reading for the lifetime of this object.
+//
+// The frame is laid out like a single-planar V4L2 buffer, see
+// strided_planes(). Any other file descriptor that can be mapped,
+// like a memfd, works as well.
+class DmabufFrame {
+  public:
+    // `stride` is the bytes per row of the first plane, 0 if rows are packed.
+    DmabufFrame(int fd, uint32_t fourcc, int32_t width, int32_t height, int32_t stride)
+     : _fd {fd} {
+        int32_t row_bytes = plane_row_bytes(fourcc, 0, width);
+        if (stride == 0) {
+            stride = row_bytes;
+        } else if (stride < row_bytes) {
+            throw std::invalid_argument("Stride must be at least the bytes of a row.");
+        }
+
+        off_t length = lseek(fd, 0, SEEK_END);
+        if (length == -1) {
+            throw std::invalid_argument("DMABUF size could not be queried: " + std::string(strerror(errno)));
+        }
+        _length = static_cast<size_t>(length);
+        void* data = mmap(nullptr, _length, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            throw std::invalid_argument("DMABUF could not be mapped: " + std::string(strerror(errno)));
+        }
+        _data = static_cast<uint8_t*>(data);
+
+        size_t size;
+        _planes = strided_planes(fourcc, _data, width, height, stride, size);
+        if (size > _length) {
+            munmap(_data, _length);
+            throw std::invalid_argument("DMABUF is smaller than a frame.");
+        }
+        // Waits for devices writing to the buffer and makes their writes
+        // visible to the CPU. Not a DMABUF if this fails, nothing to sync.
+        sync(DMA_BUF_SYNC_START);
+    }
+
+    DmabufFrame(const DmabufFrame&) = delete;
+    DmabufFrame& operator=(const DmabufFrame&) = delete;
+
+    ~DmabufFrame() {
+        sync(DMA_BUF_SYNC_END);
+        munmap(_data, _length);
+    }
+
+    const Planes& planes() const {
+        return _planes;
+    }
+
+  private:
+    int _fd;
+    uint8_t* _data = nullptr;
+    size_t _length = 0;
+    Planes _planes;
+
+    void sync(uint64_t flags) {
+        dma_buf_sync sync;
+        sync.flags = flags | DMA_BUF_SYNC_READ;
+        while (ioctl(_fd, DMA_BUF_IOCTL_SYNC, &sync) == -1 && errno == EINTR) {
+        }
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "capture_device.h"
+
+// Moves frames from a capture device to a sink on a thread of its own,
+// without Python in the loop.
+//
+// The sink reads each frame straight from the mapped capture buffer,
+// which is handed back to the driver once the sink returns. If the source
+// fails, like when it is unplugged, the relay stops and the error is
+// reported by stop().
+class FrameRelay {
+  public:
+    using Sink = std::function<void(const Planes& frame)>;
+
+    FrameRelay(std::unique_ptr<CaptureDevice> source, Sink sink)
+     : _source {std::move(source)}, _sink {std::move(sink)} {
+        _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_wake_fd == -1) {
+            throw std::runtime_error("relay could not be started: " + std::string(strerror(errno)));
+        }
+        _thread = std::thread(&FrameRelay::run, this);
+    }
+
+    FrameRelay(const FrameRelay&) = delete;
+    FrameRelay& operator=(const FrameRelay&) = delete;
+
+    ~FrameRelay() {
+        if (_thread.joinable()) {
+            wake_and_join();
+        }
+        close(_wake_fd);
+    }
+
+    // Stops relaying after the current frame.
+    // Throws if the relay had stopped on an error before.
+    void stop() {
+        if (_thread.joinable()) {
+            wake_and_join();
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_error.empty()) {
+            throw std::runtime_error(_error);
+        }
+    }
+
+    uint64_t frames_relayed() const {
+        return _frames.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::unique_ptr<CaptureDevice> _source;
+    Sink _sink;
+    int _wake_fd = -1;
+    std::atomic<uint64_t> _frames {0};
+    std::mutex _mutex;
+    std::string _error;
+    std::thread _thread;
+
+    void wake_and_join() {
+        uint64_t one = 1;
+        ssize_t n = write(_wake_fd, &one, sizeof(one));
+        (void)n;
+        _thread.join();
+    }
+
+    void fail(const std::string& error) {
+        // not an exception, nobody is waiting for the thread
+        fprintf(stderr, "relay from %s stopped: %s\n", _source->name().c_str(), error.c_str());
+        std::lock_guard<std::mutex> lock(_mutex);
+        _error = "relay from " + _source->name() + " stopped: " + error;
+    }
+
+    void run() {
+        pollfd fds[2] = {
+            {_source->fd(), POLLIN, 0},
+            {_wake_fd, POLLIN, 0},
+        };
+        while (true) {
+            if (poll(fds, 2, -1) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail(strerror(errno));
+                return;
+            }
+            if (fds[1].revents) {
+                return;
+            }
+            if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                fail("device error or disconnect");
+                return;
+            }
+            CaptureDevice::Frame frame;
+            if (!_source->dequeue(frame)) {
+                if (errno == EAGAIN) {
+                    continue;
+                }
+                fail(strerror(errno));
+                return;
+            }
+            try {
+                _sink(frame.planes);
+            } catch (std::exception& ex) {
+                _source->requeue(frame.index);
+                fail(ex.what());
+                return;
+            }
+            if (!_source->requeue(frame.index)) {
+                fail(strerror(errno));
+                return;
+            }
+            _frames.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
@@ -1,23 +1,78 @@
+#include <algorithm>
 #include <stdexcept>
 #include <optional>
+#include <memory>
+#include <mutex>
 #include <pybind11/pybind11.h>
 #include <pybind11/pytypes.h>
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
 #include "virtual_output.h"
+#include "dmabuf_frame.h"
+#include "frame_relay.h"
+#include "../native_shared/async_sender.h"
+#include "../native_shared/py_batch.h"
+#include "../native_shared/py_frame.h"
+#include "../native_shared/py_stats.h"
 
 namespace py = pybind11;
 
 class Camera {
   private:
     VirtualOutput virtual_output;
+    std::unique_ptr<AsyncSender> async_sender;
+    // Sends frames of a capture device from its own thread if set.
+    std::unique_ptr<FrameRelay> relay;
+    // Held while sending without the GIL, so that close() on another
+    // thread does not tear down the output in the middle of a frame.
+    std::mutex output_mutex;
+    uint32_t frame_fourcc;
+    // Size of frames passed to send(), which the conversion graph scales
+    // to the device sizes.
+    uint32_t frame_width;
+    uint32_t frame_height;
 
     static std::string to_string_like(const py::handle& obj) {
         // Use py::str so any object with __str__ works (e.g., pathlib.Path)
         return py::str(obj).cast<std::string>();
     }
 
-    static std::optional<std::vector<std::string>>
+    // Frames cannot be sent while the relay sends from its thread.
+    void check_not_relaying(const std::string& method) {
+        if (relay) {
+            throw std::runtime_error(method + " cannot be used while a relay is running.");
+        }
+    }
+
+    // A device name, or a dict with the name under "device" and optionally
+    // "fourcc", "width" and "height" of what to output on the device.
+    static DeviceSpec parse_device(const py::handle& item) {
+        if (!py::isinstance<py::dict>(item)) {
+            return {to_string_like(item)};
+        }
+        py::dict dict = py::reinterpret_borrow<py::dict>(item);
+        DeviceSpec spec;
+        for (auto entry : dict) {
+            std::string key = py::str(entry.first).cast<std::string>();
+            if (key == "device") {
+                spec.name = to_string_like(entry.second);
+            } else if (key == "fourcc") {
+                spec.fourcc = entry.second.cast<uint32_t>();
+            } else if (key == "width") {
+                spec.width = entry.second.cast<uint32_t>();
+            } else if (key == "height") {
+                spec.height = entry.second.cast<uint32_t>();
+            } else {
+                throw std::invalid_argument("Unknown device option '" + key + "'.");
+            }
+        }
+        if (spec.name.empty()) {
+            throw std::invalid_argument("A device dict must contain 'device'.");
+        }
+        return spec;
+    }
+
+    static std::optional<std::vector<DeviceSpec>>
     parse_devices(const py::object& device_obj) {
         if (device_obj.is_none()) {
             return std::nullopt;
@@ -26,14 +81,14 @@ class Camera {
         if (py::isinstance<py::sequence>(device_obj) &&
             !py::isinstance<py::str>(device_obj)) {
             py::list seq = py::list(device_obj);
-            std::vector<std::string> devices;
+            std::vector<DeviceSpec> devices;
             devices.reserve(seq.size());
             for (py::handle item : seq) {
                 try {
-                    devices.push_back(to_string_like(item));
+                    devices.push_back(parse_device(item));
                 } catch (const py::error_already_set&) {
                     throw std::invalid_argument(
-                        "Each device must be string-convertible when specifying a list of devices."
+                        "Each device must be string-convertible or a dict when specifying a list of devices."
                     );
                 }
             }
@@ -41,21 +96,47 @@ class Camera {
         }
 
         try {
-            return std::vector<std::string>{to_string_like(device_obj)};
+            return std::vector<DeviceSpec>{parse_device(device_obj)};
         } catch (const py::error_already_set&) {
             throw std::invalid_argument(
-                "Device must be None, a string, or a sequence of strings."
+                "Device must be None, a string, a dict, or a sequence of them."
             );
         }
     }
 
   public:
     Camera(uint32_t width, uint32_t height, [[maybe_unused]] double fps,
-           uint32_t fourcc, py::object device_arg)
-     : virtual_output {width, height, fourcc, parse_devices(device_arg)} {
+           uint32_t fourcc, py::object device_arg,
+           bool asynchronous, uint32_t queue_size, const std::string& queue_policy,
+           uint32_t threads, const std::string& io_method,
+           uint32_t input_width, uint32_t input_height, const std::string& scale_filter,
+           bool skip_unchanged, bool native_rgb,
+           const std::string& colorspace, const std::string& color_range)
+     : virtual_output {width, height, fourcc, parse_devices(device_arg),
+                       parse_io_method(io_method), threads,
+                       input_width, input_height, parse_filter_mode(scale_filter),
+                       skip_unchanged, native_rgb, parse_yuv_matrix(colorspace, color_range)} {
+        frame_fourcc = fourcc;
+        frame_width = input_width ? input_width : width;
+        frame_height = input_height ? input_height : height;
+        if (asynchronous) {
+            async_sender = std::make_unique<AsyncSender>(
+                fourcc, frame_width, frame_height, queue_size,
+                AsyncSender::parse_policy(queue_policy),
+                [this](const Planes& frame, uint64_t) { virtual_output.send(frame); });
+        }
     }
 
     void close() {
+        {
+            // Joining the sender threads does not need the GIL.
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock {output_mutex};
+            relay.reset();
+            async_sender.reset();
+        }
+        // stop() changes ACTIVE_DEVICES, which the GIL guards.
+        std::lock_guard<std::mutex> lock {output_mutex};
         virtual_output.stop();
     }
 
@@ -67,20 +148,207 @@ class Camera {
         return virtual_output.native_fourcc();
     }
 
-    void send(py::array_t<uint8_t, py::array::c_style> frame) {
-        py::buffer_info buf = frame.request();    
-        virtual_output.send(static_cast<uint8_t*>(buf.ptr));
+    void send(py::object frame, std::optional<std::vector<DirtyRect>> dirty_rects) {
+        Planes planes = planes_of(frame);
+        // `frame` keeps the buffers alive while the GIL is released.
+        py::gil_scoped_release release;
+        send_planes(planes, dirty_rects ? &*dirty_rects : nullptr);
+    }
+
+    // Planes of a frame passed to send().
+    Planes planes_of(const py::object& frame) {
+        check_not_relaying("send()");
+        return frame_planes(frame_fourcc, frame, frame_width, frame_height);
+    }
+
+    // Called without the GIL. Frames sent asynchronously may be dropped
+    // from the queue, so their changes are found by hashing instead of `dirty`.
+    void send_planes(const Planes& planes, const std::vector<DirtyRect>* dirty = nullptr) {
+        std::lock_guard<std::mutex> lock {output_mutex};
+        ScopedTimer timer {virtual_output.send_stats().send};
+        if (async_sender) {
+            async_sender->push(planes);
+        } else {
+            virtual_output.send(planes, dirty);
+        }
+    }
+
+    // Maps the frame in DMABUF `fd` only while sending it,
+    // the caller keeps the descriptor.
+    void send_dmabuf(int fd, int32_t stride) {
+        check_not_relaying("send_dmabuf()");
+        py::gil_scoped_release release;
+        DmabufFrame frame {fd, frame_fourcc,
+            static_cast<int32_t>(frame_width), static_cast<int32_t>(frame_height), stride};
+        send_planes(frame.planes());
+    }
+
+    // Relays frames of capture device `source`, which must capture frames
+    // of the format and size passed to send(), until stop_relay().
+    void start_relay(const std::string& source) {
+        if (async_sender) {
+            throw std::runtime_error("start_relay() cannot be used with asynchronous=True.");
+        }
+        check_not_relaying("start_relay()");
+        auto capture = std::make_unique<CaptureDevice>(source, frame_fourcc,
+            static_cast<int32_t>(frame_width), static_cast<int32_t>(frame_height));
+        relay = std::make_unique<FrameRelay>(std::move(capture), [this](const Planes& frame) {
+            ScopedTimer timer {virtual_output.send_stats().send};
+            virtual_output.send(frame);
+        });
+    }
+
+    // Returns the number of frames relayed.
+    uint64_t stop_relay() {
+        if (!relay) {
+            throw std::runtime_error("stop_relay() called without start_relay()");
+        }
+        std::unique_ptr<FrameRelay> stopped = std::move(relay);
+        py::gil_scoped_release release;
+        stopped->stop();
+        return stopped->frames_relayed();
+    }
+
+    py::array acquire_frame() {
+        if (async_sender) {
+            throw std::runtime_error("acquire_frame() cannot be used with asynchronous=True.");
+        }
+        check_not_relaying("acquire_frame()");
+        Planes planes = virtual_output.acquire_frame();
+        const ConversionGraph::Format& format = virtual_output.native_format();
+        return frame_view(format.fourcc, planes, format.width, format.height);
+    }
+
+    py::dict stats() {
+        return stats_dict(virtual_output.send_stats(), async_sender ? async_sender->frames_dropped() : 0);
+    }
+
+    void commit_frame() {
+        // The relay thread sends into the same device buffers.
+        check_not_relaying("commit_frame()");
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock {output_mutex};
+        virtual_output.commit_frame();
+    }
+
+    py::list device_stats() {
+        py::list result;
+        for (const DeviceStats& stats : virtual_output.device_stats()) {
+            py::dict d;
+            d["device"] = stats.device;
+            d["frames_written"] = stats.frames_written;
+            d["errors"] = stats.errors;
+            d["last_error"] = stats.last_error.empty() ? py::object(py::none()) : py::str(stats.last_error);
+            d["last_write_ms"] = stats.last_write_ns / 1e6;
+            d["mean_write_ms"] = stats.frames_written ? stats.total_write_ns / 1e6 / stats.frames_written : 0.0;
+            d["max_write_ms"] = stats.max_write_ns / 1e6;
+            result.append(d);
+        }
+        return result;
+    }
+
+    // v4l2loopback devices from the process-wide device table.
+    static py::list list_devices() {
+        py::list result;
+        for (const DeviceInfo& info : DeviceTable::instance().loopback_devices()) {
+            py::dict d;
+            d["device"] = info.device;
+            d["name"] = info.name;
+            d["in_use"] = ACTIVE_DEVICES.count(info.device) > 0;
+            result.append(d);
+        }
+        return result;
     }
 };
 
 PYBIND11_MODULE(_native_linux_v4l2loopback, m) {
     py::class_<Camera>(m, "Camera")
-        .def(py::init<uint32_t, uint32_t, double, uint32_t, py::object>(),
+        .def(py::init<uint32_t, uint32_t, double, uint32_t, py::object,
+                      bool, uint32_t, const std::string&, uint32_t, const std::string&,
+                      uint32_t, uint32_t, const std::string&, bool, bool,
+                      const std::string&, const std::string&>(),
              py::kw_only(),
              py::arg("width"), py::arg("height"), py::arg("fps"),
-             py::arg("fourcc"), py::arg("device") = py::none())
+             py::arg("fourcc"), py::arg("device") = py::none(),
+             py::arg("asynchronous") = false, py::arg("queue_size") = 2,
+             py::arg("queue_policy") = "drop_oldest",
+             py::arg("threads") = 1, py::arg("io_method") = "auto",
+             py::arg("input_width") = 0, py::arg("input_height") = 0,
+             py::arg("scale_filter") = "box",
+             py::arg("skip_unchanged") = false, py::arg("native_rgb") = false,
+             py::arg("colorspace") = "bt601", py::arg("color_range") = "limited")
         .def("close", &Camera::close)
-        .def("send", &Camera::send)
+        .def("send", &Camera::send, py::arg("frame"), py::arg("dirty_rects") = py::none())
+        .def_property_readonly_static("accepts_strided_frames", [](py::object) { return true; })
+        .def("send_dmabuf", &Camera::send_dmabuf, py::arg("fd"), py::arg("stride") = 0)
+        .def("start_relay", &Camera::start_relay, py::arg("source"))
+        .def("stop_relay", &Camera::stop_relay)
+        .def("acquire_frame", &Camera::acquire_frame)
+        .def("commit_frame", &Camera::commit_frame)
+        .def("stats", &Camera::stats)
+        .def("device_stats", &Camera::device_stats)
+        .def_static("list_devices", &Camera::list_devices)
+        .def_static("send_batch", &send_batch<Camera>, py::arg("cameras"), py::arg("frames"))
         .def("device", &Camera::device)
         .def("native_fourcc", &Camera::native_fourcc);
+
+    // Converts a single frame outside of any device, so that tests can
+    // check the values of the conversions and of frames split into bands
+    // over `threads`. Not part of the public API.
+    m.def("_convert_frame", [](const py::object& frame, uint32_t src_fourcc, uint32_t dst_fourcc,
+                               uint32_t width, uint32_t height,
+                               const std::string& colorspace, const std::string& color_range,
+                               uint32_t threads) {
+            Planes src = frame_planes(src_fourcc, frame, width, height);
+            Converter convert = find_converter(src_fourcc, dst_fourcc,
+                                               parse_yuv_matrix(colorspace, color_range));
+            if (!convert) {
+                throw std::invalid_argument("Unsupported conversion.");
+            }
+            py::array_t<uint8_t> out(fourcc_frame_size(dst_fourcc, width, height));
+            Planes dst = fourcc_planes(dst_fourcc, out.mutable_data(), width, height);
+            std::unique_ptr<ThreadPool> pool = make_thread_pool(threads);
+            convert_frame(convert, src_fourcc, src, dst_fourcc, dst, width, height, pool.get());
+            return out;
+        },
+        py::arg("frame"), py::arg("src_fourcc"), py::arg("dst_fourcc"),
+        py::arg("width"), py::arg("height"),
+        py::arg("colorspace") = "bt601", py::arg("color_range") = "limited",
+        py::arg("threads") = 1);
+
+    // Converts a sequence of frames like a camera that only converts the
+    // rows which changed, and returns the output after each frame, so that
+    // tests can compare it with converting each frame in full.
+    // `dirty_rects` has the rectangles of each frame, or None to hash it.
+    m.def("_convert_changes", [](const std::vector<py::object>& frames,
+                                 uint32_t src_fourcc, uint32_t dst_fourcc,
+                                 uint32_t width, uint32_t height,
+                                 std::optional<std::vector<std::optional<std::vector<DirtyRect>>>> dirty_rects,
+                                 uint32_t threads) {
+            if (dirty_rects && dirty_rects->size() != frames.size()) {
+                throw std::invalid_argument("dirty_rects must have an entry for each frame.");
+            }
+            int32_t w = static_cast<int32_t>(width);
+            int32_t h = static_cast<int32_t>(height);
+            ConversionGraph graph {{src_fourcc, w, h}, {{dst_fourcc, w, h}}};
+            FrameChanges changes {src_fourcc, w, h};
+            std::unique_ptr<ThreadPool> pool = make_thread_pool(threads);
+            size_t size = fourcc_frame_size(dst_fourcc, width, height);
+            py::list outputs;
+            for (size_t i = 0; i < frames.size(); i++) {
+                Planes src = frame_planes(src_fourcc, frames[i], width, height);
+                const std::optional<std::vector<DirtyRect>>* dirty =
+                    dirty_rects ? &(*dirty_rects)[i] : nullptr;
+                const std::vector<RowBand>& bands =
+                    changes.update(src, dirty && *dirty ? &**dirty : nullptr);
+                graph.run_bands(src, bands, pool.get());
+                py::array_t<uint8_t> out(size);
+                std::copy_n(graph.output(0), size, out.mutable_data());
+                outputs.append(out);
+            }
+            return outputs;
+        },
+        py::arg("frames"), py::arg("src_fourcc"), py::arg("dst_fourcc"),
+        py::arg("width"), py::arg("height"),
+        py::arg("dirty_rects") = py::none(), py::arg("threads") = 1);
 }
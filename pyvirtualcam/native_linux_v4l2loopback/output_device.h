@@ -0,0 +1,229 @@
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include <string>
+#include <vector>
+
+// Colorimetry fields of a v4l2_pix_format, all default if zero.
+struct Colorimetry {
+    uint32_t colorspace = V4L2_COLORSPACE_DEFAULT;
+    uint32_t ycbcr_enc = V4L2_YCBCR_ENC_DEFAULT;
+    uint32_t quantization = V4L2_QUANTIZATION_DEFAULT;
+    uint32_t xfer_func = V4L2_XFER_FUNC_DEFAULT;
+};
+
+// An open and configured v4l2loopback output device.
+//
+// Frames are either pushed with write() or, if the device supports it,
+// with V4L2 streaming I/O on memory-mapped buffers. The latter lets
+// callers convert directly into the buffer that the kernel hands to
+// consumers and avoids the copy that write() does.
+class OutputDevice {
+  private:
+    struct MappedBuffer {
+        uint8_t* data;
+        size_t length;
+    };
+
+    std::string _name;
+    int _fd;
+    bool _streaming = false;
+    bool _stream_on = false;
+    std::vector<MappedBuffer> _buffers;
+    // Buffers that have not been queued yet since streaming started.
+    uint32_t _unused_buffers = 0;
+    // Buffer returned by next_buffer() and not yet queued.
+    int32_t _current = -1;
+
+    int xioctl(unsigned long request, void* arg) {
+        int r;
+        do {
+            r = ioctl(_fd, request, arg);
+        } while (r == -1 && errno == EINTR);
+        return r;
+    }
+
+    void release_buffers() {
+        for (auto& buffer : _buffers) {
+            munmap(buffer.data, buffer.length);
+        }
+        _buffers.clear();
+        v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(req));
+        req.count = 0;
+        req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        req.memory = V4L2_MEMORY_MMAP;
+        xioctl(VIDIOC_REQBUFS, &req);
+    }
+
+  public:
+    OutputDevice(std::string name, int fd)
+     : _name {std::move(name)}, _fd {fd} {
+    }
+
+    OutputDevice(const OutputDevice&) = delete;
+    OutputDevice& operator=(const OutputDevice&) = delete;
+
+    ~OutputDevice() {
+        if (_stream_on) {
+            int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+            xioctl(VIDIOC_STREAMOFF, &type);
+        }
+        if (_streaming) {
+            release_buffers();
+        }
+        close(_fd);
+    }
+
+    const std::string& name() const {
+        return _name;
+    }
+
+    bool streaming() const {
+        return _streaming;
+    }
+
+    // Returns false and sets errno on failure.
+    bool set_format(uint32_t width, uint32_t height, uint32_t pixelformat,
+                    const Colorimetry& colorimetry, v4l2_pix_format& pix_out) {
+        v4l2_format v4l2_fmt;
+        memset(&v4l2_fmt, 0, sizeof(v4l2_fmt));
+        v4l2_fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        v4l2_pix_format& pix = v4l2_fmt.fmt.pix;
+        pix.width = width;
+        pix.height = height;
+        pix.pixelformat = pixelformat;
+
+        // Consumers read this from G_FMT to pick their YUV to RGB conversion.
+        pix.colorspace = colorimetry.colorspace;
+        pix.ycbcr_enc = colorimetry.ycbcr_enc;
+        pix.quantization = colorimetry.quantization;
+        pix.xfer_func = colorimetry.xfer_func;
+
+        // v4l2loopback sets bytesperline and sizeimage for us, and the
+        // colorspace if it is left at its default.
+
+        if (xioctl(VIDIOC_S_FMT, &v4l2_fmt) == -1) {
+            return false;
+        }
+        pix_out = pix;
+        return true;
+    }
+
+    // Switches to streaming I/O with memory-mapped buffers of at least
+    // `frame_size` bytes. Returns false if the device does not support it,
+    // in which case write() is used.
+    bool start_streaming(uint32_t buffer_count, size_t frame_size) {
+        v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(req));
+        req.count = buffer_count;
+        req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        req.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(VIDIOC_REQBUFS, &req) == -1 || req.count == 0) {
+            return false;
+        }
+
+        _streaming = true;
+        for (uint32_t i = 0; i < req.count; i++) {
+            v4l2_buffer buf;
+            memset(&buf, 0, sizeof(buf));
+            buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = i;
+            if (xioctl(VIDIOC_QUERYBUF, &buf) == -1 || buf.length < frame_size) {
+                release_buffers();
+                _streaming = false;
+                return false;
+            }
+            void* data = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, _fd, buf.m.offset);
+            if (data == MAP_FAILED) {
+                release_buffers();
+                _streaming = false;
+                return false;
+            }
+            _buffers.push_back({static_cast<uint8_t*>(data), buf.length});
+        }
+        _unused_buffers = static_cast<uint32_t>(_buffers.size());
+        return true;
+    }
+
+    // Streaming only. Returns a buffer of at least the frame size
+    // to fill, or nullptr on failure (errno is set).
+    uint8_t* next_buffer() {
+        if (_current != -1) {
+            return _buffers[_current].data;
+        }
+        if (_unused_buffers > 0) {
+            _current = static_cast<int32_t>(_buffers.size() - _unused_buffers);
+            _unused_buffers--;
+        } else {
+            v4l2_buffer buf;
+            memset(&buf, 0, sizeof(buf));
+            buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+            buf.memory = V4L2_MEMORY_MMAP;
+            if (xioctl(VIDIOC_DQBUF, &buf) == -1) {
+                return nullptr;
+            }
+            _current = static_cast<int32_t>(buf.index);
+        }
+        return _buffers[_current].data;
+    }
+
+    // Streaming only. Hands the buffer returned by next_buffer() to consumers.
+    bool queue_buffer(size_t frame_size) {
+        if (_current == -1) {
+            errno = EINVAL;
+            return false;
+        }
+
+        v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = static_cast<uint32_t>(_current);
+        buf.bytesused = static_cast<uint32_t>(frame_size);
+        buf.field = V4L2_FIELD_NONE;
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        buf.timestamp.tv_sec = now.tv_sec;
+        buf.timestamp.tv_usec = now.tv_nsec / 1000;
+
+        if (xioctl(VIDIOC_QBUF, &buf) == -1) {
+            return false;
+        }
+        _current = -1;
+
+        if (!_stream_on) {
+            int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+            if (xioctl(VIDIOC_STREAMON, &type) == -1) {
+                return false;
+            }
+            _stream_on = true;
+        }
+        return true;
+    }
+
+    // Either queues `frame` by copying it into the next buffer or writes it.
+    bool send(const uint8_t* frame, size_t frame_size) {
+        if (_streaming) {
+            uint8_t* buffer = next_buffer();
+            if (!buffer) {
+                return false;
+            }
+            if (buffer != frame) {
+                memcpy(buffer, frame, frame_size);
+            }
+            return queue_buffer(frame_size);
+        }
+        ssize_t n = write(_fd, frame, frame_size);
+        return n != -1;
+    }
+};
@@ -6,79 +6,288 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <linux/videodev2.h>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <set>
-#include <sstream>
 #include <stdexcept>
 
 #include "../native_shared/image_formats.h"
+#include "../native_shared/conversion_graph.h"
+#include "../native_shared/yuv_matrix.h"
+#include "../native_shared/frame_changes.h"
+#include "../native_shared/stats.h"
+#include "../native_shared/trace.h"
+#include "device_discovery.h"
+#include "output_device.h"
 
 // v4l2loopback allows opening a device multiple times.
 // To avoid selecting the same device more than once,
-// we keep track of the ones we have open ourselves.
-// Obviously, this won't help if multiple processes are used
-// or if devices are opened by other tools.
+// we keep track of the ones we have open ourselves,
+// and hold an exclusive flock() on each open device node
+// so that other pyvirtualcam processes skip it as well.
+// Obviously, this won't help if devices are opened by other tools.
 // In this case, explicitly specifying the device seems the only solution.
 static std::set<std::string> ACTIVE_DEVICES;
 
+// Number of buffers requested for streaming I/O.
+// v4l2loopback may grant fewer, depending on its max_buffers option.
+static constexpr uint32_t STREAMING_BUFFER_COUNT = 4;
+
+enum class IoMethod {
+    // Streaming I/O if the device supports it, write() otherwise.
+    Auto,
+    Mmap,
+    Write,
+};
+
+static IoMethod parse_io_method(const std::string& name) {
+    if (name == "auto") {
+        return IoMethod::Auto;
+    } else if (name == "mmap") {
+        return IoMethod::Mmap;
+    } else if (name == "write") {
+        return IoMethod::Write;
+    }
+    throw std::invalid_argument(
+        "Unknown I/O method '" + name + "', must be 'auto', 'mmap' or 'write'."
+    );
+}
+
+// A device to open and what to output on it.
+// Zero fields default to the native format for the input and the input size.
+struct DeviceSpec {
+    std::string name;
+    uint32_t fourcc = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+// V4L2 pixel format and bytes per line of the first plane for an output format.
+// Returns false if v4l2loopback devices cannot output the format.
+static bool v4l2_format(uint32_t fourcc, uint32_t width,
+                        uint32_t& pixelformat, uint32_t& bytes_per_line) {
+    bytes_per_line = plane_row_bytes(fourcc, 0, width);
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_RAW:
+            pixelformat = V4L2_PIX_FMT_RGB24;
+            return true;
+        case libyuv::FOURCC_24BG:
+            pixelformat = V4L2_PIX_FMT_BGR24;
+            return true;
+        case libyuv::FOURCC_ARGB:
+            // B, G, R and an ignored byte in memory, which the
+            // consumers we know of read more widely than ABGR32.
+            pixelformat = V4L2_PIX_FMT_BGR32;
+            return true;
+        case libyuv::FOURCC_J400:
+            pixelformat = V4L2_PIX_FMT_GREY;
+            return true;
+        case libyuv::FOURCC_I420:
+            pixelformat = V4L2_PIX_FMT_YUV420;
+            return true;
+        case libyuv::FOURCC_NV12:
+            pixelformat = V4L2_PIX_FMT_NV12;
+            return true;
+        case libyuv::FOURCC_YUY2:
+            pixelformat = V4L2_PIX_FMT_YUYV;
+            return true;
+        case libyuv::FOURCC_UYVY:
+            pixelformat = V4L2_PIX_FMT_UYVY;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Colorimetry to signal for frames of an output format in `matrix`.
+// BT.601 limited range is left to v4l2loopback, as before it could be chosen.
+static Colorimetry v4l2_colorimetry(uint32_t fourcc, YuvMatrix matrix) {
+    Colorimetry c;
+    if (matrix == YuvMatrix::BT601Limited) {
+        return c;
+    }
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_RAW:
+        case libyuv::FOURCC_24BG:
+        case libyuv::FOURCC_ARGB:
+            c.colorspace = V4L2_COLORSPACE_SRGB;
+            c.quantization = V4L2_QUANTIZATION_FULL_RANGE;
+            c.xfer_func = V4L2_XFER_FUNC_SRGB;
+            return c;
+        default:
+            break;
+    }
+    switch (matrix) {
+        case YuvMatrix::BT601Limited:
+        case YuvMatrix::BT601Full:
+            c.colorspace = V4L2_COLORSPACE_SMPTE170M;
+            c.ycbcr_enc = V4L2_YCBCR_ENC_601;
+            break;
+        case YuvMatrix::BT709Limited:
+        case YuvMatrix::BT709Full:
+            c.colorspace = V4L2_COLORSPACE_REC709;
+            c.ycbcr_enc = V4L2_YCBCR_ENC_709;
+            break;
+        case YuvMatrix::BT2020Limited:
+        case YuvMatrix::BT2020Full:
+            c.colorspace = V4L2_COLORSPACE_BT2020;
+            c.ycbcr_enc = V4L2_YCBCR_ENC_BT2020;
+            break;
+    }
+    c.quantization = is_full_range(matrix) ?
+        V4L2_QUANTIZATION_FULL_RANGE : V4L2_QUANTIZATION_LIM_RANGE;
+    c.xfer_func = V4L2_XFER_FUNC_709;
+    return c;
+}
+
+// Write statistics of one device, see VirtualOutput::device_stats().
+struct DeviceStats {
+    std::string device;
+    uint64_t frames_written = 0;
+    uint64_t errors = 0;
+    std::string last_error;
+    uint64_t last_write_ns = 0;
+    uint64_t total_write_ns = 0;
+    uint64_t max_write_ns = 0;
+};
+
 class VirtualOutput {
   private:
     bool _output_running = false;
-    std::vector<int> _camera_fds;
-    std::vector<std::string> _camera_devices;
+    std::vector<std::unique_ptr<OutputDevice>> _devices;
+    // Sink of the conversion graph for each device.
+    std::vector<size_t> _device_sinks;
     uint32_t _frame_fourcc;
-    uint32_t _native_fourcc;
-    uint32_t _frame_width;
-    uint32_t _frame_height;
-    uint32_t _out_frame_size;
+    std::unique_ptr<ConversionGraph> _graph;
+    // Only changed rows are converted again if set, into memory of the graph.
+    std::unique_ptr<FrameChanges> _changes;
     std::vector<uint8_t> _buffer_output;
+    std::unique_ptr<ThreadPool> _pool;
+    // Frame memory handed out by acquire_frame() and not committed yet.
+    uint8_t* _acquired = nullptr;
+    // One thread per device, so that devices are written to concurrently.
+    std::unique_ptr<ThreadPool> _write_pool;
+    // Indexed like _devices.
+    std::vector<DeviceStats> _stats;
+    std::mutex _stats_mutex;
+    SendStats _send_stats;
+    FrameSequence _frames;
+
+    // Records a failed operation on device `i`.
+    // Only the first error of each device is printed, all are counted.
+    void record_error(size_t i, int error) {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        DeviceStats& stats = _stats[i];
+        if (stats.errors == 0) {
+            // not an exception, in case it is temporary
+            fprintf(stderr, "error writing frame to %s: %s "
+                    "(further errors are counted in device_stats())\n",
+                    stats.device.c_str(), strerror(error));
+        }
+        stats.errors++;
+        stats.last_error = strerror(error);
+    }
+
+    void record_write(size_t i, uint64_t write_ns) {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        DeviceStats& stats = _stats[i];
+        stats.frames_written++;
+        stats.last_write_ns = write_ns;
+        stats.total_write_ns += write_ns;
+        stats.max_write_ns = std::max(stats.max_write_ns, write_ns);
+    }
+
+    size_t sink_frame_size(size_t sink) {
+        const ConversionGraph::Format& f = _graph->sink_format(sink);
+        return fourcc_frame_size(f.fourcc, f.width, f.height);
+    }
+
+    // Writes the frame of each sink to its devices and returns once all
+    // are done, as the frames may be reused for the next frame.
+    // A frame counts as dropped if writing it to any device failed.
+    // `frame` is the sequence number of the frame for trace events.
+    void write_frame(const std::vector<const uint8_t*>& sink_frames, uint64_t frame) {
+        ScopedTimer timer {_send_stats.output};
+        TRACE_SPAN(output, frame);
+        std::atomic<uint64_t> bytes {0};
+        std::atomic<bool> failed {false};
+        auto write = [&](uint32_t i) {
+            size_t sink = _device_sinks[i];
+            auto start = std::chrono::steady_clock::now();
+            bool ok;
+            {
+                TRACE_SPAN(write, frame);
+                ok = _devices[i]->send(sink_frames[sink], sink_frame_size(sink));
+            }
+            int error = errno;
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            if (ok) {
+                record_write(i, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                bytes.fetch_add(sink_frame_size(sink), std::memory_order_relaxed);
+            } else {
+                record_error(i, error);
+                failed = true;
+            }
+        };
+        uint32_t count = static_cast<uint32_t>(_devices.size());
+        if (_write_pool) {
+            _write_pool->parallel_for(count, write);
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                write(i);
+            }
+        }
+        if (failed) {
+            _send_stats.record_dropped();
+        } else {
+            _send_stats.record_output(bytes);
+        }
+    }
 
   public:
     VirtualOutput(uint32_t width, uint32_t height, uint32_t fourcc,
-                  std::optional<std::vector<std::string>> devices_) {
-        _frame_width = width;
-        _frame_height = height;
+                  std::optional<std::vector<DeviceSpec>> devices_,
+                  IoMethod io_method = IoMethod::Auto, uint32_t threads = 1,
+                  uint32_t input_width = 0, uint32_t input_height = 0,
+                  libyuv::FilterMode filter = libyuv::kFilterBox,
+                  bool skip_unchanged = false, bool native_rgb = false,
+                  YuvMatrix matrix = YuvMatrix::BT601Limited) {
         _frame_fourcc = libyuv::CanonicalFourCC(fourcc);
-        
-        uint32_t out_frame_fmt_v4l;
+        _pool = make_thread_pool(threads);
+
+        // Output format of devices without one of their own.
+        uint32_t default_fourcc;
 
         switch (_frame_fourcc) {
             case libyuv::FOURCC_RAW:
             case libyuv::FOURCC_24BG:
-                // RGB|BGR -> I420
-                _out_frame_size = i420_frame_size(width, height);
-                _buffer_output.resize(_out_frame_size);
-                _native_fourcc = libyuv::FOURCC_I420;
-                out_frame_fmt_v4l = V4L2_PIX_FMT_YUV420;
+            case libyuv::FOURCC_ARGB:
+                // RGB|BGR|BGRA -> I420, or as is if consumers take RGB
+                default_fourcc = native_rgb ? _frame_fourcc : libyuv::FOURCC_I420;
                 break;
-            case libyuv::FOURCC_J400:
-                _out_frame_size = gray_frame_size(width, height);
-                _native_fourcc = _frame_fourcc;
-                out_frame_fmt_v4l = V4L2_PIX_FMT_GREY;
+            case libyuv::FOURCC_ABGR:
+                // RGBA -> I420, or BGRA if consumers take RGB
+                default_fourcc = native_rgb ? libyuv::FOURCC_ARGB : libyuv::FOURCC_I420;
                 break;
-            case libyuv::FOURCC_I420:
-                _out_frame_size = i420_frame_size(width, height);
-                _native_fourcc = _frame_fourcc;
-                out_frame_fmt_v4l = V4L2_PIX_FMT_YUV420;
+            case libyuv::FOURCC_NV21:
+            case libyuv::FOURCC_P010:
+                // NV21|P010 -> NV12, which far more consumers read
+                default_fourcc = libyuv::FOURCC_NV12;
                 break;
+            case libyuv::FOURCC_J400:
+            case libyuv::FOURCC_I420:
             case libyuv::FOURCC_NV12:
-                _out_frame_size = nv12_frame_size(width, height);
-                _native_fourcc = _frame_fourcc;
-                out_frame_fmt_v4l = V4L2_PIX_FMT_NV12;
-                break;
             case libyuv::FOURCC_YUY2:
-                _out_frame_size = yuyv_frame_size(width, height);
-                _native_fourcc = _frame_fourcc;
-                out_frame_fmt_v4l = V4L2_PIX_FMT_YUYV;
-                break;
             case libyuv::FOURCC_UYVY:
-                _out_frame_size = uyvy_frame_size(width, height);
-                _native_fourcc = _frame_fourcc;
-                out_frame_fmt_v4l = V4L2_PIX_FMT_UYVY;
+                default_fourcc = _frame_fourcc;
                 break;
             default:
                 throw std::runtime_error("Unsupported image format.");
@@ -90,7 +299,8 @@ class VirtualOutput {
                     "Device " + device_name + " is already in use."
                 );
             }
-            int camera_fd = open(device_name.c_str(), O_WRONLY | O_SYNC);
+            // Read access is needed to map buffers for streaming I/O.
+            int camera_fd = open(device_name.c_str(), O_RDWR | O_SYNC);
             if (camera_fd == -1) {
                 if (errno == EACCES) {
                     throw std::runtime_error(
@@ -128,6 +338,12 @@ class VirtualOutput {
                         "Device " + device_name + " is not a V4L2 device."
                     );
                 }
+                // Released when the device is closed, also if the process dies.
+                if (flock(camera_fd, LOCK_EX | LOCK_NB) == -1 && errno == EWOULDBLOCK) {
+                    throw std::invalid_argument(
+                        "Device " + device_name + " is already in use by another process."
+                    );
+                }
             } catch (std::exception &ex) {
                 close(camera_fd);
                 throw;
@@ -136,40 +352,20 @@ class VirtualOutput {
         };
 
         bool auto_detect = !devices_.has_value();
-        std::vector<std::string> device_names;
+        std::vector<DeviceSpec> device_specs;
 
         if (!auto_detect) {
-            device_names = devices_.value();
-            if (device_names.empty()) {
+            device_specs = devices_.value();
+            if (device_specs.empty()) {
                 throw std::invalid_argument("Device list cannot be empty.");
             }
         } else {
-            // Auto-detect all potential v4l2loopback devices
+            // Candidates come from the device table, so that
+            // no devices are opened besides the one we use.
             bool found = false;
-            for (size_t i = 0; i < 100; i++) {
-                std::ostringstream device_name_s;
-                device_name_s << "/dev/video" << i;
-                std::string device_name = device_name_s.str();
-
-                // Check if device exists and is valid, but don't keep it open
-                int test_fd = open(device_name.c_str(), O_WRONLY | O_SYNC);
-                if (test_fd == -1) {
-                    continue;
-                }
-
-                struct v4l2_capability camera_cap;
-                bool is_valid = false;
-                if (ioctl(test_fd, VIDIOC_QUERYCAP, &camera_cap) != -1 &&
-                    (camera_cap.capabilities & V4L2_CAP_VIDEO_OUTPUT) &&
-                    strcmp((const char*)camera_cap.driver, "v4l2 loopback") == 0) {
-                    is_valid = true;
-                }
-                close(test_fd);
-
-                if (is_valid) {
-                    device_names.push_back(device_name);
-                    found = true;
-                }
+            for (const DeviceInfo& info : DeviceTable::instance().loopback_devices()) {
+                device_specs.push_back({info.device});
+                found = true;
             }
             if (!found) {
                 throw std::runtime_error(
@@ -180,23 +376,41 @@ class VirtualOutput {
         }
 
         auto cleanup_open_devices = [&]() {
-            for (int fd : _camera_fds) {
-                close(fd);
-            }
-            for (const auto& dev : _camera_devices) {
-                ACTIVE_DEVICES.erase(dev);
+            for (const auto& dev : _devices) {
+                ACTIVE_DEVICES.erase(dev->name());
             }
+            _devices.clear();
         };
 
         bool opened_device = false;
 
+        std::vector<ConversionGraph::Format> sinks;
+
         // Open and configure all devices
-        for (const auto& device_name : device_names) {
-            int camera_fd;
+        for (const auto& spec : device_specs) {
+            const std::string& device_name = spec.name;
+            ConversionGraph::Format out_format {
+                spec.fourcc ? libyuv::CanonicalFourCC(spec.fourcc) : default_fourcc,
+                static_cast<int32_t>(spec.width ? spec.width : width),
+                static_cast<int32_t>(spec.height ? spec.height : height)};
+            uint32_t out_frame_fmt_v4l;
+            uint32_t out_bytes_per_line;
+            if (!v4l2_format(out_format.fourcc, out_format.width, out_frame_fmt_v4l, out_bytes_per_line)) {
+                cleanup_open_devices();
+                throw std::invalid_argument(
+                    "Unsupported output format for device " + device_name + ".");
+            }
+            uint32_t out_frame_size = fourcc_frame_size(out_format.fourcc, out_format.width, out_format.height);
+
+            std::unique_ptr<OutputDevice> dev;
             try {
-                camera_fd = try_open(device_name);
+                dev = std::make_unique<OutputDevice>(device_name, try_open(device_name));
             } catch (const std::invalid_argument& ex) {
                 if (auto_detect) {
+                    if (access(device_name.c_str(), F_OK) != 0) {
+                        // Removed since the table was listed.
+                        DeviceTable::instance().invalidate();
+                    }
                     continue;
                 }
                 cleanup_open_devices();
@@ -206,34 +420,38 @@ class VirtualOutput {
                 throw;
             }
 
-            v4l2_format v4l2_fmt;
-            memset(&v4l2_fmt, 0, sizeof(v4l2_fmt));
-            v4l2_fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-            v4l2_pix_format& pix = v4l2_fmt.fmt.pix;
-            pix.width = width;
-            pix.height = height;
-            pix.pixelformat = out_frame_fmt_v4l;
-
-            // v4l2loopback sets bytesperline, sizeimage, and colorspace for us.
-
-            if (ioctl(camera_fd, VIDIOC_S_FMT, &v4l2_fmt) == -1) {
-                close(camera_fd);
+            v4l2_pix_format pix;
+            if (!dev->set_format(out_format.width, out_format.height, out_frame_fmt_v4l,
+                                 v4l2_colorimetry(out_format.fourcc, matrix), pix)) {
+                std::string error = strerror(errno);
+                dev.reset();
                 // Close any already opened devices before throwing
-                for (int fd : _camera_fds) {
-                    close(fd);
-                }
-                for (const auto& dev : _camera_devices) {
-                    ACTIVE_DEVICES.erase(dev);
-                }
+                cleanup_open_devices();
                 throw std::runtime_error(
                     "Virtual camera device " + device_name +
-                    " could not be configured: " + std::string(strerror(errno))
+                    " could not be configured: " + error
                 );
             }
 
-            _camera_fds.push_back(camera_fd);
-            _camera_devices.push_back(device_name);
+            if (io_method != IoMethod::Write) {
+                // Frames are converted straight into the mapped buffers
+                // which therefore must have the layout we produce.
+                bool packed = pix.sizeimage >= out_frame_size &&
+                    pix.bytesperline == out_bytes_per_line;
+                bool started = packed && dev->start_streaming(STREAMING_BUFFER_COUNT, out_frame_size);
+                if (!started && io_method == IoMethod::Mmap) {
+                    dev.reset();
+                    cleanup_open_devices();
+                    throw std::runtime_error(
+                        "Virtual camera device " + device_name +
+                        " does not support streaming I/O."
+                    );
+                }
+            }
+
             ACTIVE_DEVICES.insert(device_name);
+            _devices.push_back(std::move(dev));
+            sinks.push_back(out_format);
             opened_device = true;
 
             if (auto_detect) {
@@ -251,6 +469,39 @@ class VirtualOutput {
             throw std::runtime_error("Failed to open any of the requested devices.");
         }
 
+        // Devices with the same format share a sink.
+        std::vector<ConversionGraph::Format> unique_sinks;
+        for (const auto& format : sinks) {
+            size_t sink = 0;
+            while (sink < unique_sinks.size() && !(unique_sinks[sink] == format)) {
+                sink++;
+            }
+            if (sink == unique_sinks.size()) {
+                unique_sinks.push_back(format);
+            }
+            _device_sinks.push_back(sink);
+        }
+        try {
+            // Frames sent at another size are scaled as part of the graph.
+            _graph = std::make_unique<ConversionGraph>(
+                ConversionGraph::Format {_frame_fourcc,
+                    static_cast<int32_t>(input_width ? input_width : width),
+                    static_cast<int32_t>(input_height ? input_height : height)},
+                unique_sinks, filter, matrix);
+        } catch (std::exception&) {
+            cleanup_open_devices();
+            throw;
+        }
+        if (skip_unchanged) {
+            _changes = std::make_unique<FrameChanges>(_frame_fourcc,
+                input_width ? input_width : width, input_height ? input_height : height);
+        }
+
+        for (const auto& dev : _devices) {
+            _stats.push_back({dev->name()});
+        }
+        _write_pool = make_thread_pool(static_cast<uint32_t>(_devices.size()));
+
         _output_running = true;
     }
 
@@ -259,66 +510,128 @@ class VirtualOutput {
             return;
         }
 
-        for (int fd : _camera_fds) {
-            close(fd);
-        }
-
-        for (const auto& device : _camera_devices) {
-            ACTIVE_DEVICES.erase(device);
+        _write_pool.reset();
+        for (const auto& dev : _devices) {
+            ACTIVE_DEVICES.erase(dev->name());
         }
+        _devices.clear();
+        _acquired = nullptr;
 
         _output_running = false;
     }
 
-    void send(const uint8_t* frame) {
+    // `dirty` lists the rectangles that changed since the previous
+    // frame if frames are only converted where they changed.
+    void send(const Planes& frame, const std::vector<DirtyRect>* dirty = nullptr) {
         if (!_output_running)
             return;
+        uint64_t frame_number = _frames.next();
+
+        // Supersedes a frame from acquire_frame(), which may share the buffer.
+        _acquired = nullptr;
+
+        if (_changes) {
+            // The previous conversions are kept in the graph and
+            // copied into device buffers like for write() I/O.
+            ScopedTimer timer {_send_stats.convert};
+            TRACE_SPAN(convert, frame_number);
+            const std::vector<RowBand>& bands = _changes->update(frame, dirty);
+            if (bands.empty()) {
+                _send_stats.record_unchanged();
+            }
+            _graph->run_bands(frame, bands, _pool.get());
+        } else {
+            // Each sink is converted straight into the next buffer of its first
+            // device that uses streaming I/O. All other devices get a copy.
+            std::vector<uint8_t*> dst(_graph->sink_count());
+            for (size_t i = 0; i < _devices.size(); i++) {
+                size_t sink = _device_sinks[i];
+                if (!dst[sink] && _devices[i]->streaming()) {
+                    dst[sink] = _devices[i]->next_buffer();
+                    if (!dst[sink]) {
+                        record_error(i, errno);
+                    }
+                }
+            }
 
-        uint8_t* out_frame;
+            ScopedTimer timer {_send_stats.convert};
+            TRACE_SPAN(convert, frame_number);
+            _graph->run(frame, dst, _pool.get());
+        }
 
-        switch (_frame_fourcc) {
-            case libyuv::FOURCC_RAW:
-                out_frame = _buffer_output.data();
-                rgb_to_i420(frame, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_24BG:
-                out_frame = _buffer_output.data();
-                bgr_to_i420(frame, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_J400:
-            case libyuv::FOURCC_I420:
-            case libyuv::FOURCC_NV12:
-            case libyuv::FOURCC_YUY2:
-            case libyuv::FOURCC_UYVY:
-                out_frame = const_cast<uint8_t*>(frame);
-                break;
-            default:
-                throw std::logic_error("not implemented");
+        std::vector<const uint8_t*> sink_frames(_graph->sink_count());
+        for (size_t sink = 0; sink < sink_frames.size(); sink++) {
+            sink_frames[sink] = _graph->output(sink);
         }
+        write_frame(sink_frames, frame_number);
+    }
 
-        // Write to all devices
-        for (size_t i = 0; i < _camera_fds.size(); i++) {
-            ssize_t n = write(_camera_fds[i], out_frame, _out_frame_size);
-            if (n == -1) {
-                // not an exception, in case it is temporary
-                fprintf(stderr, "error writing frame to %s: %s\n",
-                        _camera_devices[i].c_str(), strerror(errno));
+    // Native-format memory to fill before calling commit_frame().
+    // With streaming I/O, this is the next mapped buffer of the first device.
+    // As there is no input to convert, all devices must use the same format.
+    Planes acquire_frame() {
+        if (!_output_running) {
+            throw std::runtime_error("virtual camera output is not running");
+        }
+        if (_graph->sink_count() > 1) {
+            throw std::runtime_error(
+                "acquire_frame() requires all devices to use the same format and size");
+        }
+        const ConversionGraph::Format& format = native_format();
+        if (!_acquired) {
+            OutputDevice& first = *_devices[0];
+            if (first.streaming()) {
+                _acquired = first.next_buffer();
+                if (!_acquired) {
+                    throw std::runtime_error(
+                        "error dequeuing buffer of " + first.name() + ": " + strerror(errno));
+                }
+            } else {
+                _buffer_output.resize(sink_frame_size(0));
+                _acquired = _buffer_output.data();
             }
         }
+        return fourcc_planes(format.fourcc, _acquired, format.width, format.height);
+    }
+
+    void commit_frame() {
+        if (!_output_running)
+            return;
+        if (!_acquired) {
+            throw std::runtime_error("commit_frame() called without acquire_frame()");
+        }
+        const uint8_t* out_frame = _acquired;
+        _acquired = nullptr;
+        write_frame({out_frame}, _frames.next());
     }
 
     std::string device() {
-        if (_camera_devices.empty()) {
+        if (_devices.empty()) {
             return "";
         }
-        std::string result = _camera_devices[0];
-        for (size_t i = 1; i < _camera_devices.size(); i++) {
-            result += ", " + _camera_devices[i];
+        std::string result = _devices[0]->name();
+        for (size_t i = 1; i < _devices.size(); i++) {
+            result += ", " + _devices[i]->name();
         }
         return result;
     }
 
+    // Output format and size of the first device.
+    const ConversionGraph::Format& native_format() {
+        return _graph->sink_format(_device_sinks[0]);
+    }
+
     uint32_t native_fourcc() {
-        return _native_fourcc;
+        return native_format().fourcc;
+    }
+
+    SendStats& send_stats() {
+        return _send_stats;
+    }
+
+    // Per-device counters, also available after stop().
+    std::vector<DeviceStats> device_stats() {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        return _stats;
     }
 };
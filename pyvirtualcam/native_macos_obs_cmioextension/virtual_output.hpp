@@ -29,18 +29,49 @@
 #include <mutex>
 #include <string>
 #include <vector>
+#include "../native_shared/frame_changes.h"
 #include "../native_shared/image_formats.h"
+#include "../native_shared/stats.h"
+#include "../native_shared/trace.h"
+#include "../native_shared/yuv_matrix.h"
 
 
 // This is pulled out of OBS. We can probably assume that if this changes, the camera will be incompatible anyways.
 constexpr const char *OBS_DEVICE_UUID = "7626645E-4425-469E-9D8B-97E0FA59AC75";
 
+// Pixel buffers allocated up front: a few in the queue of the extension,
+// one shown, and one spare for `lastConvertedFrame` or acquire_frame().
+constexpr int PIXEL_BUFFER_POOL_SIZE = 6;
+
+// Pixel buffer attachments that tell consumers how to convert the
+// UYVY frames to RGB, or nil for BT.601 which they assume without.
+static NSDictionary* colorimetry_attachments(YuvMatrix matrix) {
+    switch (matrix) {
+        case YuvMatrix::BT709Limited:
+            return @{
+                (id)kCVImageBufferYCbCrMatrixKey: (id)kCVImageBufferYCbCrMatrix_ITU_R_709_2,
+                (id)kCVImageBufferColorPrimariesKey: (id)kCVImageBufferColorPrimaries_ITU_R_709_2,
+                (id)kCVImageBufferTransferFunctionKey: (id)kCVImageBufferTransferFunction_ITU_R_709_2
+            };
+        case YuvMatrix::BT2020Limited:
+            return @{
+                (id)kCVImageBufferYCbCrMatrixKey: (id)kCVImageBufferYCbCrMatrix_ITU_R_2020,
+                (id)kCVImageBufferColorPrimariesKey: (id)kCVImageBufferColorPrimaries_ITU_R_2020,
+                (id)kCVImageBufferTransferFunctionKey: (id)kCVImageBufferTransferFunction_ITU_R_2020
+            };
+        default:
+            return nil;
+    }
+}
+
 class VirtualOutput {
   private:
     static std::mutex mutex;
 
     std::unique_lock<std::mutex> lock;
     CVPixelBufferPoolRef pixelBufferPool;
+    // Makes the pool report when it would grow past its prewarmed size.
+    NSDictionary *pixelBufferPoolThreshold = nil;
 
     CMIOObjectID deviceID{0};
     CMIOStreamID streamID{0};
@@ -50,12 +81,123 @@ class VirtualOutput {
     uint32_t frameWidth;
     uint32_t frameHeight;
     uint32_t frameFourCC;
-    uint32_t frameSize;
-    std::vector<uint8_t> bufferTmp;
-    std::vector<uint8_t> bufferOutput;
+    // Picked once for the input format.
+    Converter convert = nullptr;
+    // Only changed rows are converted again if set, into a copy of
+    // `lastConvertedFrame`, which is sent again if nothing changed.
+    std::unique_ptr<FrameChanges> changes;
+    CVPixelBufferRef lastConvertedFrame = NULL;
+    std::unique_ptr<ThreadPool> pool;
+    // Locked pixel buffer handed out by acquire_frame() and not committed yet.
+    CVPixelBufferRef acquiredFrame = NULL;
+    SendStats stats;
+    FrameSequence frames;
+
+    // Enqueues and releases a pixel buffer.
+    // `frame` is the sequence number of the frame for trace events.
+    void enqueuePixelBuffer(CVPixelBufferRef frameRef, uint64_t frame) {
+        CMSampleBufferRef sampleBuffer;
+        CMSampleTimingInfo timingInfo = {
+            .presentationTimeStamp = CMTimeMake(clock_gettime_nsec_np(CLOCK_UPTIME_RAW), 1000000000ull),
+        };
+        OSStatus status;
+        {
+            ScopedTimer timer {stats.output};
+            TRACE_SPAN(output, frame);
+            status = CMSampleBufferCreateForImageBuffer(kCFAllocatorDefault, frameRef, true, NULL, NULL, formatDescription, &timingInfo, &sampleBuffer);
+            if (status == noErr) {
+                status = CMSimpleQueueEnqueue(queue, sampleBuffer);
+                if (status != noErr) {
+                    // Dequeued sample buffers are released by the extension,
+                    // this one never got there.
+                    CFRelease(sampleBuffer);
+                }
+            }
+        }
+        if (status == noErr) {
+            stats.record_output(uyvy_frame_size(frameWidth, frameHeight));
+        } else {
+            // The extension is not keeping up with the queue.
+            stats.record_dropped();
+        }
+
+        CVPixelBufferRelease(frameRef);
+    }
+
+    // Pixel buffers of the caller are enqueued as is and the extension maps
+    // their surface, so they must be like the ones from the pool.
+    void checkPixelBuffer(CVPixelBufferRef buffer) {
+        if (buffer == NULL) {
+            throw std::invalid_argument("Pixel buffer must not be NULL.");
+        }
+        if (CVPixelBufferGetPixelFormatType(buffer) != kCVPixelFormatType_422YpCbCr8) {
+            throw std::invalid_argument("Pixel buffers must be in UYVY format ('2vuy').");
+        }
+        if (CVPixelBufferGetWidth(buffer) != frameWidth ||
+            CVPixelBufferGetHeight(buffer) != frameHeight) {
+            throw std::invalid_argument(
+                "Pixel buffers must be " + std::to_string(frameWidth) + "x" +
+                std::to_string(frameHeight) + ".");
+        }
+        if (CVPixelBufferGetIOSurface(buffer) == NULL) {
+            throw std::invalid_argument("Pixel buffers must be backed by an IOSurface.");
+        }
+    }
+
+    // Takes a pixel buffer from the pool, allocating one if all prewarmed
+    // buffers are still in use, which is counted in the stats.
+    CVReturn createPixelBuffer(CVPixelBufferRef *buffer) {
+        CVReturn status = CVPixelBufferPoolCreatePixelBufferWithAuxAttributes(
+            kCFAllocatorDefault, pixelBufferPool, (__bridge CFDictionaryRef)pixelBufferPoolThreshold, buffer);
+        if (status == kCVReturnWouldExceedAllocationThreshold) {
+            stats.record_pool_exhausted();
+            status = CVPixelBufferPoolCreatePixelBuffer(kCFAllocatorDefault, pixelBufferPool, buffer);
+        }
+        return status;
+    }
+
+    // Allocates all buffers of the pool before the first frame.
+    void prewarmPool() {
+        CVPixelBufferRef buffers[PIXEL_BUFFER_POOL_SIZE] = {};
+        for (CVPixelBufferRef &buffer : buffers) {
+            if (CVPixelBufferPoolCreatePixelBuffer(kCFAllocatorDefault, pixelBufferPool, &buffer) != kCVReturnSuccess) {
+                buffer = NULL;
+            }
+        }
+        // Released buffers go back into the pool.
+        for (CVPixelBufferRef buffer : buffers) {
+            if (buffer != NULL) {
+                CVPixelBufferRelease(buffer);
+            }
+        }
+    }
+
+    // Rows of pixel buffers may be padded.
+    static Planes pixelBufferPlanes(CVPixelBufferRef buffer) {
+        Planes planes;
+        planes.data[0] = (uint8_t *)CVPixelBufferGetBaseAddress(buffer);
+        planes.stride[0] = static_cast<int32_t>(CVPixelBufferGetBytesPerRow(buffer));
+        return planes;
+    }
+
+    // Converts the `bands` of `frame` that changed into `dst`,
+    // and the rest of it is copied from the last converted frame.
+    void convertChanges(const Planes& frame, const std::vector<RowBand>& bands, const Planes& dst) {
+        if (lastConvertedFrame != NULL) {
+            CVPixelBufferLockBaseAddress(lastConvertedFrame, kCVPixelBufferLock_ReadOnly);
+            copy_frame(libyuv::FOURCC_UYVY, pixelBufferPlanes(lastConvertedFrame), dst,
+                       frameWidth, frameHeight);
+            CVPixelBufferUnlockBaseAddress(lastConvertedFrame, kCVPixelBufferLock_ReadOnly);
+        }
+        convert_bands(convert,
+            frameFourCC, frame, libyuv::FOURCC_UYVY, dst,
+            frameWidth, bands, pool.get());
+    }
 
   public:
-    VirtualOutput(uint32_t width, uint32_t height, uint32_t fourcc, std::optional<std::string> device_) : lock(mutex, std::try_to_lock) {
+    VirtualOutput(uint32_t width, uint32_t height, uint32_t fourcc, std::optional<std::string> device_,
+                  uint32_t threads = 1, bool skip_unchanged = false,
+                  YuvMatrix matrix = YuvMatrix::BT601Limited) : lock(mutex, std::try_to_lock) {
         if (device_.has_value() && device_ != device()) {
             throw std::invalid_argument(
                 "This backend supports only the '" + device() + "' device."
@@ -66,55 +208,55 @@ class VirtualOutput {
             throw std::runtime_error("Multiple cameras are not supported by this backend.");
         }
 
+        if (is_full_range(matrix)) {
+            // '2vuy' pixel buffers are video range by definition.
+            throw std::invalid_argument("This backend supports only the 'limited' range.");
+        }
+
         frameFourCC = libyuv::CanonicalFourCC(fourcc);
         frameWidth = width;
         frameHeight = height;
 
-        frameSize = uyvy_frame_size(width, height);
+        // Conversions write directly into the pixel buffers from the pool.
+        // RGB|BGR|BGRA|GRAY|I420|NV12|YUYV|UYVY -> UYVY
+        convert = find_output_converter(frameFourCC, libyuv::FOURCC_UYVY, matrix);
+        if (!convert) {
+            throw std::runtime_error("Unsupported image format.");
+        }
 
-        switch (frameFourCC) {
-            case libyuv::FOURCC_RAW:
-            case libyuv::FOURCC_24BG:
-            case libyuv::FOURCC_J400:
-                // RGB|BGR|GRAY -> BGRA -> UYVY
-                bufferTmp.resize(bgra_frame_size(width, height));
-                bufferOutput.resize(frameSize);
-                break;
-            case libyuv::FOURCC_I420:
-                // I420 -> UYVY
-                bufferOutput.resize(frameSize);
-                break;
-            case libyuv::FOURCC_NV12:
-                // NV12 -> I420 -> UYVY
-                bufferTmp.resize(i420_frame_size(width, height));
-                bufferOutput.resize(frameSize);
-                break;
-            case libyuv::FOURCC_YUY2:
-                // YUYV -> I422 -> UYVY
-                bufferTmp.resize(i422_frame_size(width, height));
-                bufferOutput.resize(frameSize);
-                break;
-            case libyuv::FOURCC_UYVY:
-                break;
-            default:
-                throw std::runtime_error("Unsupported image format.");
+        pool = make_thread_pool(threads);
+        if (skip_unchanged) {
+            changes = std::make_unique<FrameChanges>(frameFourCC, width, height);
         }
 
         FourCharCode videoFormat = kCVPixelFormatType_422YpCbCr8; // UYVY
 
-        NSDictionary *pAttr = @{};
-        NSDictionary *pbAttr = @{
+        NSDictionary *pAttr = @{
+            (id)kCVPixelBufferPoolMinimumBufferCountKey: @(PIXEL_BUFFER_POOL_SIZE),
+            // Idle buffers are kept instead of being freed after a second.
+            (id)kCVPixelBufferPoolMaximumBufferAgeKey: @0
+        };
+        NSMutableDictionary *pbAttr = [NSMutableDictionary dictionaryWithDictionary:@{
             (id)kCVPixelBufferPixelFormatTypeKey: @(videoFormat),
             (id)kCVPixelBufferWidthKey: @(frameWidth),
             (id)kCVPixelBufferHeightKey: @(frameHeight),
             (id)kCVPixelBufferIOSurfacePropertiesKey: @{}
-        };
+        }];
+        NSDictionary *attachments = colorimetry_attachments(matrix);
+        if (attachments != nil) {
+            // Set on every buffer of the pool.
+            pbAttr[(id)kCVBufferPropagatedAttachmentsKey] = attachments;
+        }
         CVReturn status = CVPixelBufferPoolCreate(
             kCFAllocatorDefault, (__bridge CFDictionaryRef)pAttr,
             (__bridge CFDictionaryRef)pbAttr, &pixelBufferPool);
         if (status != kCVReturnSuccess) {
             throw std::runtime_error("unable to allocate pixel buffer pool");
         }
+        prewarmPool();
+        pixelBufferPoolThreshold = [@{
+            (id)kCVPixelBufferPoolAllocationThresholdKey: @(PIXEL_BUFFER_POOL_SIZE)
+        } retain];
 
         UInt32 size;
         UInt32 used;
@@ -161,7 +303,9 @@ class VirtualOutput {
 
 
         CMIOStreamCopyBufferQueue(streamID, [](CMIOStreamID, void *, void *){}, NULL, &queue);
-        CMVideoFormatDescriptionCreate(kCFAllocatorDefault, videoFormat, frameWidth, frameHeight, NULL, &formatDescription);
+        // Same keys as the attachments, which sample buffers must match.
+        CMVideoFormatDescriptionCreate(kCFAllocatorDefault, videoFormat, frameWidth, frameHeight,
+                                       (__bridge CFDictionaryRef)attachments, &formatDescription);
 
         OSStatus result = CMIODeviceStartStream(deviceID, streamID);
         if (result != noErr) {
@@ -170,88 +314,142 @@ class VirtualOutput {
     }
 
     void stop() {
+        if (acquiredFrame != NULL) {
+            CVPixelBufferUnlockBaseAddress(acquiredFrame, 0);
+            CVPixelBufferRelease(acquiredFrame);
+            acquiredFrame = NULL;
+        }
+        if (lastConvertedFrame != NULL) {
+            CVPixelBufferRelease(lastConvertedFrame);
+            lastConvertedFrame = NULL;
+        }
         CMIODeviceStopStream(deviceID, streamID);
         CFRelease(formatDescription);
+        [pixelBufferPoolThreshold release];
+        pixelBufferPoolThreshold = nil;
         CVPixelBufferPoolRelease(pixelBufferPool);
     }
 
-    void send(const uint8_t* frame) {
+    // `dirty` lists the rectangles that changed since the previous
+    // frame if frames are only converted where they changed.
+    void send(const Planes& frame, const std::vector<DirtyRect>* dirty = nullptr) {
         if (streamID == 0) {
             throw std::runtime_error("Stream does not exist.");
         }
-
-        uint8_t* tmp = bufferTmp.data();
-        uint8_t* outFrame;
-
-        switch (frameFourCC) {
-            case libyuv::FOURCC_RAW:
-                outFrame = bufferOutput.data();
-                rgb_to_bgra(frame, tmp, frameWidth, frameHeight);
-                bgra_to_uyvy(tmp, outFrame, frameWidth, frameHeight);
-                break;
-            case libyuv::FOURCC_24BG:
-                outFrame = bufferOutput.data();
-                bgr_to_bgra(frame, tmp, frameWidth, frameHeight);
-                bgra_to_uyvy(tmp, outFrame, frameWidth, frameHeight);
-                break;
-            case libyuv::FOURCC_J400:
-                outFrame = bufferOutput.data();
-                gray_to_bgra(frame, tmp, frameWidth, frameHeight);
-                bgra_to_uyvy(tmp, outFrame, frameWidth, frameHeight);
-                break;
-            case libyuv::FOURCC_I420:
-                outFrame = bufferOutput.data();
-                i420_to_uyvy(frame, outFrame, frameWidth, frameHeight);
-                break;
-            case libyuv::FOURCC_NV12:
-                outFrame = bufferOutput.data();
-                nv12_to_i420(frame, tmp, frameWidth, frameHeight);
-                i420_to_uyvy(tmp, outFrame, frameWidth, frameHeight);
-                break;
-            case libyuv::FOURCC_YUY2:
-                outFrame = bufferOutput.data();
-                yuyv_to_i422(frame, tmp, frameWidth, frameHeight);
-                i422_to_uyvy(tmp, outFrame, frameWidth, frameHeight);
-                break;
-            case libyuv::FOURCC_UYVY:
-                outFrame = const_cast<uint8_t*>(frame);
-                break;
-            default:
-                throw std::logic_error("not implemented");
+        uint64_t frameNumber = frames.next();
+
+        std::vector<RowBand> bands;
+        if (changes) {
+            bands = changes->update(frame, dirty);
+            if (bands.empty()) {
+                // The extension only reads pixel buffers, so the same one can be sent again.
+                stats.record_unchanged();
+                enqueuePixelBuffer(CVPixelBufferRetain(lastConvertedFrame), frameNumber);
+                return;
+            }
         }
 
         CVPixelBufferRef frameRef;
-        CVReturn status = CVPixelBufferPoolCreatePixelBuffer(
-            kCFAllocatorDefault, pixelBufferPool, &frameRef);
+        CVReturn status = createPixelBuffer(&frameRef);
 
         if (status != kCVReturnSuccess) {
             // not an exception, in case it is temporary
             fprintf(stderr, "unable to allocate pixel buffer (error %d)",
                 status);
+            if (changes) {
+                // The changes were not converted anywhere.
+                changes->invalidate();
+            }
+            stats.record_dropped();
             return;
         }
 
         CVPixelBufferLockBaseAddress(frameRef, 0);
 
-        uint8_t *dst = (uint8_t *)CVPixelBufferGetBaseAddress(frameRef);
-        int dst_size = CVPixelBufferGetDataSize(frameRef);
+        Planes dst = pixelBufferPlanes(frameRef);
 
-        if (dst_size == frameSize) {
-			memcpy(dst, outFrame, frameSize);
-        } else {
-            fprintf(stderr, "Pixel buffer size mismatch");
+        {
+            ScopedTimer timer {stats.convert};
+            TRACE_SPAN(convert, frameNumber);
+            if (changes) {
+                convertChanges(frame, bands, dst);
+            } else {
+                convert_frame(convert,
+                    frameFourCC, frame, libyuv::FOURCC_UYVY, dst,
+                    frameWidth, frameHeight, pool.get());
+            }
         }
 
         CVPixelBufferUnlockBaseAddress(frameRef, 0);
 
-        CMSampleBufferRef sampleBuffer;
-        CMSampleTimingInfo timingInfo = {
-            .presentationTimeStamp = CMTimeMake(clock_gettime_nsec_np(CLOCK_UPTIME_RAW), 1000000000ull),
-        };
-        CMSampleBufferCreateForImageBuffer(kCFAllocatorDefault, frameRef, true, NULL, NULL, formatDescription, &timingInfo, &sampleBuffer);
-        CMSimpleQueueEnqueue(queue, sampleBuffer);
+        if (changes) {
+            if (lastConvertedFrame != NULL) {
+                CVPixelBufferRelease(lastConvertedFrame);
+            }
+            lastConvertedFrame = CVPixelBufferRetain(frameRef);
+        }
+        enqueuePixelBuffer(frameRef, frameNumber);
+    }
 
-        CVPixelBufferRelease(frameRef);
+    // Native-format memory to fill before calling commit_frame().
+    // This is a locked pixel buffer from the pool, which is sent as is.
+    Planes acquire_frame() {
+        if (streamID == 0) {
+            throw std::runtime_error("Stream does not exist.");
+        }
+        if (acquiredFrame == NULL) {
+            CVReturn status = createPixelBuffer(&acquiredFrame);
+            if (status != kCVReturnSuccess) {
+                acquiredFrame = NULL;
+                throw std::runtime_error(
+                    "unable to allocate pixel buffer (error " + std::to_string(status) + ")");
+            }
+            CVPixelBufferLockBaseAddress(acquiredFrame, 0);
+        }
+        return pixelBufferPlanes(acquiredFrame);
+    }
+
+    void commit_frame() {
+        if (acquiredFrame == NULL) {
+            throw std::runtime_error("commit_frame() called without acquire_frame()");
+        }
+        CVPixelBufferRef frameRef = acquiredFrame;
+        acquiredFrame = NULL;
+        CVPixelBufferUnlockBaseAddress(frameRef, 0);
+        enqueuePixelBuffer(frameRef, frames.next());
+    }
+
+    // Enqueues a UYVY pixel buffer of the caller without converting or
+    // copying it, like one rendered into on the GPU. The extension reads its
+    // surface after this returns, so it must not be written to while it may
+    // be shown.
+    void send_cvpixelbuffer(CVPixelBufferRef buffer) {
+        if (streamID == 0) {
+            throw std::runtime_error("Stream does not exist.");
+        }
+        checkPixelBuffer(buffer);
+        enqueuePixelBuffer(CVPixelBufferRetain(buffer), frames.next());
+    }
+
+    // Like send_cvpixelbuffer(), for a UYVY surface.
+    void send_iosurface(IOSurfaceRef surface) {
+        if (surface == NULL) {
+            throw std::invalid_argument("IOSurface must not be NULL.");
+        }
+        CVPixelBufferRef buffer = NULL;
+        CVReturn status = CVPixelBufferCreateWithIOSurface(
+            kCFAllocatorDefault, surface, NULL, &buffer);
+        if (status != kCVReturnSuccess) {
+            throw std::invalid_argument(
+                "unable to wrap IOSurface in a pixel buffer (error " + std::to_string(status) + ")");
+        }
+        try {
+            send_cvpixelbuffer(buffer);
+        } catch (...) {
+            CVPixelBufferRelease(buffer);
+            throw;
+        }
+        CVPixelBufferRelease(buffer);
     }
 
     std::string device()
@@ -263,6 +461,10 @@ class VirtualOutput {
     uint32_t native_fourcc() {
         return libyuv::FOURCC_UYVY;
     }
+
+    SendStats& send_stats() {
+        return stats;
+    }
 };
 
 std::mutex VirtualOutput::mutex;
@@ -76,7 +76,10 @@
 			blog(LOG_DEBUG,
 			     "mach server received connect message from port %d!",
 			     ((NSMachPort *)message.sendPort).machPort);
-			[self.clientPorts addObject:message.sendPort];
+			// Frames may be sent from another thread.
+			@synchronized(self.clientPorts) {
+				[self.clientPorts addObject:message.sendPort];
+			}
 		}
 		break;
 	default:
@@ -88,25 +91,33 @@
 
 - (void)sendMessageToClientsWithMsgId:(uint32_t)msgId
 			   components:(nullable NSArray *)components
+{
+	@synchronized(self.clientPorts) {
+		[self sendMessageToClientsLockedWithMsgId:msgId
+					       components:components];
+	}
+}
+
+- (void)sendMessageToClientsLockedWithMsgId:(uint32_t)msgId
+				 components:(nullable NSArray *)components
 {
 	if ([self.clientPorts count] <= 0) {
 		return;
 	}
 
 	NSMutableSet *removedPorts = [NSMutableSet set];
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:1.0];
 
 	for (NSPort *port in self.clientPorts) {
 		@try {
-			NSPortMessage *message = [[NSPortMessage alloc]
+			// Not built with ARC, messages are released by the caller's pool.
+			NSPortMessage *message = [[[NSPortMessage alloc]
 				initWithSendPort:port
 				     receivePort:nil
-				      components:components];
+				      components:components] autorelease];
 			message.msgid = msgId;
 			if (![port isValid] ||
-			    ![message
-				    sendBeforeDate:
-					    [NSDate dateWithTimeIntervalSinceNow:
-							    1.0]]) {
+			    ![message sendBeforeDate:deadline]) {
 				blog(LOG_DEBUG,
 				     "failed to send message to %d, removing it from the clients!",
 				     ((NSMachPort *)port).machPort);
@@ -133,8 +144,10 @@
 	   fpsNumerator:(uint32_t)fpsNumerator
 	 fpsDenominator:(uint32_t)fpsDenominator
 {
-	if ([self.clientPorts count] <= 0) {
-		return;
+	@synchronized(self.clientPorts) {
+		if ([self.clientPorts count] <= 0) {
+			return;
+		}
 	}
 
 	@autoreleasepool {
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <CoreFoundation/CoreFoundation.h>
+#include "server/OBSDALMachServer.h"
+#include "../native_shared/mailbox.h"
+
+// A frame waiting to be sent to the clients,
+// which owns one reference to its pixel buffer.
+struct PendingFrame {
+    CVPixelBufferRef buffer;
+    uint64_t timestamp;
+
+    PendingFrame(CVPixelBufferRef buffer_, uint64_t timestamp_)
+     : buffer {buffer_}, timestamp {timestamp_} {}
+    PendingFrame(const PendingFrame&) = delete;
+    PendingFrame& operator=(const PendingFrame&) = delete;
+
+    ~PendingFrame() {
+        CVPixelBufferRelease(buffer);
+    }
+};
+
+// Runs the Mach server on a thread of its own, whose run loop handles
+// client connections as they arrive and sends frames to all clients.
+//
+// Producers post frames into a single-slot mailbox and wake the run loop,
+// so they never wait for clients. If a client stalls, frames posted in
+// the meantime replace each other and only the latest one is sent.
+class MachServerThread {
+  public:
+    MachServerThread(uint32_t fps_num, uint32_t fps_den)
+     : _fps_num {fps_num}, _fps_den {fps_den} {
+        std::promise<bool> started;
+        std::future<bool> started_future = started.get_future();
+        _thread = std::thread(&MachServerThread::run, this, std::move(started));
+        if (!started_future.get()) {
+            _thread.join();
+            throw std::runtime_error("virtual camera output could not be started");
+        }
+    }
+
+    MachServerThread(const MachServerThread&) = delete;
+    MachServerThread& operator=(const MachServerThread&) = delete;
+
+    ~MachServerThread() {
+        stop();
+    }
+
+    // Takes over the reference to `buffer`. May be called from any thread.
+    // Returns false if this replaced a frame that was not sent yet.
+    bool post(CVPixelBufferRef buffer, uint64_t timestamp) {
+        std::unique_ptr<PendingFrame> replaced =
+            _mailbox.post(std::make_unique<PendingFrame>(buffer, timestamp));
+        wake();
+        return replaced == nullptr;
+    }
+
+    // Sends the last posted frame and a stop message to the clients,
+    // and closes the server port.
+    void stop() {
+        if (!_thread.joinable()) {
+            return;
+        }
+        _stopping = true;
+        wake();
+        _thread.join();
+    }
+
+  private:
+    uint32_t _fps_num;
+    uint32_t _fps_den;
+    Mailbox<PendingFrame> _mailbox;
+    std::atomic<bool> _stopping {false};
+    // Created by the thread before the constructor returns.
+    OBSDALMachServer* _server = nil;
+    CFRunLoopRef _run_loop = nullptr;
+    CFRunLoopSourceRef _source = nullptr;
+    std::thread _thread;
+
+    void wake() {
+        CFRunLoopSourceSignal(_source);
+        CFRunLoopWakeUp(_run_loop);
+    }
+
+    void send_pending() {
+        std::unique_ptr<PendingFrame> frame = _mailbox.take();
+        if (!frame) {
+            return;
+        }
+        [_server sendPixelBuffer:frame->buffer
+            timestamp:frame->timestamp
+            fpsNumerator:_fps_num
+            fpsDenominator:_fps_den];
+    }
+
+    void run(std::promise<bool> started) {
+        @autoreleasepool {
+            // The server port is scheduled in the run loop of this thread.
+            _server = [[OBSDALMachServer alloc] init];
+            if (![_server run]) {
+                [_server dealloc];
+                _server = nil;
+                started.set_value(false);
+                return;
+            }
+            _run_loop = CFRunLoopGetCurrent();
+            CFRunLoopSourceContext context {};
+            context.info = this;
+            context.perform = [](void* info) {
+                static_cast<MachServerThread*>(info)->send_pending();
+            };
+            _source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+            CFRunLoopAddSource(_run_loop, _source, kCFRunLoopDefaultMode);
+        }
+        started.set_value(true);
+
+        NSRunLoop* run_loop = [NSRunLoop currentRunLoop];
+        while (!_stopping) {
+            @autoreleasepool {
+                // Returns after handling a port message or posted frames.
+                [run_loop runMode:NSDefaultRunLoopMode beforeDate:[NSDate distantFuture]];
+            }
+        }
+
+        @autoreleasepool {
+            send_pending();
+            [_server stop];
+            CFRunLoopRemoveSource(_run_loop, _source, kCFRunLoopDefaultMode);
+            CFRelease(_source);
+            [_server dealloc];
+            _server = nil;
+        }
+    }
+};
@@ -22,26 +22,154 @@
 
 #include <stdexcept>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include <mach/mach_time.h>
-#include "server/OBSDALMachServer.h"
+#include "server_thread.h"
+#include "../native_shared/frame_changes.h"
 #include "../native_shared/image_formats.h"
+#include "../native_shared/stats.h"
+#include "../native_shared/trace.h"
+#include "../native_shared/yuv_matrix.h"
+
+// Pixel buffers allocated up front: one in the mailbox of the server
+// thread, one being sent, one shown by clients, and one spare
+// for `_last_converted` or acquire_frame().
+static constexpr int PIXEL_BUFFER_POOL_SIZE = 4;
+
+// Pixel buffer attachments that tell consumers how to convert the
+// UYVY frames to RGB, or nil for BT.601 which they assume without.
+static NSDictionary* colorimetry_attachments(YuvMatrix matrix) {
+    switch (matrix) {
+        case YuvMatrix::BT709Limited:
+            return @{
+                (id)kCVImageBufferYCbCrMatrixKey: (id)kCVImageBufferYCbCrMatrix_ITU_R_709_2,
+                (id)kCVImageBufferColorPrimariesKey: (id)kCVImageBufferColorPrimaries_ITU_R_709_2,
+                (id)kCVImageBufferTransferFunctionKey: (id)kCVImageBufferTransferFunction_ITU_R_709_2
+            };
+        case YuvMatrix::BT2020Limited:
+            return @{
+                (id)kCVImageBufferYCbCrMatrixKey: (id)kCVImageBufferYCbCrMatrix_ITU_R_2020,
+                (id)kCVImageBufferColorPrimariesKey: (id)kCVImageBufferColorPrimaries_ITU_R_2020,
+                (id)kCVImageBufferTransferFunctionKey: (id)kCVImageBufferTransferFunction_ITU_R_2020
+            };
+        default:
+            return nil;
+    }
+}
 
 class VirtualOutput {
   private:
-    OBSDALMachServer* _mach_server = nil;
+    std::unique_ptr<MachServerThread> _server_thread;
     mach_timebase_info_data_t _timebase_info;
     CVPixelBufferPoolRef _cv_pool;
+    // Makes the pool report when it would grow past its prewarmed size.
+    NSDictionary* _cv_pool_threshold = nil;
     FourCharCode _cv_format;
     uint32_t _frame_width;
     uint32_t _frame_height;
     uint32_t _frame_fourcc;
-    uint32_t _out_frame_size;
+    // Picked once for the input format.
+    Converter _convert = nullptr;
+    // Only changed rows are converted again if set, into a copy of
+    // `_last_converted`, which is sent again if nothing changed.
+    std::unique_ptr<FrameChanges> _changes;
+    CVPixelBufferRef _last_converted = nil;
     uint32_t _fps_num;
     uint32_t _fps_den;
-    std::vector<uint8_t> _buffer_tmp;
-    std::vector<uint8_t> _buffer_output;
+    std::unique_ptr<ThreadPool> _pool;
+    // Locked pixel buffer handed out by acquire_frame() and not committed yet.
+    CVPixelBufferRef _acquired = nil;
+    SendStats _stats;
+    FrameSequence _frames;
+
+    // Hands a pixel buffer and its reference to the server thread.
+    // `frame` is the sequence number of the frame for trace events.
+    void send_pixel_buffer(CVPixelBufferRef frame_ref, uint64_t timestamp, uint64_t frame) {
+        bool replaced;
+        {
+            ScopedTimer timer {_stats.output};
+            TRACE_SPAN(output, frame);
+            replaced = !_server_thread->post(frame_ref, timestamp);
+        }
+        if (replaced) {
+            // The server thread was still busy with clients,
+            // the previous frame was never sent.
+            _stats.record_dropped();
+        }
+        _stats.record_output(uyvy_frame_size(_frame_width, _frame_height));
+    }
+
+    // Pixel buffers of the caller are sent as is and clients map their
+    // surface, so they must be like the ones from the pool.
+    void check_pixel_buffer(CVPixelBufferRef buffer) {
+        if (buffer == nil) {
+            throw std::invalid_argument("Pixel buffer must not be NULL.");
+        }
+        if (CVPixelBufferGetPixelFormatType(buffer) != _cv_format) {
+            throw std::invalid_argument("Pixel buffers must be in UYVY format ('2vuy').");
+        }
+        if (CVPixelBufferGetWidth(buffer) != _frame_width ||
+            CVPixelBufferGetHeight(buffer) != _frame_height) {
+            throw std::invalid_argument(
+                "Pixel buffers must be " + std::to_string(_frame_width) + "x" +
+                std::to_string(_frame_height) + ".");
+        }
+        if (CVPixelBufferGetIOSurface(buffer) == NULL) {
+            throw std::invalid_argument("Pixel buffers must be backed by an IOSurface.");
+        }
+    }
+
+    // Takes a pixel buffer from the pool, allocating one if all prewarmed
+    // buffers are still in use, which is counted in the stats.
+    CVReturn create_pixel_buffer(CVPixelBufferRef* buffer) {
+        CVReturn status = CVPixelBufferPoolCreatePixelBufferWithAuxAttributes(
+            kCFAllocatorDefault, _cv_pool, (__bridge CFDictionaryRef)_cv_pool_threshold, buffer);
+        if (status == kCVReturnWouldExceedAllocationThreshold) {
+            _stats.record_pool_exhausted();
+            status = CVPixelBufferPoolCreatePixelBuffer(kCFAllocatorDefault, _cv_pool, buffer);
+        }
+        return status;
+    }
+
+    // Allocates all buffers of the pool before the first frame.
+    void prewarm_pool() {
+        CVPixelBufferRef buffers[PIXEL_BUFFER_POOL_SIZE] = {};
+        for (CVPixelBufferRef& buffer : buffers) {
+            if (CVPixelBufferPoolCreatePixelBuffer(kCFAllocatorDefault, _cv_pool, &buffer) != kCVReturnSuccess) {
+                buffer = nil;
+            }
+        }
+        // Released buffers go back into the pool.
+        for (CVPixelBufferRef buffer : buffers) {
+            if (buffer != nil) {
+                CVPixelBufferRelease(buffer);
+            }
+        }
+    }
+
+    // Rows of pixel buffers may be padded.
+    static Planes pixel_buffer_planes(CVPixelBufferRef buffer) {
+        Planes planes;
+        planes.data[0] = (uint8_t *)CVPixelBufferGetBaseAddress(buffer);
+        planes.stride[0] = static_cast<int32_t>(CVPixelBufferGetBytesPerRow(buffer));
+        return planes;
+    }
+
+    // Converts the `bands` of `frame` that changed into `dst`,
+    // and the rest of it is copied from the last converted frame.
+    void convert_changes(const Planes& frame, const std::vector<RowBand>& bands, const Planes& dst) {
+        if (_last_converted != nil) {
+            CVPixelBufferLockBaseAddress(_last_converted, kCVPixelBufferLock_ReadOnly);
+            copy_frame(libyuv::FOURCC_UYVY, pixel_buffer_planes(_last_converted), dst,
+                       _frame_width, _frame_height);
+            CVPixelBufferUnlockBaseAddress(_last_converted, kCVPixelBufferLock_ReadOnly);
+        }
+        convert_bands(_convert,
+            _frame_fourcc, frame, libyuv::FOURCC_UYVY, dst,
+            _frame_width, bands, _pool.get());
+    }
 
     // https://stackoverflow.com/a/23378064
     uint64_t scale_mach_time(uint64_t i) {
@@ -56,7 +184,8 @@ class VirtualOutput {
 
   public:
     VirtualOutput(uint32_t width, uint32_t height, double fps, uint32_t fourcc,
-                  std::optional<std::string> device_) {
+                  std::optional<std::string> device_, uint32_t threads = 1,
+                  bool skip_unchanged = false, YuvMatrix matrix = YuvMatrix::BT601Limited) {
         NSString *dal_plugin_path = @"/Library/CoreMediaIO/Plug-Ins/DAL/obs-mac-virtualcam.plugin";
         NSFileManager *file_manager = [NSFileManager defaultManager];
         BOOL dal_plugin_installed = [file_manager fileExistsAtPath:dal_plugin_path];
@@ -87,62 +216,64 @@ class VirtualOutput {
             );
         }
 
+        if (is_full_range(matrix)) {
+            // '2vuy' pixel buffers are video range by definition.
+            throw std::invalid_argument("This backend supports only the 'limited' range.");
+        }
+
         _frame_fourcc = libyuv::CanonicalFourCC(fourcc);
         _frame_width = width;
         _frame_height = height;
         _fps_num = fps * 1000;
         _fps_den = 1000;
 
-        _out_frame_size = uyvy_frame_size(width, height);
-
-        switch (_frame_fourcc) {
-            case libyuv::FOURCC_RAW:
-            case libyuv::FOURCC_24BG:
-            case libyuv::FOURCC_J400:
-                // RGB|BGR|GRAY -> BGRA -> UYVY
-                _buffer_tmp.resize(bgra_frame_size(width, height));
-                _buffer_output.resize(_out_frame_size);
-                break;
-            case libyuv::FOURCC_I420:
-                // I420 -> UYVY
-                _buffer_output.resize(_out_frame_size);
-                break;
-            case libyuv::FOURCC_NV12:
-                // NV12 -> I420 -> UYVY
-                _buffer_tmp.resize(i420_frame_size(width, height));
-                _buffer_output.resize(_out_frame_size);
-                break;
-            case libyuv::FOURCC_YUY2:
-                // YUYV -> I422 -> UYVY
-                _buffer_tmp.resize(i422_frame_size(width, height));
-                _buffer_output.resize(_out_frame_size);
-                break;
-            case libyuv::FOURCC_UYVY:
-                break;
-            default:
-                throw std::runtime_error("Unsupported image format.");
+        // Conversions write directly into the pixel buffers from the pool.
+        // RGB|BGR|BGRA|GRAY|I420|NV12|YUYV|UYVY -> UYVY
+        _convert = find_output_converter(_frame_fourcc, libyuv::FOURCC_UYVY, matrix);
+        if (!_convert) {
+            throw std::runtime_error("Unsupported image format.");
+        }
+
+        _pool = make_thread_pool(threads);
+        if (skip_unchanged) {
+            _changes = std::make_unique<FrameChanges>(_frame_fourcc, width, height);
         }
 
         _cv_format = kCVPixelFormatType_422YpCbCr8; // UYVY
 
-        NSDictionary *pAttr = @{};
-        NSDictionary *pbAttr = @{
+        NSDictionary *pAttr = @{
+            (id)kCVPixelBufferPoolMinimumBufferCountKey: @(PIXEL_BUFFER_POOL_SIZE),
+            // Idle buffers are kept instead of being freed after a second.
+            (id)kCVPixelBufferPoolMaximumBufferAgeKey: @0
+        };
+        NSMutableDictionary *pbAttr = [NSMutableDictionary dictionaryWithDictionary:@{
             (id)kCVPixelBufferPixelFormatTypeKey: @(_cv_format),
             (id)kCVPixelBufferWidthKey: @(_frame_width),
             (id)kCVPixelBufferHeightKey: @(_frame_height),
             (id)kCVPixelBufferIOSurfacePropertiesKey: @{}
-        };
+        }];
+        NSDictionary *attachments = colorimetry_attachments(matrix);
+        if (attachments != nil) {
+            // Set on every buffer of the pool and carried along by its IOSurface.
+            pbAttr[(id)kCVBufferPropagatedAttachmentsKey] = attachments;
+        }
         CVReturn status = CVPixelBufferPoolCreate(
             kCFAllocatorDefault, (__bridge CFDictionaryRef)pAttr,
             (__bridge CFDictionaryRef)pbAttr, &_cv_pool);
         if (status != kCVReturnSuccess) {
             throw std::runtime_error("unable to allocate pixel buffer pool");
         }
+        prewarm_pool();
+        _cv_pool_threshold = [@{
+            (id)kCVPixelBufferPoolAllocationThresholdKey: @(PIXEL_BUFFER_POOL_SIZE)
+        } retain];
 
-        _mach_server = [[OBSDALMachServer alloc] init];
-        BOOL started = [_mach_server run];
-        if (!started) {
-            throw std::runtime_error("virtual camera output could not be started");
+        try {
+            _server_thread = std::make_unique<MachServerThread>(_fps_num, _fps_den);
+        } catch (...) {
+            [_cv_pool_threshold release];
+            CVPixelBufferPoolRelease(_cv_pool);
+            throw;
         }
 
         kern_return_t mti_status = mach_timebase_info(&_timebase_info);
@@ -150,14 +281,24 @@ class VirtualOutput {
     }
 
     void stop() {
-        if (_mach_server == nil) {
+        if (!_server_thread) {
             return;
         }
 
-        [_mach_server stop];
-        [_mach_server dealloc];
-        _mach_server = nil;
+        if (_acquired != nil) {
+            CVPixelBufferUnlockBaseAddress(_acquired, 0);
+            CVPixelBufferRelease(_acquired);
+            _acquired = nil;
+        }
+        if (_last_converted != nil) {
+            CVPixelBufferRelease(_last_converted);
+            _last_converted = nil;
+        }
 
+        _server_thread = nullptr;
+
+        [_cv_pool_threshold release];
+        _cv_pool_threshold = nil;
         CVPixelBufferPoolRelease(_cv_pool);
         
         // When the named server port is invalidated, the effect is not immediate.
@@ -167,89 +308,135 @@ class VirtualOutput {
         [NSThread sleepForTimeInterval:0.2f];
     }
 
-    void send(const uint8_t* frame) {
-        if (_mach_server == nil) {
+    // May be called from any thread, port messages
+    // are handled on the server thread.
+    // `dirty` lists the rectangles that changed since the previous
+    // frame if frames are only converted where they changed.
+    void send(const Planes& frame, const std::vector<DirtyRect>* dirty = nullptr) {
+        if (!_server_thread) {
             return;
         }
 
-        // We must handle port messages, and somehow our RunLoop isn't normally active.
-        // Handle exactly one message. If no message is queued, return without blocking.
-        NSRunLoop *run_loop = [NSRunLoop currentRunLoop];
-        NSDate *now = [NSDate date];
-        [run_loop runMode:NSDefaultRunLoopMode beforeDate:now];
-        
         uint64_t timestamp = scale_mach_time(mach_absolute_time());
+        uint64_t frame_number = _frames.next();
 
-        uint8_t* tmp = _buffer_tmp.data();
-        uint8_t* out_frame;
-        
-        switch (_frame_fourcc) {
-            case libyuv::FOURCC_RAW:            
-                out_frame = _buffer_output.data();
-                rgb_to_bgra(frame, tmp, _frame_width, _frame_height);
-                bgra_to_uyvy(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_24BG:
-                out_frame = _buffer_output.data();
-                bgr_to_bgra(frame, tmp, _frame_width, _frame_height);
-                bgra_to_uyvy(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_J400:
-                out_frame = _buffer_output.data();
-                gray_to_bgra(frame, tmp, _frame_width, _frame_height);
-                bgra_to_uyvy(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_I420:
-                out_frame = _buffer_output.data();
-                i420_to_uyvy(frame, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_NV12:
-                out_frame = _buffer_output.data();
-                nv12_to_i420(frame, tmp, _frame_width, _frame_height);
-                i420_to_uyvy(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_YUY2:
-                out_frame = _buffer_output.data();
-                yuyv_to_i422(frame, tmp, _frame_width, _frame_height);
-                i422_to_uyvy(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_UYVY:
-                out_frame = const_cast<uint8_t*>(frame);
-                break;
-            default:
-                throw std::logic_error("not implemented");
+        std::vector<RowBand> bands;
+        if (_changes) {
+            bands = _changes->update(frame, dirty);
+            if (bands.empty()) {
+                // Clients only read pixel buffers, so the same one can be sent again.
+                _stats.record_unchanged();
+                send_pixel_buffer(CVPixelBufferRetain(_last_converted), timestamp, frame_number);
+                return;
+            }
         }
-        
+
         CVPixelBufferRef frame_ref = nil;
-        CVReturn status = CVPixelBufferPoolCreatePixelBuffer(
-            kCFAllocatorDefault, _cv_pool, &frame_ref);
+        CVReturn status = create_pixel_buffer(&frame_ref);
 
         if (status != kCVReturnSuccess) {
             // not an exception, in case it is temporary
             fprintf(stderr, "unable to allocate pixel buffer (error %d)",
                 status);
+            if (_changes) {
+                // The changes were not converted anywhere.
+                _changes->invalidate();
+            }
+            _stats.record_dropped();
             return;
         }
 
         CVPixelBufferLockBaseAddress(frame_ref, 0);
 
-        uint8_t *dst = (uint8_t *)CVPixelBufferGetBaseAddress(frame_ref);
-        int dst_size = CVPixelBufferGetDataSize(frame_ref);
+        Planes dst = pixel_buffer_planes(frame_ref);
 
-        if (dst_size == _out_frame_size) {
-			memcpy(dst, out_frame, _out_frame_size);
-        } else {
-            fprintf(stderr, "pixel buffer size mismatch");
+        {
+            ScopedTimer timer {_stats.convert};
+            TRACE_SPAN(convert, frame_number);
+            if (_changes) {
+                convert_changes(frame, bands, dst);
+            } else {
+                convert_frame(_convert,
+                    _frame_fourcc, frame, libyuv::FOURCC_UYVY, dst,
+                    _frame_width, _frame_height, _pool.get());
+            }
         }
 
         CVPixelBufferUnlockBaseAddress(frame_ref, 0);
 
-        [_mach_server sendPixelBuffer:frame_ref
-            timestamp:timestamp
-            fpsNumerator:_fps_num
-            fpsDenominator:_fps_den];
-        
-        CVPixelBufferRelease(frame_ref);
+        if (_changes) {
+            if (_last_converted != nil) {
+                CVPixelBufferRelease(_last_converted);
+            }
+            _last_converted = CVPixelBufferRetain(frame_ref);
+        }
+        send_pixel_buffer(frame_ref, timestamp, frame_number);
+    }
+
+    // Native-format memory to fill before calling commit_frame().
+    // This is a locked pixel buffer from the pool, which is sent as is.
+    Planes acquire_frame() {
+        if (!_server_thread) {
+            throw std::runtime_error("virtual camera output is not running");
+        }
+        if (_acquired == nil) {
+            CVReturn status = create_pixel_buffer(&_acquired);
+            if (status != kCVReturnSuccess) {
+                _acquired = nil;
+                throw std::runtime_error(
+                    "unable to allocate pixel buffer (error " + std::to_string(status) + ")");
+            }
+            CVPixelBufferLockBaseAddress(_acquired, 0);
+        }
+        return pixel_buffer_planes(_acquired);
+    }
+
+    // May be called from any thread.
+    void commit_frame() {
+        if (!_server_thread) {
+            return;
+        }
+        if (_acquired == nil) {
+            throw std::runtime_error("commit_frame() called without acquire_frame()");
+        }
+        CVPixelBufferRef frame_ref = _acquired;
+        _acquired = nil;
+        CVPixelBufferUnlockBaseAddress(frame_ref, 0);
+        send_pixel_buffer(frame_ref, scale_mach_time(mach_absolute_time()), _frames.next());
+    }
+
+    // Sends a UYVY pixel buffer of the caller without converting or copying
+    // it, like one rendered into on the GPU. Clients read its surface after
+    // this returns, so it must not be written to while it may be shown.
+    // May be called from any thread.
+    void send_cvpixelbuffer(CVPixelBufferRef buffer) {
+        if (!_server_thread) {
+            return;
+        }
+        check_pixel_buffer(buffer);
+        send_pixel_buffer(CVPixelBufferRetain(buffer), scale_mach_time(mach_absolute_time()),
+                          _frames.next());
+    }
+
+    // Like send_cvpixelbuffer(), for a UYVY surface.
+    void send_iosurface(IOSurfaceRef surface) {
+        if (surface == NULL) {
+            throw std::invalid_argument("IOSurface must not be NULL.");
+        }
+        CVPixelBufferRef buffer = nil;
+        CVReturn status = CVPixelBufferCreateWithIOSurface(
+            kCFAllocatorDefault, surface, NULL, &buffer);
+        if (status != kCVReturnSuccess) {
+            throw std::invalid_argument(
+                "unable to wrap IOSurface in a pixel buffer (error " + std::to_string(status) + ")");
+        }
+        try {
+            send_cvpixelbuffer(buffer);
+        } catch (...) {
+            CVPixelBufferRelease(buffer);
+            throw;
+        }
+        CVPixelBufferRelease(buffer);
     }
 
     std::string device()
@@ -261,4 +448,8 @@ class VirtualOutput {
     uint32_t native_fourcc() {
         return libyuv::FOURCC_UYVY;
     }
+
+    SendStats& send_stats() {
+        return _stats;
+    }
 };
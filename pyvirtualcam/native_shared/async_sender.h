@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "image_formats.h"
+
+// Moves the conversion and output work of a backend onto a worker thread.
+// Frames are copied into a bounded ring of preallocated contiguous slots
+// which the worker drains in order, so that push() only costs a copy.
+// Each frame keeps the timestamp it was pushed with, 0 if it had none.
+class AsyncSender {
+  public:
+    enum class Policy {
+        // Replace the oldest queued frame if the ring is full.
+        DropOldest,
+        // Wait until the worker has freed a slot.
+        Block,
+    };
+
+    static Policy parse_policy(const std::string& name) {
+        if (name == "drop_oldest") {
+            return Policy::DropOldest;
+        } else if (name == "block") {
+            return Policy::Block;
+        }
+        throw std::invalid_argument(
+            "Unknown queue policy '" + name + "', "
+            "must be 'drop_oldest' or 'block'."
+        );
+    }
+
+    AsyncSender(uint32_t fourcc, int32_t width, int32_t height,
+                size_t queue_size, Policy policy,
+                std::function<void(const Planes&, uint64_t timestamp_ns)> send)
+     : _send {std::move(send)}, _fourcc {fourcc}, _width {width}, _height {height},
+       _queue_size {queue_size}, _policy {policy} {
+        if (queue_size == 0) {
+            throw std::invalid_argument("Queue size must be at least 1.");
+        }
+        // One extra slot so that the worker can send a frame
+        // while the ring is full.
+        _slots.resize(queue_size + 1);
+        for (size_t i = 0; i < _slots.size(); i++) {
+            _slots[i].data.resize(fourcc_frame_size(fourcc, width, height));
+            _free.push_back(i);
+        }
+        _thread = std::thread(&AsyncSender::run, this);
+    }
+
+    AsyncSender(const AsyncSender&) = delete;
+    AsyncSender& operator=(const AsyncSender&) = delete;
+
+    ~AsyncSender() {
+        stop();
+    }
+
+    // Sends all queued frames and stops the worker.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stopping) {
+                return;
+            }
+            _stopping = true;
+        }
+        _cv_worker.notify_one();
+        _cv_producer.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    void push(const Planes& frame, uint64_t timestamp_ns = 0) {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_error.empty()) {
+                std::string error;
+                std::swap(error, _error);
+                throw std::runtime_error(error);
+            }
+            if (_policy == Policy::DropOldest &&
+                (_ready.size() >= _queue_size || _free.empty()) && !_ready.empty()) {
+                // Ring is full, recycle the oldest queued frame.
+                _free.push_back(_ready.front());
+                _ready.pop_front();
+                _dropped++;
+            }
+            _cv_producer.wait(lock, [this] {
+                return _stopping || (_ready.size() < _queue_size && !_free.empty());
+            });
+            if (_stopping) {
+                return;
+            }
+            slot = _free.back();
+            _free.pop_back();
+        }
+
+        // The slot is neither free nor ready, nobody else touches it.
+        copy_frame(_fourcc, frame, slot_planes(slot), _width, _height);
+        _slots[slot].timestamp_ns = timestamp_ns;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _ready.push_back(slot);
+        }
+        _cv_worker.notify_one();
+    }
+
+    // Number of frames that were replaced before the worker got to send them.
+    uint64_t frames_dropped() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _dropped;
+    }
+
+  private:
+    struct Slot {
+        std::vector<uint8_t> data;
+        uint64_t timestamp_ns = 0;
+    };
+
+    std::function<void(const Planes&, uint64_t)> _send;
+    uint32_t _fourcc;
+    int32_t _width;
+    int32_t _height;
+    size_t _queue_size;
+    Policy _policy;
+    std::vector<Slot> _slots;
+    std::vector<size_t> _free;
+    std::deque<size_t> _ready;
+    bool _stopping = false;
+    std::string _error;
+    uint64_t _dropped = 0;
+    std::mutex _mutex;
+    std::condition_variable _cv_worker;
+    std::condition_variable _cv_producer;
+    std::thread _thread;
+
+    Planes slot_planes(size_t slot) {
+        return fourcc_planes(_fourcc, _slots[slot].data.data(), _width, _height);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _cv_worker.wait(lock, [this] { return _stopping || !_ready.empty(); });
+            if (_ready.empty()) {
+                // stopping and nothing left to send
+                return;
+            }
+            size_t slot = _ready.front();
+            _ready.pop_front();
+
+            lock.unlock();
+            std::string error;
+            try {
+                _send(slot_planes(slot), _slots[slot].timestamp_ns);
+            } catch (std::exception& ex) {
+                error = ex.what();
+            }
+            lock.lock();
+
+            if (!error.empty() && _error.empty()) {
+                // Reported to the producer on its next push().
+                _error = error;
+            }
+            _free.push_back(slot);
+            _cv_producer.notify_one();
+        }
+    }
+};
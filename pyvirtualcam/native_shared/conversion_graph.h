@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <libyuv.h>
+#include "frame_changes.h"
+#include "image_formats.h"
+#include "thread_pool.h"
+#include "yuv_matrix.h"
+
+static libyuv::FilterMode parse_filter_mode(const std::string& name) {
+    if (name == "none") {
+        return libyuv::kFilterNone;
+    } else if (name == "linear") {
+        return libyuv::kFilterLinear;
+    } else if (name == "bilinear") {
+        return libyuv::kFilterBilinear;
+    } else if (name == "box") {
+        return libyuv::kFilterBox;
+    }
+    throw std::invalid_argument(
+        "Unknown scale filter '" + name + "', "
+        "must be 'none', 'linear', 'bilinear' or 'box'."
+    );
+}
+
+// Formats that libyuv can scale without converting them first.
+static bool is_scalable(uint32_t fourcc) {
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_J400:
+        case libyuv::FOURCC_I420:
+        case libyuv::FOURCC_NV12:
+        case libyuv::FOURCC_NV21:
+        case libyuv::FOURCC_ARGB:
+        case libyuv::FOURCC_ABGR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Produces frames in several formats and sizes ("sinks") from one input frame.
+//
+// The conversions form a tree rooted at the input. Sinks whose format can
+// be reached directly from the input at the input size are converted in a
+// single step. Everything else goes through an I420 frame at the input size
+// which is computed once and shared: resized sinks scale it per distinct
+// size, and then reformat the scaled I420 frame if needed.
+// Exceptions are resized sinks that libyuv can scale in their own format
+// and that need no chroma subsampling on the way: sinks in the input format
+// are scaled from the input, RGB sinks from an RGB frame at the input size,
+// and gray sinks scale luma straight from the input if it has a luma plane.
+// Packed 24-bit RGB sinks are converted from a scaled BGRA frame.
+class ConversionGraph {
+  public:
+    struct Format {
+        uint32_t fourcc;
+        int32_t width;
+        int32_t height;
+
+        bool operator==(const Format& other) const {
+            return fourcc == other.fourcc && width == other.width && height == other.height;
+        }
+    };
+
+    ConversionGraph(Format input, const std::vector<Format>& sinks,
+                    libyuv::FilterMode filter = libyuv::kFilterBox,
+                    YuvMatrix matrix = YuvMatrix::BT601Limited)
+     : _filter {filter}, _matrix {matrix} {
+        input.fourcc = libyuv::CanonicalFourCC(input.fourcc);
+        _nodes.push_back({input, -1, Step::Input});
+        for (Format sink : sinks) {
+            sink.fourcc = libyuv::CanonicalFourCC(sink.fourcc);
+            _sinks.push_back(node_for(sink));
+        }
+    }
+
+    ConversionGraph(const ConversionGraph&) = delete;
+    ConversionGraph& operator=(const ConversionGraph&) = delete;
+
+    size_t sink_count() const {
+        return _sinks.size();
+    }
+
+    // Runs all conversions for `input`.
+    // If `dst[i]` has data, sink i is written there instead of into memory
+    // of the graph, which must then be contiguous in the sink format.
+    // Afterwards, output(i) has the contiguous frame of sink i.
+    void run(const Planes& input, const std::vector<uint8_t*>& dst, ThreadPool* pool) {
+        for (Node& node : _nodes) {
+            node.target = nullptr;
+        }
+        for (size_t i = 0; i < _sinks.size(); i++) {
+            if (i < dst.size() && dst[i]) {
+                _nodes[_sinks[i]].target = dst[i];
+            }
+        }
+
+        Node& root = _nodes[0];
+        root.planes = input;
+        if (root.target || (is_sink(0) && !is_contiguous(root.format.fourcc, input,
+                                                          root.format.width, root.format.height))) {
+            // The input is a sink but must be handed out contiguous.
+            root.planes = node_memory(root);
+            copy_frame(root.format.fourcc, input, root.planes, root.format.width, root.format.height);
+        }
+
+        for (size_t i = 1; i < _nodes.size(); i++) {
+            Node& node = _nodes[i];
+            const Node& parent = _nodes[node.parent];
+            // Conversions read from the input rather than a copy of it.
+            const Planes& src = parent.parent == -1 ? input : parent.planes;
+            node.planes = node_memory(node);
+            const Format& in = parent.format;
+            const Format& out = node.format;
+            switch (node.step) {
+                case Step::Convert:
+                    convert_frame(node.convert, in.fourcc, src, out.fourcc, node.planes,
+                                  out.width, out.height, pool);
+                    break;
+                case Step::Scale:
+                    scale(src, in, node.planes, out);
+                    break;
+                case Step::Input:
+                    throw std::logic_error("unexpected input node");
+            }
+        }
+        _reusable = std::none_of(dst.begin(), dst.end(), [](uint8_t* d) { return d != nullptr; });
+    }
+
+    // Like run() without `dst`, for an input that only differs in `bands`
+    // from the input of the previous run, whose results are updated.
+    // Graphs whose previous run wrote into `dst` run in full, as do graphs
+    // that scale unless nothing changed.
+    void run_bands(const Planes& input, const std::vector<RowBand>& bands, ThreadPool* pool) {
+        Node& root = _nodes[0];
+        const Format& f = root.format;
+        bool copy_input = is_sink(0) && !is_contiguous(f.fourcc, input, f.width, f.height);
+        bool copied_input = !root.buffer.empty() && root.planes.data[0] == root.buffer.data();
+        bool scales = std::any_of(_nodes.begin(), _nodes.end(),
+            [](const Node& node) { return node.step == Step::Scale; });
+        if (!_reusable || (scales && !bands.empty()) || copy_input != copied_input) {
+            run(input, {}, pool);
+            return;
+        }
+
+        if (copy_input) {
+            for (const RowBand& band : bands) {
+                copy_frame(f.fourcc, band_planes(f.fourcc, input, band.y),
+                           band_planes(f.fourcc, root.planes, band.y), f.width, band.rows);
+            }
+        } else {
+            root.planes = input;
+        }
+        // All nodes are conversions at the input size,
+        // or there are no bands if the graph scales.
+        for (size_t i = 1; i < _nodes.size(); i++) {
+            Node& node = _nodes[i];
+            const Node& parent = _nodes[node.parent];
+            const Planes& src = parent.parent == -1 ? input : parent.planes;
+            convert_bands(node.convert, parent.format.fourcc, src, node.format.fourcc, node.planes,
+                          node.format.width, bands, pool);
+        }
+    }
+
+    // Contiguous frame of sink `i` after run().
+    const uint8_t* output(size_t i) const {
+        return _nodes[_sinks[i]].planes.data[0];
+    }
+
+    const Format& sink_format(size_t i) const {
+        return _nodes[_sinks[i]].format;
+    }
+
+  private:
+    libyuv::FilterMode _filter;
+    // Of conversions between RGB and YUV.
+    YuvMatrix _matrix;
+
+    enum class Step {
+        Input,
+        // A libyuv conversion at the same size.
+        Convert,
+        // libyuv scaling in the node's format. Planar formats may also
+        // scale a subset of the parent planes, like luma for gray.
+        Scale,
+    };
+
+    struct Node {
+        Format format;
+        int32_t parent;
+        Step step;
+        Converter convert = nullptr;
+        std::vector<uint8_t> buffer;
+        // Memory to write into instead of `buffer` in the current run().
+        uint8_t* target = nullptr;
+        Planes planes;
+    };
+
+    // Nodes are in topological order, parents come before their children.
+    std::vector<Node> _nodes;
+    std::vector<int32_t> _sinks;
+    // Whether the previous run() kept all results in memory of the graph.
+    bool _reusable = false;
+
+    void scale(const Planes& src, const Format& in, const Planes& dst, const Format& out) {
+        switch (out.fourcc) {
+            case libyuv::FOURCC_NV12:
+            case libyuv::FOURCC_NV21:
+                // Chroma order does not matter for scaling.
+                libyuv::NV12Scale(
+                    src.data[0], src.stride[0],
+                    src.data[1], src.stride[1],
+                    in.width, in.height,
+                    dst.data[0], dst.stride[0],
+                    dst.data[1], dst.stride[1],
+                    out.width, out.height, _filter);
+                break;
+            case libyuv::FOURCC_ARGB:
+            case libyuv::FOURCC_ABGR:
+                libyuv::ARGBScale(
+                    src.data[0], src.stride[0], in.width, in.height,
+                    dst.data[0], dst.stride[0], out.width, out.height, _filter);
+                break;
+            default:
+                for (int p = 0; p < 3; p++) {
+                    if (dst.data[p]) {
+                        libyuv::ScalePlane(
+                            src.data[p], src.stride[p],
+                            plane_row_bytes(in.fourcc, p, in.width),
+                            in.height >> plane_vertical_shift(in.fourcc, p),
+                            dst.data[p], dst.stride[p],
+                            plane_row_bytes(out.fourcc, p, out.width),
+                            out.height >> plane_vertical_shift(out.fourcc, p),
+                            _filter);
+                    }
+                }
+                break;
+        }
+    }
+
+    bool is_sink(int32_t node) const {
+        for (int32_t sink : _sinks) {
+            if (sink == node) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Planes node_memory(Node& node) {
+        const Format& f = node.format;
+        uint8_t* data = node.target;
+        if (!data) {
+            node.buffer.resize(fourcc_frame_size(f.fourcc, f.width, f.height));
+            data = node.buffer.data();
+        }
+        return fourcc_planes(f.fourcc, data, f.width, f.height);
+    }
+
+    int32_t find(const Format& format) const {
+        for (size_t i = 0; i < _nodes.size(); i++) {
+            if (_nodes[i].format == format) {
+                return static_cast<int32_t>(i);
+            }
+        }
+        return -1;
+    }
+
+    int32_t add(const Format& format, int32_t parent, Step step, Converter convert = nullptr) {
+        Node node {format, parent, step};
+        node.convert = convert;
+        _nodes.push_back(std::move(node));
+        return static_cast<int32_t>(_nodes.size() - 1);
+    }
+
+    // Index of the node producing `format`, adding it and its parents as needed.
+    int32_t node_for(const Format& format) {
+        int32_t existing = find(format);
+        if (existing != -1) {
+            return existing;
+        }
+        if (fourcc_frame_size(format.fourcc, format.width, format.height) == 0) {
+            throw std::invalid_argument("Unsupported output format.");
+        }
+
+        // A copy, as adding nodes may move it.
+        Format input = _nodes[0].format;
+        bool same_size = format.width == input.width && format.height == input.height;
+        Format i420 {libyuv::FOURCC_I420, format.width, format.height};
+
+        if (same_size) {
+            if (Converter convert = find_converter(input.fourcc, format.fourcc, _matrix)) {
+                return add(format, 0, Step::Convert, convert);
+            }
+            if (format.fourcc == libyuv::FOURCC_I420) {
+                throw std::invalid_argument("Unsupported input format.");
+            }
+            Converter convert = find_converter(libyuv::FOURCC_I420, format.fourcc, _matrix);
+            if (!convert) {
+                throw std::invalid_argument("Unsupported output format.");
+            }
+            return add(format, node_for(i420), Step::Convert, convert);
+        }
+
+        if (format.fourcc == input.fourcc && is_scalable(format.fourcc)) {
+            return add(format, 0, Step::Scale);
+        }
+        if (format.fourcc == libyuv::FOURCC_ARGB || format.fourcc == libyuv::FOURCC_ABGR) {
+            return add(format, node_for({format.fourcc, input.width, input.height}), Step::Scale);
+        }
+        if (format.fourcc == libyuv::FOURCC_RAW || format.fourcc == libyuv::FOURCC_24BG) {
+            int32_t bgra = node_for({libyuv::FOURCC_ARGB, format.width, format.height});
+            return add(format, bgra, Step::Convert, find_converter(libyuv::FOURCC_ARGB, format.fourcc));
+        }
+        if (format.fourcc == libyuv::FOURCC_J400) {
+            // Luma is the first plane of all of these.
+            bool has_luma = input.fourcc == libyuv::FOURCC_J400 ||
+                input.fourcc == libyuv::FOURCC_I420 || input.fourcc == libyuv::FOURCC_NV12 ||
+                input.fourcc == libyuv::FOURCC_NV21;
+            int32_t parent = has_luma ? 0 : node_for({libyuv::FOURCC_I420, input.width, input.height});
+            return add(format, parent, Step::Scale);
+        }
+        if (format.fourcc == libyuv::FOURCC_I420) {
+            return add(format, node_for({libyuv::FOURCC_I420, input.width, input.height}), Step::Scale);
+        }
+        Converter convert = find_converter(libyuv::FOURCC_I420, format.fourcc, _matrix);
+        if (!convert) {
+            throw std::invalid_argument("Unsupported output format.");
+        }
+        return add(format, node_for(i420), Step::Convert, convert);
+    }
+};
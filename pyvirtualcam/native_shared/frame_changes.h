@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <libyuv.h>
+#include "image_formats.h"
+
+// Rows [y, y + rows) of a frame.
+struct RowBand {
+    int32_t y;
+    int32_t rows;
+};
+
+// A rectangle (x, y, width, height) in pixels, as given to Camera.send().
+using DirtyRect = std::array<int32_t, 4>;
+
+// Finds the rows of a frame that differ from the previous frame, so that
+// backends which keep their previous output only convert those again.
+//
+// Frames are split into bands of BAND_ROWS rows. Either the caller names
+// the rectangles that changed, or each band is hashed with libyuv's SIMD
+// HashDjb2 and compared with the hash of the band in the previous frame,
+// which reads the frame once, several times faster than converting it.
+class FrameChanges {
+  public:
+    // A multiple of the vertical chroma subsampling of all formats.
+    static constexpr int32_t BAND_ROWS = 16;
+
+    FrameChanges(uint32_t fourcc, int32_t width, int32_t height)
+     : _fourcc {libyuv::CanonicalFourCC(fourcc)}, _width {width}, _height {height},
+       _hashes((height + BAND_ROWS - 1) / BAND_ROWS), _pending(_hashes.size()) {
+    }
+
+    // Bands of `frame` that changed, adjacent ones merged and in order,
+    // or none if the frame is the same as the previous one.
+    // Everything changed for the first frame and after invalidate().
+    // If `dirty` is given, only the bands it touches changed, and the
+    // frame is not read.
+    const std::vector<RowBand>& update(const Planes& frame, const std::vector<DirtyRect>* dirty) {
+        std::vector<bool> changed(_hashes.size(), !_valid);
+        for (size_t i = 0; i < changed.size(); i++) {
+            if (_pending[i]) {
+                changed[i] = true;
+                _pending[i] = false;
+            }
+        }
+        if (dirty) {
+            if (_skipped_unknown) {
+                // `dirty` is relative to a frame that was not converted.
+                changed.assign(changed.size(), true);
+            }
+            mark(*dirty, changed);
+            // Hashes were not kept up to date.
+            _hashed = false;
+        } else {
+            for (size_t i = 0; i < _hashes.size(); i++) {
+                uint32_t hash = band_hash(frame, static_cast<int32_t>(i) * BAND_ROWS);
+                if (!_hashed || hash != _hashes[i]) {
+                    changed[i] = true;
+                }
+                _hashes[i] = hash;
+            }
+            _hashed = true;
+        }
+        _valid = true;
+        _skipped_unknown = false;
+
+        _bands.clear();
+        for (size_t i = 0; i < changed.size(); i++) {
+            if (!changed[i]) {
+                continue;
+            }
+            int32_t y = static_cast<int32_t>(i) * BAND_ROWS;
+            int32_t rows = std::min(BAND_ROWS, _height - y);
+            if (!_bands.empty() && _bands.back().y + _bands.back().rows == y) {
+                _bands.back().rows += rows;
+            } else {
+                _bands.push_back({y, rows});
+            }
+        }
+        return _bands;
+    }
+
+    // For a frame that is not converted, like when it is dropped:
+    // the next update() also reports the rectangles that changed in it.
+    // Frames compared by hash are compared with the last converted frame.
+    void skip(const std::vector<DirtyRect>* dirty) {
+        if (dirty) {
+            mark(*dirty, _pending);
+        } else {
+            _skipped_unknown = true;
+        }
+    }
+
+    // Makes the next update() report the whole frame as changed,
+    // like when the previous output is gone.
+    void invalidate() {
+        _valid = false;
+    }
+
+  private:
+    uint32_t _fourcc;
+    int32_t _width;
+    int32_t _height;
+    // Hash of each band of the previous frame, if `_hashed`.
+    std::vector<uint32_t> _hashes;
+    bool _hashed = false;
+    // Whether there is a previous frame to compare with.
+    bool _valid = false;
+    // Bands that changed in skipped frames.
+    std::vector<bool> _pending;
+    // Whether a skipped frame was compared by hash, so that
+    // its changes are unknown.
+    bool _skipped_unknown = false;
+    std::vector<RowBand> _bands;
+
+    // Sets the bands that `dirty` touches in `changed`.
+    void mark(const std::vector<DirtyRect>& dirty, std::vector<bool>& changed) const {
+        for (const DirtyRect& rect : dirty) {
+            check_rect(rect);
+            if (rect[2] == 0) {
+                continue;
+            }
+            for (int32_t y = rect[1]; y < rect[1] + rect[3]; y = (y / BAND_ROWS + 1) * BAND_ROWS) {
+                changed[y / BAND_ROWS] = true;
+            }
+        }
+    }
+
+    void check_rect(const DirtyRect& rect) const {
+        if (rect[0] < 0 || rect[1] < 0 || rect[2] < 0 || rect[3] < 0 ||
+            rect[0] + rect[2] > _width || rect[1] + rect[3] > _height) {
+            throw std::invalid_argument("Dirty rectangles must lie within the frame.");
+        }
+    }
+
+    uint32_t band_hash(const Planes& frame, int32_t y) const {
+        uint32_t hash = 5381;
+        for (int p = 0; p < 3; p++) {
+            if (!frame.data[p]) {
+                continue;
+            }
+            int shift = plane_vertical_shift(_fourcc, p);
+            int32_t row_bytes = plane_row_bytes(_fourcc, p, _width);
+            int32_t end = (std::min(y + BAND_ROWS, _height) + (1 << shift) - 1) >> shift;
+            for (int32_t row = y >> shift; row < end; row++) {
+                hash = libyuv::HashDjb2(plane_row(frame, p, row), row_bytes, hash);
+            }
+        }
+        return hash;
+    }
+};
+
+// Converts the `bands` of `src` into `dst`, which holds the conversion
+// of a frame that only differed from `src` in those bands.
+static void convert_bands(Converter convert,
+                          uint32_t src_fourcc, const Planes& src,
+                          uint32_t dst_fourcc, const Planes& dst,
+                          int32_t width, const std::vector<RowBand>& bands, ThreadPool* pool) {
+    for (const RowBand& band : bands) {
+        convert_frame(convert,
+            src_fourcc, band_planes(src_fourcc, src, band.y),
+            dst_fourcc, band_planes(dst_fourcc, dst, band.y),
+            width, band.rows, pool);
+    }
+}
@@ -1,282 +1,862 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 #include <libyuv.h>
+#include "thread_pool.h"
 
 // libyuv names RGBA-type formats after the order in a *register*,
 // whereas we name it after the order in *memory*.
 // For example, libyuv ARGB is referred to as BGRA in function names below.
 
-// Passing a negative height to the functions below flips the image vertically.
+// Pointers to the planes of an image and their row strides in bytes.
+// Packed formats only use the first plane, NV12, NV21 and P010 the first two.
+// Source planes are never written to.
+struct Planes {
+    uint8_t* data[3] = {};
+    int32_t stride[3] = {};
+};
+
+// Planes of a contiguous frame in the given format.
+static Planes fourcc_planes(uint32_t fourcc, const uint8_t* frame, int32_t width, int32_t height) {
+    uint8_t* data = const_cast<uint8_t*>(frame);
+    int32_t half_width = width / 2;
+    int32_t half_height = height / 2;
+    Planes planes;
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_RAW:
+        case libyuv::FOURCC_24BG:
+            planes.data[0] = data;
+            planes.stride[0] = width * 3;
+            break;
+        case libyuv::FOURCC_ABGR:
+        case libyuv::FOURCC_ARGB:
+            planes.data[0] = data;
+            planes.stride[0] = width * 4;
+            break;
+        case libyuv::FOURCC_J400:
+            planes.data[0] = data;
+            planes.stride[0] = width;
+            break;
+        case libyuv::FOURCC_I420:
+            planes.data[0] = data;
+            planes.data[1] = data + width * height;
+            planes.data[2] = data + width * height + half_width * half_height;
+            planes.stride[0] = width;
+            planes.stride[1] = half_width;
+            planes.stride[2] = half_width;
+            break;
+        case libyuv::FOURCC_I422:
+            planes.data[0] = data;
+            planes.data[1] = data + width * height;
+            planes.data[2] = data + width * height + half_width * height;
+            planes.stride[0] = width;
+            planes.stride[1] = half_width;
+            planes.stride[2] = half_width;
+            break;
+        case libyuv::FOURCC_NV12:
+        case libyuv::FOURCC_NV21:
+            planes.data[0] = data;
+            planes.data[1] = data + width * height;
+            planes.stride[0] = width;
+            planes.stride[1] = width;
+            break;
+        case libyuv::FOURCC_P010:
+            planes.data[0] = data;
+            planes.data[1] = data + width * height * 2;
+            planes.stride[0] = width * 2;
+            planes.stride[1] = width * 2;
+            break;
+        case libyuv::FOURCC_YUY2:
+        case libyuv::FOURCC_UYVY:
+            planes.data[0] = data;
+            planes.stride[0] = width * 2;
+            break;
+    }
+    return planes;
+}
+
+// Vertical subsampling of a plane as a shift, e.g. 1 for 4:2:0 chroma.
+static int32_t plane_vertical_shift(uint32_t fourcc, int plane) {
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_I420:
+        case libyuv::FOURCC_NV12:
+        case libyuv::FOURCC_NV21:
+        case libyuv::FOURCC_P010:
+            return plane > 0 ? 1 : 0;
+        default:
+            return 0;
+    }
+}
+
+static uint8_t* plane_row(const Planes& planes, int plane, int32_t row) {
+    return planes.data[plane] + row * planes.stride[plane];
+}
+
+// Planes of the image starting at row `y`, which must be even
+// for formats with vertical chroma subsampling.
+static Planes band_planes(uint32_t fourcc, const Planes& planes, int32_t y) {
+    Planes band = planes;
+    for (int i = 0; i < 3; i++) {
+        if (band.data[i]) {
+            band.data[i] = plane_row(planes, i, y >> plane_vertical_shift(fourcc, i));
+        }
+    }
+    return band;
+}
+
+// The same planes with rows in reverse order.
+// Converting into these flips the image vertically.
+static Planes flip_planes(uint32_t fourcc, const Planes& planes, int32_t height) {
+    Planes flipped = planes;
+    for (int i = 0; i < 3; i++) {
+        if (flipped.data[i]) {
+            int32_t rows = height >> plane_vertical_shift(fourcc, i);
+            flipped.data[i] = plane_row(planes, i, rows - 1);
+            flipped.stride[i] = -planes.stride[i];
+        }
+    }
+    return flipped;
+}
+
+// Bytes per row of a plane of an unpadded frame, or 0 if the plane is unused.
+static int32_t plane_row_bytes(uint32_t fourcc, int plane, int32_t width) {
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_RAW:
+        case libyuv::FOURCC_24BG:
+            return plane == 0 ? width * 3 : 0;
+        case libyuv::FOURCC_ABGR:
+        case libyuv::FOURCC_ARGB:
+            return plane == 0 ? width * 4 : 0;
+        case libyuv::FOURCC_J400:
+            return plane == 0 ? width : 0;
+        case libyuv::FOURCC_I420:
+        case libyuv::FOURCC_I422:
+            return plane == 0 ? width : width / 2;
+        case libyuv::FOURCC_NV12:
+        case libyuv::FOURCC_NV21:
+            return plane < 2 ? width : 0;
+        case libyuv::FOURCC_P010:
+            // 16-bit samples with the 10 significant bits at the top.
+            return plane < 2 ? width * 2 : 0;
+        case libyuv::FOURCC_YUY2:
+        case libyuv::FOURCC_UYVY:
+            return plane == 0 ? width * 2 : 0;
+        default:
+            return 0;
+    }
+}
+
+// Planes of a frame whose planes follow each other in one block of memory,
+// with rows of the first plane `stride` bytes apart, like the single-planar
+// formats of V4L2. Rows of chroma planes are padded in proportion.
+// `size` is set to the bytes that the frame spans.
+static Planes strided_planes(uint32_t fourcc, const uint8_t* frame,
+                             int32_t width, int32_t height, int32_t stride, size_t& size) {
+    uint8_t* data = const_cast<uint8_t*>(frame);
+    int32_t row_bytes = plane_row_bytes(fourcc, 0, width);
+    Planes planes;
+    uint8_t* next = data;
+    for (int i = 0; i < 3; i++) {
+        int32_t plane_bytes = plane_row_bytes(fourcc, i, width);
+        if (!plane_bytes) {
+            continue;
+        }
+        planes.data[i] = next;
+        planes.stride[i] = static_cast<int32_t>(static_cast<int64_t>(stride) * plane_bytes / row_bytes);
+        next += static_cast<size_t>(planes.stride[i]) * (height >> plane_vertical_shift(fourcc, i));
+    }
+    size = static_cast<size_t>(next - data);
+    return planes;
+}
+
+// Whether the planes are laid out like fourcc_planes() would return them,
+// that is, the frame is a single contiguous block of memory.
+static bool is_contiguous(uint32_t fourcc, const Planes& planes, int32_t width, int32_t height) {
+    Planes contiguous = fourcc_planes(fourcc, planes.data[0], width, height);
+    for (int i = 0; i < 3; i++) {
+        if (planes.data[i] != contiguous.data[i] || planes.stride[i] != contiguous.stride[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copies a frame between planes of the same format, row by row if strides differ.
+static void copy_frame(uint32_t fourcc, const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    for (int i = 0; i < 3; i++) {
+        if (src.data[i]) {
+            libyuv::CopyPlane(
+                src.data[i], src.stride[i],
+                dst.data[i], dst.stride[i],
+                plane_row_bytes(fourcc, i, width),
+                height >> plane_vertical_shift(fourcc, i));
+        }
+    }
+}
+
+// Conversions which libyuv cannot do in a single pass are row-tiled:
+// each band of rows goes through both steps before moving on, so that
+// the intermediate stays in cache instead of round-tripping a full frame
+// through memory.
+
+// Target size of the intermediate rows of one band.
+static constexpr int32_t BAND_BYTES = 64 * 1024;
+
+// Rows per band for `row_bytes` of intermediate data per row.
+// Always even so that bands start on a chroma row of 4:2:0 formats.
+static int32_t band_height(int32_t row_bytes) {
+    int32_t rows = BAND_BYTES / std::max<int32_t>(row_bytes, 1);
+    return std::max<int32_t>(rows & ~1, 2);
+}
+
+// Per-thread scratch memory for the intermediate rows of a band.
+// Conversions that run another row-tiled conversion on each of their
+// bands keep their own rows in `slot` 1.
+static uint8_t* band_buffer(size_t size, int slot = 0) {
+    thread_local std::vector<uint8_t> buffers[2];
+    std::vector<uint8_t>& buffer = buffers[slot];
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+    return buffer.data();
+}
+
+// Runs `to_bgra(y, rows, bgra)` and `from_bgra(bgra, y, rows)` band by band.
+template <typename ToBgra, typename FromBgra>
+static void via_bgra_rows(int32_t width, int32_t height, ToBgra to_bgra, FromBgra from_bgra) {
+    int32_t band = band_height(width * 4);
+    uint8_t* bgra = band_buffer(static_cast<size_t>(width) * 4 * band);
+    for (int32_t y = 0; y < height; y += band) {
+        int32_t rows = std::min(band, height - y);
+        to_bgra(y, rows, bgra);
+        from_bgra(bgra, y, rows);
+    }
+}
 
 // copy
-static void gray_to_bgra(const uint8_t *gray, uint8_t* bgra, int32_t width, int32_t height) {
+static void gray_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::J400ToARGB(
-        gray, width,
-        bgra, width * 4,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
 // copy
-static void rgb_to_bgra(const uint8_t *rgb, uint8_t* bgra, int32_t width, int32_t height) {
+static void rgb_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::RAWToARGB(
-        rgb, width * 3,
-        bgra, width * 4,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
 // copy
-static void bgra_to_rgba(const uint8_t *bgra, uint8_t* rgba, int32_t width, int32_t height) {
+static void bgra_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::ARGBToABGR(
-        bgra, width * 4,
-        rgba, width * 4,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
 // copy
-static void bgra_to_bgra(const uint8_t *src, uint8_t* dist, int32_t width, int32_t height) {
+static void bgra_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::ARGBCopy(
-        src, width * 4,
-        dist, width * 4,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
 #define rgba_to_rgba bgra_to_bgra
 
 // horizontal and vertical subsampling and yuv conversion
-static void rgb_to_i420(const uint8_t *rgb, uint8_t* i420, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
-
+static void rgb_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::RAWToI420(
-        rgb, width * 3,
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        width, height_);
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
 }
 
 // copy
-static void bgr_to_bgra(const uint8_t *bgr, uint8_t* bgra, int32_t width, int32_t height) {
+static void bgr_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::RGB24ToARGB(
-        bgr, width * 3,
-        bgra, width * 4,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
 // horizontal and vertical subsampling and yuv conversion
-static void bgr_to_i420(const uint8_t *bgr, uint8_t* i420, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
-
+static void bgr_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::RGB24ToI420(
-        bgr, width * 3,
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        width, height_);
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
 }
 
 // horizontal and vertical subsampling and yuv conversion
-static void bgra_to_nv12(const uint8_t *bgra, uint8_t* nv12, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
+static void bgra_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::ARGBToNV12(
-        bgra, width * 4,
-        nv12, width,
-        nv12 + width * height, width,
-        width, height_);
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        width, height);
 }
 
 // horizontal subsampling and yuv conversion
-static void bgra_to_uyvy(const uint8_t *bgra, uint8_t* uyvy, int32_t width, int32_t height) {
+static void bgra_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::ARGBToUYVY(
-        bgra, width * 4,
-        uyvy, width * 2,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// horizontal and vertical subsampling and yuv conversion
+static void bgra_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::ARGBToI420(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
+}
+
+// copy, drops alpha
+static void bgra_to_rgb(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::ARGBToRAW(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// copy, drops alpha
+static void bgra_to_bgr(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::ARGBToRGB24(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
 // copy
-static void i420_to_nv12(const uint8_t *i420, uint8_t* nv12, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
+static void rgba_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::ABGRToARGB(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
 
+// horizontal and vertical subsampling and yuv conversion
+static void rgba_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::ABGRToI420(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
+}
+
+// horizontal and vertical subsampling and yuv conversion
+static void rgba_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::ABGRToNV12(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        width, height);
+}
+
+// horizontal subsampling and yuv conversion, row-tiled
+static void rgba_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::ABGRToARGB(plane_row(src, 0, y), src.stride[0], bgra, width * 4, width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToUYVY(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// copy
+static void i420_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::I420ToNV12(
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        nv12, width,
-        nv12 + width * height, width,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        width, height);
 }
 
 // horizontal and vertical upsampling and yuv conversion
-static void i420_to_bgra(const uint8_t *i420, uint8_t* bgra, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
-
+static void i420_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::I420ToARGB(
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        bgra, width * 4,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        width, height);
 }
 
 // horizontal and vertical upsampling and yuv conversion
-static void i420_to_rgba(const uint8_t *i420, uint8_t* rgba, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
-
+static void i420_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::I420ToABGR(
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        rgba, width * 4,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        width, height);
 }
 
-// copy
-static void nv12_to_i420(const uint8_t *nv12, uint8_t* i420, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
+// horizontal and vertical upsampling and yuv conversion
+static void i420_to_rgb(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I420ToRAW(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
 
+// horizontal and vertical upsampling and yuv conversion
+static void i420_to_bgr(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I420ToRGB24(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// copy
+static void nv12_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::NV12ToI420(
-        nv12, width,
-        nv12 + width * height, width,
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
 }
 
 // horizontal and vertical upsampling and yuv conversion
-static void nv12_to_bgra(const uint8_t *nv12, uint8_t* bgra, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
+static void nv12_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::NV12ToARGB(
-        nv12, width,
-        nv12 + width * height, width,
-        bgra, width * 4,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        width, height);
 }
 
 // horizontal and vertical upsampling and yuv conversion
-static void nv12_to_rgba(const uint8_t *nv12, uint8_t* rgba, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
+static void nv12_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::NV12ToABGR(
-        nv12, width,
-        nv12 + width * height, width,
-        rgba, width * 4,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        width, height);
 }
 
 // vertical upsampling
-static void i420_to_uyvy(const uint8_t *i420, uint8_t* uyvy, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
-
+static void i420_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::I420ToUYVY(
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        uyvy, width * 2,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        width, height);
 }
 
 // vertical subsampling
-static void yuyv_to_nv12(const uint8_t *yuyv, uint8_t* nv12, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
+static void yuyv_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::YUY2ToNV12(
-        yuyv, width * 2,
-        nv12, width,
-        nv12 + width * height, width,
-        width, height_);
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        width, height);
 }
 
 // vertical subsampling
-static void yuyv_to_i420(const uint8_t *yuyv, uint8_t* i420, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-    int32_t half_height = height / 2;
-
+static void yuyv_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::YUY2ToI420(
-        yuyv, width * 2,
-        i420, width,
-        i420 + width * height, half_width,
-        i420 + width * height + half_width * half_height, half_width,
-        width, height_);
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
 }
 
 // copy
-static void yuyv_to_i422(const uint8_t *yuyv, uint8_t* i422, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-
+static void yuyv_to_i422(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::YUY2ToI422(
-        yuyv, width * 2,
-        i422, width,
-        i422 + width * height, half_width,
-        i422 + width * height + half_width * height, half_width,
-        width, height_);
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
 }
 
 // horizontal upsampling and yuv conversion
-static void yuyv_to_bgra(const uint8_t *yuyv, uint8_t* bgra, int32_t width, int32_t height) {
+static void yuyv_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::YUY2ToARGB(
-        yuyv, width * 2,
-        bgra, width * 4,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
 // vertical subsampling
-static void uyvy_to_nv12(const uint8_t *uyvy, uint8_t* nv12, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
+static void uyvy_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::UYVYToNV12(
-        uyvy, width * 2,
-        nv12, width,
-        nv12 + width * height, width,
-        width, height_);
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        width, height);
 }
 
 // copy
-static void i422_to_uyvy(const uint8_t *i422, uint8_t* uyvy, int32_t width, int32_t height) {
-    int32_t height_ = height;
-    height = std::abs(height);
-    int32_t half_width = width / 2;
-
+static void i422_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::I422ToUYVY(
-        i422, width,
-        i422 + width * height, half_width,
-        i422 + width * height + half_width * height, half_width,
-        uyvy, width * 2,
-        width, height_);
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// copy
+static void uyvy_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::CopyPlane(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width * 2, height);
 }
 
 // horizontal upsampling and yuv conversion
-static void uyvy_to_bgra(const uint8_t *uyvy, uint8_t* bgra, int32_t width, int32_t height) {
+static void uyvy_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
     libyuv::UYVYToARGB(
-        uyvy, width * 2,
-        bgra, width * 4,
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// copy
+// libyuv RGB24 is BGR in memory, so this keeps the byte order and adds alpha.
+static void rgb_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::RGB24ToARGB(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// copy
+// libyuv RAW is RGB in memory, so this swaps red and blue and adds alpha.
+static void bgr_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::RAWToARGB(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// copy
+// Gray replicated into all channels is the same in either channel order.
+#define gray_to_rgba gray_to_bgra
+
+// horizontal upsampling and yuv conversion, row-tiled
+static void yuyv_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::YUY2ToARGB(plane_row(src, 0, y), src.stride[0], bgra, width * 4, width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToABGR(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// horizontal upsampling and yuv conversion, row-tiled
+static void uyvy_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::UYVYToARGB(plane_row(src, 0, y), src.stride[0], bgra, width * 4, width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToABGR(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// Writes Y directly into the NV12 destination and only keeps the chroma
+// planes of each band in scratch memory before interleaving them.
+template <typename ToI420>
+static void via_i420_chroma_rows(const Planes& dst, int32_t width, int32_t height, ToI420 to_i420) {
+    int32_t half_width = (width + 1) / 2;
+    int32_t band = band_height(half_width);
+    uint8_t* u = band_buffer(static_cast<size_t>(half_width) * band);
+    uint8_t* v = u + half_width * (band / 2);
+    for (int32_t y = 0; y < height; y += band) {
+        int32_t rows = std::min(band, height - y);
+        to_i420(y, rows, u, v, half_width);
+        libyuv::MergeUVPlane(
+            u, half_width,
+            v, half_width,
+            plane_row(dst, 1, y / 2), dst.stride[1],
+            width / 2, rows / 2);
+    }
+}
+
+// horizontal and vertical subsampling and yuv conversion, row-tiled chroma
+static void rgb_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_i420_chroma_rows(dst, width, height, [&](int32_t y, int32_t rows,
+            uint8_t* u, uint8_t* v, int32_t uv_stride) {
+        libyuv::RAWToI420(
+            plane_row(src, 0, y), src.stride[0],
+            plane_row(dst, 0, y), dst.stride[0],
+            u, uv_stride,
+            v, uv_stride,
+            width, rows);
+    });
+}
+
+// horizontal and vertical subsampling and yuv conversion, row-tiled chroma
+static void bgr_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_i420_chroma_rows(dst, width, height, [&](int32_t y, int32_t rows,
+            uint8_t* u, uint8_t* v, int32_t uv_stride) {
+        libyuv::RGB24ToI420(
+            plane_row(src, 0, y), src.stride[0],
+            plane_row(dst, 0, y), dst.stride[0],
+            u, uv_stride,
+            v, uv_stride,
+            width, rows);
+    });
+}
+
+// yuv conversion, row-tiled
+static void gray_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::J400ToARGB(plane_row(src, 0, y), src.stride[0], bgra, width * 4, width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToNV12(
+            bgra, width * 4,
+            plane_row(dst, 0, y), dst.stride[0],
+            plane_row(dst, 1, y / 2), dst.stride[1],
+            width, rows);
+    });
+}
+
+// horizontal subsampling and yuv conversion, row-tiled
+static void rgb_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::RAWToARGB(plane_row(src, 0, y), src.stride[0], bgra, width * 4, width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToUYVY(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// horizontal subsampling and yuv conversion, row-tiled
+static void bgr_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::RGB24ToARGB(plane_row(src, 0, y), src.stride[0], bgra, width * 4, width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToUYVY(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// yuv conversion, row-tiled
+static void gray_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::J400ToARGB(plane_row(src, 0, y), src.stride[0], bgra, width * 4, width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToUYVY(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// vertical upsampling, row-tiled chroma
+// Y is read straight from the source, only the deinterleaved
+// chroma rows of each band go through scratch memory.
+// `vu` is set for NV21, whose chroma pairs start with V.
+static void semi_planar_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height,
+                                bool vu) {
+    int32_t half_width = (width + 1) / 2;
+    int32_t band = band_height(half_width);
+    uint8_t* u = band_buffer(static_cast<size_t>(half_width) * band);
+    uint8_t* v = u + half_width * (band / 2);
+    for (int32_t y = 0; y < height; y += band) {
+        int32_t rows = std::min(band, height - y);
+        libyuv::SplitUVPlane(
+            plane_row(src, 1, y / 2), src.stride[1],
+            vu ? v : u, half_width,
+            vu ? u : v, half_width,
+            width / 2, rows / 2);
+        libyuv::I420ToUYVY(
+            plane_row(src, 0, y), src.stride[0],
+            u, half_width,
+            v, half_width,
+            plane_row(dst, 0, y), dst.stride[0],
+            width, rows);
+    }
+}
+
+// vertical upsampling, row-tiled chroma
+static void nv12_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    semi_planar_to_uyvy(src, dst, width, height, false);
+}
+
+// copy
+static void nv21_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV21ToI420(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
+}
+
+// copy, swaps the bytes of each chroma pair
+static void nv21_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV21ToNV12(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+static void nv21_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV21ToARGB(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+static void nv21_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV21ToABGR(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// vertical upsampling, row-tiled chroma
+static void nv21_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    semi_planar_to_uyvy(src, dst, width, height, true);
+}
+
+// Reduces samples to their top 8 bits, so that 10-bit P010 becomes NV12.
+// Strides of P010 are in bytes like everywhere else but libyuv counts
+// them in 16-bit samples.
+static void p010_to_nv12(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    for (int i = 0; i < 2; i++) {
+        libyuv::Convert16To8Plane(
+            reinterpret_cast<const uint16_t*>(src.data[i]), src.stride[i] / 2,
+            dst.data[i], dst.stride[i],
+            256, width, height >> i);
+    }
+}
+
+// Runs `from_nv12(nv12, y, rows)` band by band on P010 rows
+// reduced to NV12 in scratch memory.
+template <typename FromNv12>
+static void via_nv12_rows(const Planes& src, int32_t width, int32_t height, FromNv12 from_nv12) {
+    int32_t band = band_height(width + width / 2);
+    uint8_t* data = band_buffer(static_cast<size_t>(width) * band * 3 / 2, 1);
+    Planes nv12 = fourcc_planes(libyuv::FOURCC_NV12, data, width, band);
+    for (int32_t y = 0; y < height; y += band) {
+        int32_t rows = std::min(band, height - y);
+        p010_to_nv12(band_planes(libyuv::FOURCC_P010, src, y), nv12, width, rows);
+        from_nv12(nv12, y, rows);
+    }
+}
+
+// bit depth reduction, row-tiled
+static void p010_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_nv12_rows(src, width, height, [&](const Planes& nv12, int32_t y, int32_t rows) {
+        nv12_to_i420(nv12, band_planes(libyuv::FOURCC_I420, dst, y), width, rows);
+    });
+}
+
+// bit depth reduction and vertical upsampling, row-tiled
+static void p010_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_nv12_rows(src, width, height, [&](const Planes& nv12, int32_t y, int32_t rows) {
+        nv12_to_uyvy(nv12, band_planes(libyuv::FOURCC_UYVY, dst, y), width, rows);
+    });
+}
+
+// bit depth reduction, upsampling and yuv conversion, row-tiled
+static void p010_to_bgra(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_nv12_rows(src, width, height, [&](const Planes& nv12, int32_t y, int32_t rows) {
+        nv12_to_bgra(nv12, band_planes(libyuv::FOURCC_ARGB, dst, y), width, rows);
+    });
+}
+
+// bit depth reduction, upsampling and yuv conversion, row-tiled
+static void p010_to_rgba(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_nv12_rows(src, width, height, [&](const Planes& nv12, int32_t y, int32_t rows) {
+        nv12_to_rgba(nv12, band_planes(libyuv::FOURCC_ABGR, dst, y), width, rows);
+    });
+}
+
+// copy
+// Swaps luma and chroma bytes within each 4-byte macropixel.
+static void yuyv_to_uyvy(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    static const uint8_t shuffler[16] = {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14};
+    libyuv::ARGBShuffle(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        shuffler,
+        width / 2, height);
+}
+
+// vertical subsampling
+static void uyvy_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::UYVYToI420(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
+}
+
+// copy, chroma is set to neutral
+static void gray_to_i420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I400ToI420(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
+}
+
+// vertical upsampling
+static void i420_to_yuyv(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I420ToYUY2(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// copy of the luma plane
+static void i420_to_gray(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::CopyPlane(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+#define nv12_to_gray i420_to_gray
+#define nv21_to_gray i420_to_gray
+
+// luma extraction
+static void yuyv_to_gray(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::YUY2ToY(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        width, height);
+}
+
+// luma extraction
+static void uyvy_to_gray(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::UYVYToY(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
         width, height);
 }
 
@@ -284,6 +864,10 @@ static int32_t bgra_frame_size(int32_t width, int32_t height) {
     return width * height * 4;
 }
 
+static int32_t rgb_frame_size(int32_t width, int32_t height) {
+    return width * height * 3;
+}
+
 static int32_t gray_frame_size(int32_t width, int32_t height) {
     return width * height;
 }
@@ -296,7 +880,178 @@ static int32_t i422_frame_size(int32_t width, int32_t height) {
     return width * height * 2;
 }
 
+static int32_t p010_frame_size(int32_t width, int32_t height) {
+    return width * height * 3;
+}
+
 #define rgba_frame_size bgra_frame_size
+#define bgr_frame_size rgb_frame_size
 #define nv12_frame_size i420_frame_size
+#define nv21_frame_size i420_frame_size
 #define uyvy_frame_size i422_frame_size
-#define yuyv_frame_size i422_frame_size
\ No newline at end of file
+#define yuyv_frame_size i422_frame_size
+
+// Size of a contiguous frame in the given format, or 0 if the format is unknown.
+static int32_t fourcc_frame_size(uint32_t fourcc, int32_t width, int32_t height) {
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_RAW:
+            return rgb_frame_size(width, height);
+        case libyuv::FOURCC_24BG:
+            return bgr_frame_size(width, height);
+        case libyuv::FOURCC_ABGR:
+            return rgba_frame_size(width, height);
+        case libyuv::FOURCC_ARGB:
+            return bgra_frame_size(width, height);
+        case libyuv::FOURCC_J400:
+            return gray_frame_size(width, height);
+        case libyuv::FOURCC_I420:
+            return i420_frame_size(width, height);
+        case libyuv::FOURCC_NV12:
+            return nv12_frame_size(width, height);
+        case libyuv::FOURCC_NV21:
+            return nv21_frame_size(width, height);
+        case libyuv::FOURCC_P010:
+            return p010_frame_size(width, height);
+        case libyuv::FOURCC_YUY2:
+            return yuyv_frame_size(width, height);
+        case libyuv::FOURCC_UYVY:
+            return uyvy_frame_size(width, height);
+        default:
+            return 0;
+    }
+}
+
+// Signature shared by the conversion functions above.
+typedef void (*Converter)(const Planes& src, const Planes& dst, int32_t width, int32_t height);
+
+// The conversion function between two formats, or nullptr if there is none.
+// Identical formats have none either, see copy_frame().
+static Converter find_converter(uint32_t src_fourcc, uint32_t dst_fourcc) {
+    struct Entry {
+        uint32_t src;
+        uint32_t dst;
+        Converter convert;
+    };
+    static const Entry table[] = {
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_ARGB, rgb_to_bgra},
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_ABGR, rgb_to_rgba},
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_I420, rgb_to_i420},
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_NV12, rgb_to_nv12},
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_UYVY, rgb_to_uyvy},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_ARGB, bgr_to_bgra},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_ABGR, bgr_to_rgba},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_I420, bgr_to_i420},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_NV12, bgr_to_nv12},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_UYVY, bgr_to_uyvy},
+        {libyuv::FOURCC_J400, libyuv::FOURCC_ARGB, gray_to_bgra},
+        {libyuv::FOURCC_J400, libyuv::FOURCC_ABGR, gray_to_rgba},
+        {libyuv::FOURCC_J400, libyuv::FOURCC_I420, gray_to_i420},
+        {libyuv::FOURCC_J400, libyuv::FOURCC_NV12, gray_to_nv12},
+        {libyuv::FOURCC_J400, libyuv::FOURCC_UYVY, gray_to_uyvy},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_RAW,  bgra_to_rgb},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_24BG, bgra_to_bgr},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_ABGR, bgra_to_rgba},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_I420, bgra_to_i420},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_NV12, bgra_to_nv12},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_UYVY, bgra_to_uyvy},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_ARGB, rgba_to_bgra},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_I420, rgba_to_i420},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_NV12, rgba_to_nv12},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_UYVY, rgba_to_uyvy},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_RAW,  i420_to_rgb},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_24BG, i420_to_bgr},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_ARGB, i420_to_bgra},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_ABGR, i420_to_rgba},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_J400, i420_to_gray},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_NV12, i420_to_nv12},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_YUY2, i420_to_yuyv},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_UYVY, i420_to_uyvy},
+        {libyuv::FOURCC_NV12, libyuv::FOURCC_ARGB, nv12_to_bgra},
+        {libyuv::FOURCC_NV12, libyuv::FOURCC_ABGR, nv12_to_rgba},
+        {libyuv::FOURCC_NV12, libyuv::FOURCC_J400, nv12_to_gray},
+        {libyuv::FOURCC_NV12, libyuv::FOURCC_I420, nv12_to_i420},
+        {libyuv::FOURCC_NV12, libyuv::FOURCC_UYVY, nv12_to_uyvy},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_ARGB, nv21_to_bgra},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_ABGR, nv21_to_rgba},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_J400, nv21_to_gray},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_I420, nv21_to_i420},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_NV12, nv21_to_nv12},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_UYVY, nv21_to_uyvy},
+        {libyuv::FOURCC_P010, libyuv::FOURCC_ARGB, p010_to_bgra},
+        {libyuv::FOURCC_P010, libyuv::FOURCC_ABGR, p010_to_rgba},
+        {libyuv::FOURCC_P010, libyuv::FOURCC_I420, p010_to_i420},
+        {libyuv::FOURCC_P010, libyuv::FOURCC_NV12, p010_to_nv12},
+        {libyuv::FOURCC_P010, libyuv::FOURCC_UYVY, p010_to_uyvy},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_ARGB, yuyv_to_bgra},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_ABGR, yuyv_to_rgba},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_J400, yuyv_to_gray},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_I420, yuyv_to_i420},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_NV12, yuyv_to_nv12},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_UYVY, yuyv_to_uyvy},
+        {libyuv::FOURCC_UYVY, libyuv::FOURCC_ARGB, uyvy_to_bgra},
+        {libyuv::FOURCC_UYVY, libyuv::FOURCC_ABGR, uyvy_to_rgba},
+        {libyuv::FOURCC_UYVY, libyuv::FOURCC_J400, uyvy_to_gray},
+        {libyuv::FOURCC_UYVY, libyuv::FOURCC_I420, uyvy_to_i420},
+        {libyuv::FOURCC_UYVY, libyuv::FOURCC_NV12, uyvy_to_nv12},
+    };
+    src_fourcc = libyuv::CanonicalFourCC(src_fourcc);
+    dst_fourcc = libyuv::CanonicalFourCC(dst_fourcc);
+    for (const Entry& entry : table) {
+        if (entry.src == src_fourcc && entry.dst == dst_fourcc) {
+            return entry.convert;
+        }
+    }
+    return nullptr;
+}
+
+// The converter from `src_fourcc` into a backend's native `dst_fourcc`.
+// Unlike find_converter(), identical packed formats have a copy, which
+// backends need to flip frames or to remove row padding on the way out.
+// Backends look this up once when they start, so that sending a frame
+// does not dispatch on formats.
+static Converter find_output_converter(uint32_t src_fourcc, uint32_t dst_fourcc) {
+    src_fourcc = libyuv::CanonicalFourCC(src_fourcc);
+    dst_fourcc = libyuv::CanonicalFourCC(dst_fourcc);
+    if (src_fourcc == dst_fourcc) {
+        switch (src_fourcc) {
+            case libyuv::FOURCC_ARGB:
+                return bgra_to_bgra;
+            case libyuv::FOURCC_ABGR:
+                return rgba_to_rgba;
+            case libyuv::FOURCC_UYVY:
+                return uyvy_to_uyvy;
+            default:
+                return nullptr;
+        }
+    }
+    return find_converter(src_fourcc, dst_fourcc);
+}
+
+// Bands smaller than this are not worth handing to another thread.
+static constexpr int32_t MIN_PARALLEL_ROWS = 64;
+
+// Runs `convert` on horizontal bands spread over `pool`, or in one go if
+// there is no pool or the frame is too small to be worth splitting.
+// Bands start on even rows so that 4:2:0 chroma rows are never split.
+static void convert_frame(Converter convert,
+                          uint32_t src_fourcc, const Planes& src,
+                          uint32_t dst_fourcc, const Planes& dst,
+                          int32_t width, int32_t height, ThreadPool* pool) {
+    int32_t bands = 1;
+    if (pool) {
+        bands = std::min<int32_t>(pool->size(), height / MIN_PARALLEL_ROWS);
+    }
+    if (bands <= 1) {
+        convert(src, dst, width, height);
+        return;
+    }
+    int32_t band = ((height + bands - 1) / bands + 1) & ~1;
+    pool->parallel_for(bands, [&](uint32_t i) {
+        int32_t y = static_cast<int32_t>(i) * band;
+        if (y >= height) {
+            return;
+        }
+        int32_t rows = std::min(band, height - y);
+        convert(band_planes(src_fourcc, src, y), band_planes(dst_fourcc, dst, y), width, rows);
+    });
+}
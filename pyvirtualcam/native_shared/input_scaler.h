@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <libyuv.h>
+#include "conversion_graph.h"
+#include "frame_changes.h"
+#include "image_formats.h"
+
+// Resizes frames sent at the input size to the camera size, before
+// they reach a backend that only converts at one size.
+class InputScaler {
+  public:
+    // Format of scaled frames for input frames in `fourcc`: the input
+    // format if libyuv can scale it, RGB for RGB input so that chroma
+    // is not subsampled twice on the way to RGB outputs, and I420 otherwise.
+    static uint32_t scaled_fourcc(uint32_t fourcc) {
+        fourcc = libyuv::CanonicalFourCC(fourcc);
+        if (is_scalable(fourcc)) {
+            return fourcc;
+        }
+        switch (fourcc) {
+            case libyuv::FOURCC_RAW:
+            case libyuv::FOURCC_24BG:
+                return libyuv::FOURCC_ARGB;
+            default:
+                return libyuv::FOURCC_I420;
+        }
+    }
+
+    // If `skip_unchanged`, frames that did not change are not scaled again.
+    InputScaler(uint32_t fourcc, int32_t input_width, int32_t input_height,
+                int32_t width, int32_t height, libyuv::FilterMode filter,
+                bool skip_unchanged = false)
+     : _graph {{fourcc, input_width, input_height},
+               {{scaled_fourcc(fourcc), width, height}}, filter} {
+        if (skip_unchanged) {
+            _changes = std::make_unique<FrameChanges>(fourcc, input_width, input_height);
+        }
+    }
+
+    // Planes of the scaled frame, valid until the next call.
+    Planes scale(const Planes& frame, ThreadPool* pool) {
+        const std::vector<DirtyRect>* dirty = nullptr;
+        return scale(frame, pool, dirty);
+    }
+
+    // Like scale(frame, pool) for a frame in which `dirty` changed, or which
+    // is compared by hash if it is nullptr. Afterwards, `dirty` tells the
+    // same for the scaled frame: either nothing changed or it is nullptr.
+    Planes scale(const Planes& frame, ThreadPool* pool, const std::vector<DirtyRect>*& dirty) {
+        if (_changes) {
+            static const std::vector<DirtyRect> unchanged;
+            const std::vector<RowBand>& bands = _changes->update(frame, dirty);
+            // Scales the whole frame unless nothing changed.
+            _graph.run_bands(frame, bands, pool);
+            dirty = bands.empty() ? &unchanged : nullptr;
+        } else {
+            _graph.run(frame, {}, pool);
+        }
+        const ConversionGraph::Format& out = _graph.sink_format(0);
+        return fourcc_planes(out.fourcc, const_cast<uint8_t*>(_graph.output(0)),
+                             out.width, out.height);
+    }
+
+  private:
+    ConversionGraph _graph;
+    std::unique_ptr<FrameChanges> _changes;
+};
+
+// Whether frames sent at the input size need scaling,
+// where a zero input width or height stands for the camera size.
+static bool is_resized(uint32_t width, uint32_t height,
+                       uint32_t input_width, uint32_t input_height) {
+    return (input_width != 0 && input_width != width) ||
+           (input_height != 0 && input_height != height);
+}
+
+// Format a backend receives frames in when they are sent in `fourcc`.
+static uint32_t backend_fourcc(uint32_t fourcc, uint32_t width, uint32_t height,
+                               uint32_t input_width, uint32_t input_height) {
+    if (!is_resized(width, height, input_width, input_height)) {
+        return fourcc;
+    }
+    return InputScaler::scaled_fourcc(fourcc);
+}
+
+// Scaler for the `input_size` option of a backend, or nullptr
+// if frames are sent at the camera size.
+static std::unique_ptr<InputScaler> make_input_scaler(
+        uint32_t fourcc, uint32_t width, uint32_t height,
+        uint32_t input_width, uint32_t input_height, const std::string& filter,
+        bool skip_unchanged = false) {
+    libyuv::FilterMode mode = parse_filter_mode(filter);
+    if (!is_resized(width, height, input_width, input_height)) {
+        return nullptr;
+    }
+    return std::make_unique<InputScaler>(fourcc,
+        input_width ? input_width : width, input_height ? input_height : height,
+        width, height, mode, skip_unchanged);
+}
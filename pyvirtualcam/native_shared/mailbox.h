@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+// Hands the latest item from producers to a consumer thread without locks.
+//
+// The mailbox holds at most one item. Posting replaces an item that the
+// consumer did not take yet and gives it back to the producer, so that
+// producers never wait for a slow consumer and the consumer always gets
+// the most recent item.
+template <typename T>
+class Mailbox {
+  public:
+    Mailbox() = default;
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    ~Mailbox() {
+        delete _slot.exchange(nullptr);
+    }
+
+    // Returns the item that was replaced, or nullptr.
+    std::unique_ptr<T> post(std::unique_ptr<T> item) {
+        return std::unique_ptr<T>(_slot.exchange(item.release(), std::memory_order_acq_rel));
+    }
+
+    // Returns the posted item, or nullptr if there is none.
+    std::unique_ptr<T> take() {
+        return std::unique_ptr<T>(_slot.exchange(nullptr, std::memory_order_acq_rel));
+    }
+
+  private:
+    std::atomic<T*> _slot {nullptr};
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <mmsystem.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <cerrno>
+#include <time.h>
+#endif
+
+// Waits for frame deadlines at a fixed rate on the monotonic clock.
+//
+// Deadlines are slots of one frame interval after the first wait, so
+// that time spent producing a frame does not accumulate as drift.
+// The thread sleeps with the most precise timer of the platform until
+// shortly before the deadline and spins for the rest, as OS sleeps
+// routinely overshoot by more than the sub-millisecond accuracy needed
+// for smooth output at high frame rates. Spinning keeps a core busy, so
+// the default spin is about the overshoot of the platform's timers.
+class FramePacer {
+  public:
+    struct Slot {
+        // Deadlines that had already passed when waiting started,
+        // zero if the caller was on time.
+        uint64_t missed;
+        // How long the caller waited, and how late the wait returned.
+        // Negative lateness is not possible, early wakeups keep spinning.
+        int64_t waited_ns;
+        int64_t late_ns;
+    };
+
+    explicit FramePacer(double fps, int64_t spin_ns = -1) {
+        if (!(fps > 0)) {
+            throw std::invalid_argument("fps must be positive.");
+        }
+        _interval_ns = static_cast<int64_t>(1e9 / fps);
+#if defined(_WIN32)
+        QueryPerformanceFrequency(&_qpc_frequency);
+        // High resolution timers exist since Windows 10 1803, older
+        // versions round waits up to the timer tick of about 15.6 ms.
+        _timer = CreateWaitableTimerExW(nullptr, nullptr,
+            CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        bool high_resolution = _timer != nullptr;
+        if (!_timer) {
+            _timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+        }
+        if (!_timer) {
+            throw std::runtime_error("could not create waitable timer");
+        }
+        if (!high_resolution) {
+            // Shortens the tick to 1 ms system-wide while the pacer exists,
+            // so that waits overshoot by 1-2 ms. Otherwise the spin covers
+            // a whole tick, which at 60 fps is most of each frame on a core.
+            _period_raised = timeBeginPeriod(1) == TIMERR_NOERROR;
+        }
+        // Spinning costs up to the spin of CPU time per frame,
+        // 2 ms are 12% of a core at 60 fps.
+        _spin_ns = spin_ns >= 0 ? spin_ns
+            : high_resolution ? 1000000 : _period_raised ? 2000000 : 16000000;
+#elif defined(__APPLE__)
+        mach_timebase_info(&_timebase);
+        _spin_ns = spin_ns >= 0 ? spin_ns : 500000;
+#else
+        _spin_ns = spin_ns >= 0 ? spin_ns : 200000;
+#endif
+    }
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    ~FramePacer() {
+#if defined(_WIN32)
+        CloseHandle(_timer);
+        if (_period_raised) {
+            timeEndPeriod(1);
+        }
+#endif
+    }
+
+    int64_t interval_ns() const {
+        return _interval_ns;
+    }
+
+    // Starts a new schedule, the next wait() is one interval from now.
+    void reset() {
+        _started = false;
+    }
+
+    // Blocks until the next deadline. If deadlines were missed, returns
+    // immediately and moves the schedule to the latest missed deadline,
+    // so that late frames are not followed by a burst of catch-up frames.
+    Slot wait() {
+        int64_t now = now_ns();
+        if (!_started) {
+            _deadline = now;
+            _started = true;
+        }
+        _deadline += _interval_ns;
+
+        Slot slot {0, 0, 0};
+        if (now >= _deadline) {
+            uint64_t passed = static_cast<uint64_t>((now - _deadline) / _interval_ns);
+            _deadline += static_cast<int64_t>(passed) * _interval_ns;
+            slot.missed = passed + 1;
+            slot.late_ns = now - _deadline;
+            return slot;
+        }
+
+        int64_t t = wait_until(_deadline);
+        slot.waited_ns = t - now;
+        slot.late_ns = t - _deadline;
+        return slot;
+    }
+
+    // Blocks until `deadline_ns` on the clock of now_ns(), without
+    // changing the schedule. Returns the time after waiting.
+    int64_t wait_until(int64_t deadline_ns) {
+        if (deadline_ns - now_ns() > _spin_ns) {
+            sleep_until(deadline_ns - _spin_ns);
+        }
+        int64_t t = now_ns();
+        while (t < deadline_ns) {
+            std::this_thread::yield();
+            t = now_ns();
+        }
+        return t;
+    }
+
+    int64_t now_ns() const {
+#if defined(_WIN32)
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        // Split to avoid overflowing the product.
+        int64_t seconds = counter.QuadPart / _qpc_frequency.QuadPart;
+        int64_t rest = counter.QuadPart % _qpc_frequency.QuadPart;
+        return seconds * 1000000000 + rest * 1000000000 / _qpc_frequency.QuadPart;
+#elif defined(__APPLE__)
+        return static_cast<int64_t>(mach_absolute_time() * _timebase.numer / _timebase.denom);
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+    }
+
+  private:
+    int64_t _interval_ns;
+    int64_t _spin_ns;
+    bool _started = false;
+    int64_t _deadline = 0;
+#if defined(_WIN32)
+    LARGE_INTEGER _qpc_frequency;
+    HANDLE _timer;
+    // Whether timeBeginPeriod() was called, without a high resolution timer.
+    bool _period_raised = false;
+#elif defined(__APPLE__)
+    mach_timebase_info_data_t _timebase;
+#endif
+
+    void sleep_until(int64_t deadline_ns) {
+#if defined(_WIN32)
+        int64_t remaining = deadline_ns - now_ns();
+        if (remaining <= 0) {
+            return;
+        }
+        // Negative due times are relative, in 100 ns units.
+        LARGE_INTEGER due;
+        due.QuadPart = -(remaining / 100);
+        if (SetWaitableTimer(_timer, &due, 0, nullptr, nullptr, FALSE)) {
+            WaitForSingleObject(_timer, INFINITE);
+        }
+#elif defined(__APPLE__)
+        mach_wait_until(static_cast<uint64_t>(deadline_ns) * _timebase.denom / _timebase.numer);
+#else
+        timespec ts;
+        ts.tv_sec = deadline_ns / 1000000000;
+        ts.tv_nsec = deadline_ns % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        }
+#endif
+    }
+};
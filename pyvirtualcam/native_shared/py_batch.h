@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "image_formats.h"
+#include "thread_pool.h"
+
+namespace py = pybind11;
+
+// Sends one frame to each of several cameras of one backend in a single
+// call, see CameraGroup in camera.py. Frames are checked and taken apart
+// into planes with the GIL held, then all cameras convert and output
+// their frames in parallel while the GIL is released once.
+//
+// `CameraT` must have `Planes planes_of(py::object)`, which is called with
+// the GIL, and `void send_planes(const Planes&)`, which is called without.
+// The cameras must be distinct, as each one is sent to from one thread.
+template <typename CameraT>
+static void send_batch(const std::vector<CameraT*>& cameras, const py::list& frames) {
+    if (cameras.size() != frames.size()) {
+        throw std::invalid_argument("Number of frames must match the number of cameras.");
+    }
+    std::vector<Planes> planes;
+    planes.reserve(cameras.size());
+    for (size_t i = 0; i < cameras.size(); i++) {
+        // `frames` keeps the buffers alive while the GIL is released.
+        py::object frame = frames[i];
+        planes.push_back(cameras[i]->planes_of(frame));
+    }
+
+    std::vector<std::string> errors(cameras.size());
+    {
+        py::gil_scoped_release release;
+
+        // Shared by all batches, with one thread per camera of the largest
+        // batch so far. Never destroyed, as joining threads while the
+        // module is unloaded can hang on Windows.
+        static std::mutex pool_mutex;
+        static ThreadPool* pool = nullptr;
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        uint32_t count = static_cast<uint32_t>(cameras.size());
+        if (!pool || pool->size() < count) {
+            delete pool;
+            pool = new ThreadPool(count);
+        }
+        pool->parallel_for(count, [&](uint32_t i) {
+            try {
+                cameras[i]->send_planes(planes[i]);
+            } catch (std::exception& ex) {
+                errors[i] = ex.what();
+            }
+        });
+    }
+    for (const std::string& error : errors) {
+        if (!error.empty()) {
+            // Like errors of send(), the other frames were sent.
+            throw std::runtime_error(error);
+        }
+    }
+}
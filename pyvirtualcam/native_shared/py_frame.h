@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include "image_formats.h"
+
+namespace py = pybind11;
+
+// A writable numpy view onto native-format frame memory owned by a backend,
+// shaped like the frames that send() accepts in that format.
+// Packed YUV formats whose rows are padded are returned as (h, row bytes).
+// The view does not keep the memory alive.
+static py::array frame_view(uint32_t fourcc, const Planes& planes,
+                            uint32_t width, uint32_t height) {
+    py::ssize_t w = width;
+    py::ssize_t h = height;
+    py::ssize_t stride = planes.stride[0];
+    std::vector<py::ssize_t> shape;
+    std::vector<py::ssize_t> strides;
+
+    switch (libyuv::CanonicalFourCC(fourcc)) {
+        case libyuv::FOURCC_RAW:
+        case libyuv::FOURCC_24BG:
+            shape = {h, w, 3};
+            strides = {stride, 3, 1};
+            break;
+        case libyuv::FOURCC_ABGR:
+        case libyuv::FOURCC_ARGB:
+            shape = {h, w, 4};
+            strides = {stride, 4, 1};
+            break;
+        case libyuv::FOURCC_J400:
+            shape = {h, w};
+            strides = {stride, 1};
+            break;
+        case libyuv::FOURCC_YUY2:
+        case libyuv::FOURCC_UYVY:
+            if (stride == w * 2) {
+                shape = {w * h * 2};
+                strides = {1};
+            } else {
+                shape = {h, w * 2};
+                strides = {stride, 1};
+            }
+            break;
+        case libyuv::FOURCC_I420:
+        case libyuv::FOURCC_NV12:
+        case libyuv::FOURCC_NV21:
+        case libyuv::FOURCC_P010:
+            if (!is_contiguous(fourcc, planes, width, height)) {
+                throw std::logic_error("planar frame memory must be contiguous");
+            }
+            shape = {fourcc_frame_size(fourcc, width, height)};
+            strides = {1};
+            break;
+        default:
+            throw std::logic_error("not implemented");
+    }
+
+    // A base object stops numpy from copying the data.
+    py::capsule base(planes.data[0], [](void*) {});
+    return py::array(py::dtype::of<uint8_t>(), shape, strides, planes.data[0], base);
+}
+
+// Start and row stride of `rows` rows of `row_bytes` each in `array`.
+// The array is either 1D and contiguous or has `rows` as first dimension
+// and packed remaining dimensions, while the row stride can be anything,
+// including padding and negative strides of flipped views.
+static uint8_t* array_rows(const py::handle& obj, py::ssize_t rows, py::ssize_t row_bytes,
+                           int32_t& stride) {
+    if (!py::isinstance<py::array>(obj)) {
+        throw std::invalid_argument("frame must be a numpy array");
+    }
+    py::array array = py::reinterpret_borrow<py::array>(obj);
+    if (array.dtype().kind() != 'u' || array.itemsize() != 1) {
+        throw std::invalid_argument("frame dtype must be uint8");
+    }
+    py::ssize_t ndim = array.ndim();
+    if (ndim == 0 || array.size() != rows * row_bytes) {
+        throw std::invalid_argument("unexpected frame size");
+    }
+    if (ndim > 1 && array.shape(0) != rows) {
+        throw std::invalid_argument("unexpected number of frame rows");
+    }
+    py::ssize_t packed = 1;
+    for (py::ssize_t i = ndim - 1; i >= (ndim > 1 ? 1 : 0); i--) {
+        if (array.shape(i) > 1 && array.strides(i) != packed) {
+            throw std::invalid_argument("frame pixels must be packed within each row");
+        }
+        packed *= array.shape(i);
+    }
+    stride = static_cast<int32_t>(ndim > 1 ? array.strides(0) : row_bytes);
+    return static_cast<uint8_t*>(const_cast<void*>(array.data()));
+}
+
+// Planes of a frame passed to send(), without copying.
+// `frame` is a uint8 array which is either C-contiguous, of any shape, or
+// has padded rows as described in array_rows(). Planar frames can also be
+// given as a tuple of one array per plane, and those with interleaved
+// chroma (NV12, NV21, P010) as a single 2D array of 3/2 the rows whose
+// Y and UV rows share the same stride. P010 arrays hold the bytes of
+// its 16-bit samples.
+static Planes frame_planes(uint32_t fourcc, const py::object& frame,
+                           uint32_t width, uint32_t height) {
+    fourcc = libyuv::CanonicalFourCC(fourcc);
+    int plane_count = 0;
+    while (plane_count < 3 && plane_row_bytes(fourcc, plane_count, width)) {
+        plane_count++;
+    }
+    Planes planes;
+
+    if (py::isinstance<py::tuple>(frame)) {
+        py::tuple tuple = py::reinterpret_borrow<py::tuple>(frame);
+        if (plane_count == 1 || static_cast<int>(tuple.size()) != plane_count) {
+            throw std::invalid_argument(
+                "a tuple of planes must have one array per plane of planar frames");
+        }
+        for (int i = 0; i < plane_count; i++) {
+            planes.data[i] = array_rows(tuple[i],
+                height >> plane_vertical_shift(fourcc, i),
+                plane_row_bytes(fourcc, i, width), planes.stride[i]);
+        }
+        return planes;
+    }
+
+    if (py::isinstance<py::array>(frame)) {
+        py::array array = py::reinterpret_borrow<py::array>(frame);
+        if ((array.flags() & py::array::c_style) &&
+                array.dtype().kind() == 'u' && array.itemsize() == 1 &&
+                array.size() == fourcc_frame_size(fourcc, width, height)) {
+            uint8_t* data = static_cast<uint8_t*>(const_cast<void*>(array.data()));
+            return fourcc_planes(fourcc, data, width, height);
+        }
+        if (plane_count == 2 && array.ndim() == 2) {
+            planes.data[0] = array_rows(frame, height + height / 2,
+                                        plane_row_bytes(fourcc, 0, width), planes.stride[0]);
+            planes.data[1] = plane_row(planes, 0, height);
+            planes.stride[1] = planes.stride[0];
+            return planes;
+        }
+    }
+
+    if (plane_count > 1) {
+        throw std::invalid_argument(
+            "planar frames must be contiguous, a tuple of planes, or for NV12, NV21 and P010 a 2D array");
+    }
+    planes.data[0] = array_rows(frame, height, plane_row_bytes(fourcc, 0, width), planes.stride[0]);
+    return planes;
+}
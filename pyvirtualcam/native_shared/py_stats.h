@@ -0,0 +1,33 @@
+#pragma once
+
+#include <pybind11/pybind11.h>
+#include "stats.h"
+
+namespace py = pybind11;
+
+static py::dict histogram_dict(const LatencyHistogram& histogram) {
+    LatencyHistogram::Summary s = histogram.summary();
+    py::dict d;
+    d["count"] = s.count;
+    d["mean_ms"] = s.mean_ns / 1e6;
+    d["p50_ms"] = s.p50_ns / 1e6;
+    d["p99_ms"] = s.p99_ns / 1e6;
+    d["max_ms"] = s.max_ns / 1e6;
+    return d;
+}
+
+// The dict returned by Camera.stats() of the built-in backends.
+// `queue_dropped` counts frames replaced in the asynchronous queue.
+static py::dict stats_dict(const SendStats& stats, uint64_t queue_dropped) {
+    py::dict d;
+    d["frames_output"] = stats.frames_output.load(std::memory_order_relaxed);
+    d["frames_dropped"] = stats.frames_dropped.load(std::memory_order_relaxed) + queue_dropped;
+    d["bytes_output"] = stats.bytes_output.load(std::memory_order_relaxed);
+    d["frames_skipped"] = stats.frames_skipped.load(std::memory_order_relaxed);
+    d["frames_unchanged"] = stats.frames_unchanged.load(std::memory_order_relaxed);
+    d["pool_exhausted"] = stats.pool_exhausted.load(std::memory_order_relaxed);
+    d["convert"] = histogram_dict(stats.convert);
+    d["output"] = histogram_dict(stats.output);
+    d["send"] = histogram_dict(stats.send);
+    return d;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Latency histogram that threads can record into without locking.
+//
+// Buckets are log-linear: each power of two of nanoseconds is split into
+// eight linear sub-buckets, so percentiles are accurate to 12.5 %
+// from nanoseconds to minutes with a few kilobytes per histogram.
+class LatencyHistogram {
+  public:
+    struct Summary {
+        uint64_t count;
+        uint64_t mean_ns;
+        uint64_t p50_ns;
+        uint64_t p99_ns;
+        uint64_t max_ns;
+    };
+
+    void record(uint64_t ns) {
+        _buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = _max.load(std::memory_order_relaxed);
+        while (ns > max && !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Percentiles are upper bounds of their bucket, capped at the maximum.
+    // Concurrent recording may make the summary slightly inconsistent.
+    Summary summary() const {
+        Summary s {};
+        s.count = _count.load(std::memory_order_relaxed);
+        s.max_ns = _max.load(std::memory_order_relaxed);
+        if (s.count == 0) {
+            return s;
+        }
+        s.mean_ns = _sum.load(std::memory_order_relaxed) / s.count;
+        s.p50_ns = std::min(percentile(s.count, 0.50), s.max_ns);
+        s.p99_ns = std::min(percentile(s.count, 0.99), s.max_ns);
+        return s;
+    }
+
+  private:
+    static constexpr int SubBits = 3;
+    static constexpr int SubBuckets = 1 << SubBits;
+    static constexpr int BucketCount = (64 - SubBits + 1) * SubBuckets;
+
+    std::atomic<uint64_t> _buckets[BucketCount] {};
+    std::atomic<uint64_t> _count {0};
+    std::atomic<uint64_t> _sum {0};
+    std::atomic<uint64_t> _max {0};
+
+    static int bucket(uint64_t ns) {
+        if (ns < SubBuckets) {
+            return static_cast<int>(ns);
+        }
+        int msb = 63;
+        while (!(ns >> msb)) {
+            msb--;
+        }
+        int shift = msb - SubBits;
+        int sub = static_cast<int>((ns >> shift) & (SubBuckets - 1));
+        return (shift + 1) * SubBuckets + sub;
+    }
+
+    static uint64_t bucket_upper_bound(int i) {
+        if (i < SubBuckets) {
+            return static_cast<uint64_t>(i);
+        }
+        int shift = i / SubBuckets - 1;
+        uint64_t sub = static_cast<uint64_t>(i % SubBuckets);
+        return ((SubBuckets + sub + 1) << shift) - 1;
+    }
+
+    uint64_t percentile(uint64_t count, double p) const {
+        uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(count - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BucketCount; i++) {
+            seen += _buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return bucket_upper_bound(i);
+            }
+        }
+        return _max.load(std::memory_order_relaxed);
+    }
+};
+
+// Where the time of sending frames goes, for Camera.stats().
+// All members can be recorded into from any thread.
+struct SendStats {
+    // Pixel format conversion into the output format.
+    LatencyHistogram convert;
+    // Handing the converted frame to the device: device writes,
+    // queue or shared memory copies, or posting frames to the Mach server thread.
+    LatencyHistogram output;
+    // Whole send() calls of the caller, including queue pushes
+    // if frames are sent asynchronously.
+    LatencyHistogram send;
+    std::atomic<uint64_t> frames_output {0};
+    // Frames not delivered to the device, like when no app is
+    // capturing, the receiver skipped them, or writes failed.
+    std::atomic<uint64_t> frames_dropped {0};
+    std::atomic<uint64_t> bytes_output {0};
+    // Frames deliberately not converted or sent, like when
+    // the receiver did not ask for a new frame.
+    std::atomic<uint64_t> frames_skipped {0};
+    // Frames not converted as they did not change since the previous
+    // frame, see FrameChanges. The previous output is sent again.
+    std::atomic<uint64_t> frames_unchanged {0};
+    // Output buffers allocated because all buffers of a pool were in use,
+    // which should not happen once the pool is large enough.
+    std::atomic<uint64_t> pool_exhausted {0};
+
+    void record_output(uint64_t bytes) {
+        frames_output.fetch_add(1, std::memory_order_relaxed);
+        bytes_output.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void record_dropped() {
+        frames_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_skipped() {
+        frames_skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_unchanged() {
+        frames_unchanged.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_pool_exhausted() {
+        pool_exhausted.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// Records the time from construction to destruction into a histogram.
+class ScopedTimer {
+  public:
+    explicit ScopedTimer(LatencyHistogram& histogram)
+     : _histogram {histogram}, _start {std::chrono::steady_clock::now()} {
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - _start;
+        _histogram.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+  private:
+    LatencyHistogram& _histogram;
+    std::chrono::steady_clock::time_point _start;
+};
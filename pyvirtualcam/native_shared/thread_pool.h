@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run the tasks of one parallel_for()
+// at a time. The threads are created once and then wait for work, so that
+// splitting a frame conversion does not spawn threads per frame.
+class ThreadPool {
+  public:
+    // `threads` includes the calling thread, which also runs tasks.
+    explicit ThreadPool(uint32_t threads) {
+        for (uint32_t i = 1; i < threads; i++) {
+            _workers.emplace_back(&ThreadPool::run, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv_work.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    uint32_t size() const {
+        return static_cast<uint32_t>(_workers.size()) + 1;
+    }
+
+    // Calls `task(i)` for all i in [0, count) and returns when all are done.
+    // Tasks must not throw.
+    void parallel_for(uint32_t count, const std::function<void(uint32_t)>& task) {
+        if (_workers.empty() || count <= 1) {
+            for (uint32_t i = 0; i < count; i++) {
+                task(i);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> job_lock(_job_mutex);
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            // Workers late for the previous job may still be looking at it.
+            _cv_done.wait(lock, [this] { return _active == 0; });
+            _task = &task;
+            _count = count;
+            _next = 0;
+            _done = 0;
+            _generation++;
+        }
+        _cv_work.notify_all();
+
+        work();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv_done.wait(lock, [this] { return _done == _count && _active == 0; });
+        _task = nullptr;
+    }
+
+  private:
+    std::vector<std::thread> _workers;
+    // Serializes concurrent parallel_for() calls.
+    std::mutex _job_mutex;
+    std::mutex _mutex;
+    std::condition_variable _cv_work;
+    std::condition_variable _cv_done;
+    bool _stopping = false;
+    uint64_t _generation = 0;
+    // Workers currently inside work(), the job is not reset while > 0.
+    uint32_t _active = 0;
+    const std::function<void(uint32_t)>* _task = nullptr;
+    uint32_t _count = 0;
+    std::atomic<uint32_t> _next {0};
+    std::atomic<uint32_t> _done {0};
+
+    void work() {
+        while (true) {
+            uint32_t i = _next.fetch_add(1);
+            if (i >= _count) {
+                return;
+            }
+            (*_task)(i);
+            if (_done.fetch_add(1) + 1 == _count) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _cv_done.notify_one();
+            }
+        }
+    }
+
+    void run() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _cv_work.wait(lock, [&] { return _stopping || _generation != seen; });
+            if (_stopping) {
+                return;
+            }
+            seen = _generation;
+            _active++;
+            lock.unlock();
+            work();
+            lock.lock();
+            _active--;
+            if (_active == 0) {
+                _cv_done.notify_one();
+            }
+        }
+    }
+};
+
+// Pool for the `threads` option of a backend, or nullptr
+// if conversions should run on the calling thread only.
+static std::unique_ptr<ThreadPool> make_thread_pool(uint32_t threads) {
+    if (threads == 0) {
+        throw std::invalid_argument("threads must be at least 1.");
+    }
+    if (threads == 1) {
+        return nullptr;
+    }
+    return std::make_unique<ThreadPool>(threads);
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+
+// Trace points around the stages of sending a frame, to line up the work of
+// a camera with the apps reading it and the OS scheduler in system tracers.
+//
+// They are only compiled in if PYVIRTUALCAM_TRACE is defined, which setup.py
+// does for PYVIRTUALCAM_TRACE=1, and expand to nothing otherwise.
+// Each event carries the sequence number of its frame, see FrameSequence.
+//
+// - Linux: USDT probes `<stage>__start` and `<stage>__done` of the
+//   "pyvirtualcam" provider with the frame as argument, for perf, bpftrace
+//   or Perfetto. Needs <sys/sdt.h> from systemtap-sdt-dev at build time.
+// - Windows: TraceLogging events named after the stage with start and stop
+//   opcodes and a "frame" field, for WPR and WPA. The provider is named
+//   "pyvirtualcam", so that `wpr -start` or `tracelog` can enable it as
+//   `*pyvirtualcam`, and its GUID is derived from that name.
+// - macOS: os_signpost intervals named after the stage in subsystem
+//   "com.pyvirtualcam", category "frames", for Instruments. Needs macOS 10.14.
+//
+// TRACE_SPAN(stage, frame) traces the rest of the enclosing scope as `stage`,
+// an identifier like `convert`.
+
+#ifdef PYVIRTUALCAM_TRACE
+
+#include <atomic>
+
+// Numbers the frames of a camera from 1 in the order they are sent.
+// Frames that are dropped before being converted take a number as well,
+// so gaps between the frames of output events are drops.
+class FrameSequence {
+  public:
+    uint64_t next() {
+        return _last.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+  private:
+    std::atomic<uint64_t> _last {0};
+};
+
+// Calls `f` when the enclosing scope is left.
+template <typename F>
+class TraceSpanEnd {
+  public:
+    explicit TraceSpanEnd(F f) : _f {f} {
+    }
+
+    TraceSpanEnd(const TraceSpanEnd&) = delete;
+    TraceSpanEnd& operator=(const TraceSpanEnd&) = delete;
+
+    ~TraceSpanEnd() {
+        _f();
+    }
+
+  private:
+    F _f;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Unique per line, so that spans can be nested.
+#define TRACE_NAME(name) TRACE_CONCAT(name, __LINE__)
+
+#if defined(__linux__)
+
+#include <sys/sdt.h>
+
+#define TRACE_SPAN(stage, frame) \
+    const uint64_t TRACE_NAME(_trace_frame) = (frame); \
+    DTRACE_PROBE1(pyvirtualcam, stage##__start, TRACE_NAME(_trace_frame)); \
+    TraceSpanEnd TRACE_NAME(_trace_end) {[&] { \
+        DTRACE_PROBE1(pyvirtualcam, stage##__done, TRACE_NAME(_trace_frame)); \
+    }}
+
+#elif defined(_WIN32)
+
+#include <windows.h>
+#include <winmeta.h>
+#include <TraceLoggingProvider.h>
+
+// Each extension module is a single translation unit with a provider of its own.
+// {c372e773-cfcd-5e27-80dd-3e5253895593} is the ETW name hash of "pyvirtualcam".
+TRACELOGGING_DEFINE_PROVIDER(
+    g_trace_provider, "pyvirtualcam",
+    (0xc372e773, 0xcfcd, 0x5e27, 0x80, 0xdd, 0x3e, 0x52, 0x53, 0x89, 0x55, 0x93));
+
+// Registered on first use until the module is unloaded.
+static TraceLoggingHProvider trace_provider() {
+    static struct Registration {
+        Registration() {
+            TraceLoggingRegister(g_trace_provider);
+        }
+        ~Registration() {
+            TraceLoggingUnregister(g_trace_provider);
+        }
+    } registration;
+    return g_trace_provider;
+}
+
+#define TRACE_SPAN(stage, frame) \
+    const uint64_t TRACE_NAME(_trace_frame) = (frame); \
+    TraceLoggingWrite(trace_provider(), #stage, \
+        TraceLoggingOpcode(WINEVENT_OPCODE_START), \
+        TraceLoggingUInt64(TRACE_NAME(_trace_frame), "frame")); \
+    TraceSpanEnd TRACE_NAME(_trace_end) {[&] { \
+        TraceLoggingWrite(trace_provider(), #stage, \
+            TraceLoggingOpcode(WINEVENT_OPCODE_STOP), \
+            TraceLoggingUInt64(TRACE_NAME(_trace_frame), "frame")); \
+    }}
+
+#elif defined(__APPLE__)
+
+#include <os/signpost.h>
+
+static os_log_t trace_log() {
+    static os_log_t log = os_log_create("com.pyvirtualcam", "frames");
+    return log;
+}
+
+// Frames of several cameras or threads may overlap, so each span gets an id.
+#define TRACE_SPAN(stage, frame) \
+    const uint64_t TRACE_NAME(_trace_frame) = (frame); \
+    const os_signpost_id_t TRACE_NAME(_trace_id) = os_signpost_id_generate(trace_log()); \
+    os_signpost_interval_begin(trace_log(), TRACE_NAME(_trace_id), #stage, \
+        "frame %llu", static_cast<unsigned long long>(TRACE_NAME(_trace_frame))); \
+    TraceSpanEnd TRACE_NAME(_trace_end) {[&] { \
+        os_signpost_interval_end(trace_log(), TRACE_NAME(_trace_id), #stage, \
+            "frame %llu", static_cast<unsigned long long>(TRACE_NAME(_trace_frame))); \
+    }}
+
+#else
+#error "PYVIRTUALCAM_TRACE is not supported on this platform."
+#endif
+
+#else
+
+// Numbers nothing unless tracing is compiled in.
+class FrameSequence {
+  public:
+    uint64_t next() {
+        return 0;
+    }
+};
+
+#define TRACE_SPAN(stage, frame) static_cast<void>(frame)
+
+#endif
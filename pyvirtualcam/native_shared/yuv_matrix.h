@@ -0,0 +1,558 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <libyuv.h>
+#include "image_formats.h"
+
+// Color matrix and range of YUV frames, for conversions between RGB and YUV.
+// BT.601 limited range is what the libyuv functions in image_formats.h use.
+enum class YuvMatrix {
+    BT601Limited,
+    BT601Full,
+    BT709Limited,
+    BT709Full,
+    BT2020Limited,
+    BT2020Full,
+};
+
+static YuvMatrix parse_yuv_matrix(const std::string& colorspace, const std::string& color_range) {
+    bool full;
+    if (color_range == "limited") {
+        full = false;
+    } else if (color_range == "full") {
+        full = true;
+    } else {
+        throw std::invalid_argument(
+            "Unknown color range '" + color_range + "', must be 'limited' or 'full'."
+        );
+    }
+    if (colorspace == "bt601") {
+        return full ? YuvMatrix::BT601Full : YuvMatrix::BT601Limited;
+    } else if (colorspace == "bt709") {
+        return full ? YuvMatrix::BT709Full : YuvMatrix::BT709Limited;
+    } else if (colorspace == "bt2020") {
+        return full ? YuvMatrix::BT2020Full : YuvMatrix::BT2020Limited;
+    }
+    throw std::invalid_argument(
+        "Unknown colorspace '" + colorspace + "', "
+        "must be 'bt601', 'bt709' or 'bt2020'."
+    );
+}
+
+static constexpr bool is_full_range(YuvMatrix matrix) {
+    return matrix == YuvMatrix::BT601Full || matrix == YuvMatrix::BT709Full ||
+           matrix == YuvMatrix::BT2020Full;
+}
+
+// libyuv's coefficients for YUV to RGB conversions. The YVU variants
+// give RGBA instead of BGRA when U and V are passed in swapped order.
+static const libyuv::YuvConstants* yuv_constants(YuvMatrix matrix, bool yvu) {
+    switch (matrix) {
+        case YuvMatrix::BT601Limited:
+            return yvu ? &libyuv::kYvuI601Constants : &libyuv::kYuvI601Constants;
+        case YuvMatrix::BT601Full:
+            return yvu ? &libyuv::kYvuJPEGConstants : &libyuv::kYuvJPEGConstants;
+        case YuvMatrix::BT709Limited:
+            return yvu ? &libyuv::kYvuH709Constants : &libyuv::kYuvH709Constants;
+        case YuvMatrix::BT709Full:
+            return yvu ? &libyuv::kYvuF709Constants : &libyuv::kYuvF709Constants;
+        case YuvMatrix::BT2020Limited:
+            return yvu ? &libyuv::kYvu2020Constants : &libyuv::kYuv2020Constants;
+        case YuvMatrix::BT2020Full:
+            return yvu ? &libyuv::kYvuV2020Constants : &libyuv::kYuvV2020Constants;
+    }
+    return nullptr;
+}
+
+// libyuv has no public RGB to YUV conversions that take a matrix other
+// than BT.601, so these are done here in portable code. Coefficients are
+// 14-bit fixed point and computed at compile time for each matrix.
+// `benchmark_conversions.py --colorspace bt709` in test/ compares them
+// with libyuv's SIMD kernels.
+struct RgbToYuvCoefficients {
+    int32_t yr, yg, yb, y_offset;
+    int32_t ur, ug, ub;
+    int32_t vr, vg, vb;
+};
+
+static constexpr int32_t COEFFICIENT_BITS = 14;
+
+static constexpr int32_t fixed_point(double x) {
+    return static_cast<int32_t>(x * (1 << COEFFICIENT_BITS) + (x < 0 ? -0.5 : 0.5));
+}
+
+static constexpr RgbToYuvCoefficients rgb_to_yuv_coefficients(YuvMatrix matrix) {
+    double kr = 0.299, kb = 0.114;
+    if (matrix == YuvMatrix::BT709Limited || matrix == YuvMatrix::BT709Full) {
+        kr = 0.2126;
+        kb = 0.0722;
+    } else if (matrix == YuvMatrix::BT2020Limited || matrix == YuvMatrix::BT2020Full) {
+        kr = 0.2627;
+        kb = 0.0593;
+    }
+    double kg = 1 - kr - kb;
+    bool full = is_full_range(matrix);
+    double y_scale = full ? 1 : 219.0 / 255;
+    double c_scale = full ? 1 : 224.0 / 255;
+    double u_scale = c_scale / (2 * (1 - kb));
+    double v_scale = c_scale / (2 * (1 - kr));
+    return {
+        fixed_point(kr * y_scale), fixed_point(kg * y_scale), fixed_point(kb * y_scale),
+        full ? 0 : 16,
+        fixed_point(-kr * u_scale), fixed_point(-kg * u_scale), fixed_point((1 - kb) * u_scale),
+        fixed_point((1 - kr) * v_scale), fixed_point(-kg * v_scale), fixed_point(-kb * v_scale),
+    };
+}
+
+static inline uint8_t clamp_sample(int32_t v) {
+    return static_cast<uint8_t>(std::min<int32_t>(std::max<int32_t>(v, 0), 255));
+}
+
+// Converts `rows` rows of packed RGB with `Bpp` bytes per pixel and the
+// channels at byte offsets `R`, `G` and `B` to planar YUV whose chroma
+// rows are subsampled by `VShift`, that is I420 for 1 and I422 for 0.
+// Chroma is the average of each pair of pixels, or of each 2x2 block
+// for I420; odd last columns and rows are paired with themselves.
+template <YuvMatrix M, int Bpp, int R, int G, int B, int VShift>
+static void rgb_rows_to_yuv(const uint8_t* src, int32_t src_stride,
+                            uint8_t* dst_y, int32_t y_stride,
+                            uint8_t* dst_u, int32_t u_stride,
+                            uint8_t* dst_v, int32_t v_stride,
+                            int32_t width, int32_t rows) {
+    constexpr RgbToYuvCoefficients c = rgb_to_yuv_coefficients(M);
+    constexpr int32_t y_round = (c.y_offset << COEFFICIENT_BITS) + (1 << (COEFFICIENT_BITS - 1));
+    // Chroma sums four pixels, which adds two bits.
+    constexpr int32_t c_round = (128 << (COEFFICIENT_BITS + 2)) + (1 << (COEFFICIENT_BITS + 1));
+
+    for (int32_t y = 0; y < rows; y++) {
+        const uint8_t* s = src + y * src_stride;
+        uint8_t* d = dst_y + y * y_stride;
+        for (int32_t x = 0; x < width; x++) {
+            const uint8_t* p = s + x * Bpp;
+            d[x] = clamp_sample((c.yr * p[R] + c.yg * p[G] + c.yb * p[B] + y_round) >> COEFFICIENT_BITS);
+        }
+    }
+    for (int32_t y = 0; y < rows; y += 1 << VShift) {
+        const uint8_t* s0 = src + y * src_stride;
+        const uint8_t* s1 = VShift && y + 1 < rows ? s0 + src_stride : s0;
+        uint8_t* u = dst_u + (y >> VShift) * u_stride;
+        uint8_t* v = dst_v + (y >> VShift) * v_stride;
+        for (int32_t x = 0; x < width; x += 2) {
+            int32_t x1 = x + 1 < width ? x + 1 : x;
+            const uint8_t* a = s0 + x * Bpp;
+            const uint8_t* b = s0 + x1 * Bpp;
+            const uint8_t* e = s1 + x * Bpp;
+            const uint8_t* f = s1 + x1 * Bpp;
+            int32_t r = a[R] + b[R] + e[R] + f[R];
+            int32_t g = a[G] + b[G] + e[G] + f[G];
+            int32_t bl = a[B] + b[B] + e[B] + f[B];
+            u[x / 2] = clamp_sample((c.ur * r + c.ug * g + c.ub * bl + c_round) >> (COEFFICIENT_BITS + 2));
+            v[x / 2] = clamp_sample((c.vr * r + c.vg * g + c.vb * bl + c_round) >> (COEFFICIENT_BITS + 2));
+        }
+    }
+}
+
+// horizontal and vertical subsampling and yuv conversion
+template <YuvMatrix M, int Bpp, int R, int G, int B>
+static void rgb_to_i420_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    rgb_rows_to_yuv<M, Bpp, R, G, B, 1>(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        dst.data[1], dst.stride[1],
+        dst.data[2], dst.stride[2],
+        width, height);
+}
+
+// horizontal and vertical subsampling and yuv conversion, row-tiled chroma
+template <YuvMatrix M, int Bpp, int R, int G, int B>
+static void rgb_to_nv12_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_i420_chroma_rows(dst, width, height, [&](int32_t y, int32_t rows,
+            uint8_t* u, uint8_t* v, int32_t uv_stride) {
+        rgb_rows_to_yuv<M, Bpp, R, G, B, 1>(
+            plane_row(src, 0, y), src.stride[0],
+            plane_row(dst, 0, y), dst.stride[0],
+            u, uv_stride,
+            v, uv_stride,
+            width, rows);
+    });
+}
+
+// horizontal subsampling and yuv conversion, row-tiled
+template <YuvMatrix M, int Bpp, int R, int G, int B>
+static void rgb_to_uyvy_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    int32_t half_width = (width + 1) / 2;
+    int32_t band = band_height(width + half_width * 2);
+    uint8_t* y_rows = band_buffer(static_cast<size_t>(width + half_width * 2) * band);
+    uint8_t* u = y_rows + width * band;
+    uint8_t* v = u + half_width * band;
+    for (int32_t y = 0; y < height; y += band) {
+        int32_t rows = std::min(band, height - y);
+        rgb_rows_to_yuv<M, Bpp, R, G, B, 0>(
+            plane_row(src, 0, y), src.stride[0],
+            y_rows, width,
+            u, half_width,
+            v, half_width,
+            width, rows);
+        libyuv::I422ToUYVY(
+            y_rows, width,
+            u, half_width,
+            v, half_width,
+            plane_row(dst, 0, y), dst.stride[0],
+            width, rows);
+    }
+}
+
+// horizontal and vertical upsampling and yuv conversion
+template <YuvMatrix M>
+static void i420_to_bgra_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I420ToARGBMatrix(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, false), width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+template <YuvMatrix M>
+static void i420_to_rgba_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I420ToARGBMatrix(
+        src.data[0], src.stride[0],
+        src.data[2], src.stride[2],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, true), width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+template <YuvMatrix M>
+static void i420_to_rgb_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I420ToRGB24Matrix(
+        src.data[0], src.stride[0],
+        src.data[2], src.stride[2],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, true), width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+template <YuvMatrix M>
+static void i420_to_bgr_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::I420ToRGB24Matrix(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        src.data[2], src.stride[2],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, false), width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+template <YuvMatrix M>
+static void nv12_to_bgra_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV12ToARGBMatrix(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, false), width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+// Reading UV as VU with swapped coefficients gives RGBA.
+template <YuvMatrix M>
+static void nv12_to_rgba_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV21ToARGBMatrix(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, true), width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+template <YuvMatrix M>
+static void nv21_to_bgra_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV21ToARGBMatrix(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, false), width, height);
+}
+
+// horizontal and vertical upsampling and yuv conversion
+template <YuvMatrix M>
+static void nv21_to_rgba_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::NV12ToARGBMatrix(
+        src.data[0], src.stride[0],
+        src.data[1], src.stride[1],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, true), width, height);
+}
+
+// horizontal upsampling and yuv conversion
+template <YuvMatrix M>
+static void yuyv_to_bgra_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::YUY2ToARGBMatrix(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, false), width, height);
+}
+
+// horizontal upsampling and yuv conversion, row-tiled
+template <YuvMatrix M>
+static void yuyv_to_rgba_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::YUY2ToARGBMatrix(plane_row(src, 0, y), src.stride[0], bgra, width * 4,
+                                 yuv_constants(M, false), width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToABGR(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// horizontal upsampling and yuv conversion
+template <YuvMatrix M>
+static void uyvy_to_bgra_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    libyuv::UYVYToARGBMatrix(
+        src.data[0], src.stride[0],
+        dst.data[0], dst.stride[0],
+        yuv_constants(M, false), width, height);
+}
+
+// horizontal upsampling and yuv conversion, row-tiled
+template <YuvMatrix M>
+static void uyvy_to_rgba_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_bgra_rows(width, height, [&](int32_t y, int32_t rows, uint8_t* bgra) {
+        libyuv::UYVYToARGBMatrix(plane_row(src, 0, y), src.stride[0], bgra, width * 4,
+                                 yuv_constants(M, false), width, rows);
+    }, [&](const uint8_t* bgra, int32_t y, int32_t rows) {
+        libyuv::ARGBToABGR(bgra, width * 4, plane_row(dst, 0, y), dst.stride[0], width, rows);
+    });
+}
+
+// bit depth reduction, upsampling and yuv conversion, row-tiled
+template <YuvMatrix M>
+static void p010_to_bgra_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_nv12_rows(src, width, height, [&](const Planes& nv12, int32_t y, int32_t rows) {
+        nv12_to_bgra_matrix<M>(nv12, band_planes(libyuv::FOURCC_ARGB, dst, y), width, rows);
+    });
+}
+
+// bit depth reduction, upsampling and yuv conversion, row-tiled
+template <YuvMatrix M>
+static void p010_to_rgba_matrix(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_nv12_rows(src, width, height, [&](const Planes& nv12, int32_t y, int32_t rows) {
+        nv12_to_rgba_matrix<M>(nv12, band_planes(libyuv::FOURCC_ABGR, dst, y), width, rows);
+    });
+}
+
+// GRAY frames hold full range luma like libyuv's J400, which is copied
+// into full range YUV and rescaled to 16-235 for limited range, in the
+// same way for every colorspace. Chroma is neutral.
+template <bool Full>
+static inline uint8_t gray_to_y(uint8_t g) {
+    constexpr int32_t scale = fixed_point(219.0 / 255);
+    constexpr int32_t round = (16 << COEFFICIENT_BITS) + (1 << (COEFFICIENT_BITS - 1));
+    return Full ? g : static_cast<uint8_t>((g * scale + round) >> COEFFICIENT_BITS);
+}
+
+template <bool Full>
+static void gray_rows_to_y(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    if (Full) {
+        libyuv::CopyPlane(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, height);
+        return;
+    }
+    for (int32_t y = 0; y < height; y++) {
+        const uint8_t* s = plane_row(src, 0, y);
+        uint8_t* d = plane_row(dst, 0, y);
+        for (int32_t x = 0; x < width; x++) {
+            d[x] = gray_to_y<Full>(s[x]);
+        }
+    }
+}
+
+// luma copy or rescaling, chroma is set to neutral
+template <bool Full>
+static void gray_to_i420_range(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    gray_rows_to_y<Full>(src, dst, width, height);
+    libyuv::SetPlane(dst.data[1], dst.stride[1], width / 2, height / 2, 128);
+    libyuv::SetPlane(dst.data[2], dst.stride[2], width / 2, height / 2, 128);
+}
+
+// luma copy or rescaling, chroma is set to neutral
+template <bool Full>
+static void gray_to_nv12_range(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    gray_rows_to_y<Full>(src, dst, width, height);
+    libyuv::SetPlane(dst.data[1], dst.stride[1], width / 2 * 2, height / 2, 128);
+}
+
+// luma copy or rescaling and interleaving with neutral chroma
+template <bool Full>
+static void gray_to_uyvy_range(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    for (int32_t y = 0; y < height; y++) {
+        const uint8_t* s = plane_row(src, 0, y);
+        uint8_t* d = plane_row(dst, 0, y);
+        for (int32_t x = 0; x < width; x += 2) {
+            d[x * 2] = 128;
+            d[x * 2 + 1] = gray_to_y<Full>(s[x]);
+            d[x * 2 + 2] = 128;
+            d[x * 2 + 3] = gray_to_y<Full>(s[x + 1 < width ? x + 1 : x]);
+        }
+    }
+}
+
+// The conversions from GRAY to YUV formats in full or limited range.
+static Converter find_gray_converter(uint32_t dst_fourcc, bool full) {
+    switch (dst_fourcc) {
+        case libyuv::FOURCC_I420:
+            return full ? gray_to_i420_range<true> : gray_to_i420_range<false>;
+        case libyuv::FOURCC_NV12:
+            return full ? gray_to_nv12_range<true> : gray_to_nv12_range<false>;
+        case libyuv::FOURCC_UYVY:
+            return full ? gray_to_uyvy_range<true> : gray_to_uyvy_range<false>;
+    }
+    return nullptr;
+}
+
+// BT.601 full range is libyuv's JPEG matrix, which it has SIMD kernels for.
+using RgbToJ420 = int (*)(const uint8_t*, int, uint8_t*, int, uint8_t*, int, uint8_t*, int, int, int);
+
+// horizontal and vertical subsampling and yuv conversion
+template <RgbToJ420 F>
+static void rgb_to_j420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    F(src.data[0], src.stride[0],
+      dst.data[0], dst.stride[0],
+      dst.data[1], dst.stride[1],
+      dst.data[2], dst.stride[2],
+      width, height);
+}
+
+// horizontal and vertical subsampling and yuv conversion, row-tiled chroma
+template <RgbToJ420 F>
+static void rgb_to_nv12_j420(const Planes& src, const Planes& dst, int32_t width, int32_t height) {
+    via_i420_chroma_rows(dst, width, height, [&](int32_t y, int32_t rows,
+            uint8_t* u, uint8_t* v, int32_t uv_stride) {
+        F(plane_row(src, 0, y), src.stride[0],
+          plane_row(dst, 0, y), dst.stride[0],
+          u, uv_stride,
+          v, uv_stride,
+          width, rows);
+    });
+}
+
+// The conversions from RGB to 4:2:0 YUV formats in BT.601 full range.
+static Converter find_j420_converter(uint32_t src_fourcc, uint32_t dst_fourcc) {
+    struct Entry {
+        uint32_t src;
+        uint32_t dst;
+        Converter convert;
+    };
+    static const Entry table[] = {
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_I420, rgb_to_j420<libyuv::RAWToJ420>},
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_NV12, rgb_to_nv12_j420<libyuv::RAWToJ420>},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_I420, rgb_to_j420<libyuv::RGB24ToJ420>},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_NV12, rgb_to_nv12_j420<libyuv::RGB24ToJ420>},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_I420, rgb_to_j420<libyuv::ARGBToJ420>},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_NV12, rgb_to_nv12_j420<libyuv::ARGBToJ420>},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_I420, rgb_to_j420<libyuv::ABGRToJ420>},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_NV12, rgb_to_nv12_j420<libyuv::ABGRToJ420>},
+    };
+    for (const Entry& entry : table) {
+        if (entry.src == src_fourcc && entry.dst == dst_fourcc) {
+            return entry.convert;
+        }
+    }
+    return nullptr;
+}
+
+// The conversions between RGB and YUV formats in matrix `M`.
+template <YuvMatrix M>
+static Converter find_matrix_converter(uint32_t src_fourcc, uint32_t dst_fourcc) {
+    struct Entry {
+        uint32_t src;
+        uint32_t dst;
+        Converter convert;
+    };
+    // Byte offsets of red, green and blue in memory.
+    static const Entry table[] = {
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_I420, rgb_to_i420_matrix<M, 3, 0, 1, 2>},
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_NV12, rgb_to_nv12_matrix<M, 3, 0, 1, 2>},
+        {libyuv::FOURCC_RAW,  libyuv::FOURCC_UYVY, rgb_to_uyvy_matrix<M, 3, 0, 1, 2>},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_I420, rgb_to_i420_matrix<M, 3, 2, 1, 0>},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_NV12, rgb_to_nv12_matrix<M, 3, 2, 1, 0>},
+        {libyuv::FOURCC_24BG, libyuv::FOURCC_UYVY, rgb_to_uyvy_matrix<M, 3, 2, 1, 0>},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_I420, rgb_to_i420_matrix<M, 4, 2, 1, 0>},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_NV12, rgb_to_nv12_matrix<M, 4, 2, 1, 0>},
+        {libyuv::FOURCC_ARGB, libyuv::FOURCC_UYVY, rgb_to_uyvy_matrix<M, 4, 2, 1, 0>},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_I420, rgb_to_i420_matrix<M, 4, 0, 1, 2>},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_NV12, rgb_to_nv12_matrix<M, 4, 0, 1, 2>},
+        {libyuv::FOURCC_ABGR, libyuv::FOURCC_UYVY, rgb_to_uyvy_matrix<M, 4, 0, 1, 2>},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_RAW,  i420_to_rgb_matrix<M>},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_24BG, i420_to_bgr_matrix<M>},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_ARGB, i420_to_bgra_matrix<M>},
+        {libyuv::FOURCC_I420, libyuv::FOURCC_ABGR, i420_to_rgba_matrix<M>},
+        {libyuv::FOURCC_NV12, libyuv::FOURCC_ARGB, nv12_to_bgra_matrix<M>},
+        {libyuv::FOURCC_NV12, libyuv::FOURCC_ABGR, nv12_to_rgba_matrix<M>},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_ARGB, nv21_to_bgra_matrix<M>},
+        {libyuv::FOURCC_NV21, libyuv::FOURCC_ABGR, nv21_to_rgba_matrix<M>},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_ARGB, yuyv_to_bgra_matrix<M>},
+        {libyuv::FOURCC_YUY2, libyuv::FOURCC_ABGR, yuyv_to_rgba_matrix<M>},
+        {libyuv::FOURCC_UYVY, libyuv::FOURCC_ARGB, uyvy_to_bgra_matrix<M>},
+        {libyuv::FOURCC_UYVY, libyuv::FOURCC_ABGR, uyvy_to_rgba_matrix<M>},
+        {libyuv::FOURCC_P010, libyuv::FOURCC_ARGB, p010_to_bgra_matrix<M>},
+        {libyuv::FOURCC_P010, libyuv::FOURCC_ABGR, p010_to_rgba_matrix<M>},
+    };
+    for (const Entry& entry : table) {
+        if (entry.src == src_fourcc && entry.dst == dst_fourcc) {
+            return entry.convert;
+        }
+    }
+    return nullptr;
+}
+
+// The conversion function between two formats in `matrix`, or nullptr if
+// there is none. Conversions that do not go between RGB and YUV are the
+// same for all matrices, as are the other conversions for BT.601 limited
+// range. GRAY to YUV only depends on the range.
+static Converter find_converter(uint32_t src_fourcc, uint32_t dst_fourcc, YuvMatrix matrix) {
+    uint32_t src = libyuv::CanonicalFourCC(src_fourcc);
+    uint32_t dst = libyuv::CanonicalFourCC(dst_fourcc);
+    Converter convert = nullptr;
+    if (src == libyuv::FOURCC_J400) {
+        convert = find_gray_converter(dst, is_full_range(matrix));
+    }
+    if (convert) {
+        return convert;
+    }
+    switch (matrix) {
+        case YuvMatrix::BT601Limited:
+            break;
+        case YuvMatrix::BT601Full:
+            convert = find_j420_converter(src, dst);
+            if (!convert) {
+                convert = find_matrix_converter<YuvMatrix::BT601Full>(src, dst);
+            }
+            break;
+        case YuvMatrix::BT709Limited:
+            convert = find_matrix_converter<YuvMatrix::BT709Limited>(src, dst);
+            break;
+        case YuvMatrix::BT709Full:
+            convert = find_matrix_converter<YuvMatrix::BT709Full>(src, dst);
+            break;
+        case YuvMatrix::BT2020Limited:
+            convert = find_matrix_converter<YuvMatrix::BT2020Limited>(src, dst);
+            break;
+        case YuvMatrix::BT2020Full:
+            convert = find_matrix_converter<YuvMatrix::BT2020Full>(src, dst);
+            break;
+    }
+    return convert ? convert : find_converter(src, dst);
+}
+
+// Like find_output_converter() for frames in `matrix`.
+static Converter find_output_converter(uint32_t src_fourcc, uint32_t dst_fourcc, YuvMatrix matrix) {
+    if (libyuv::CanonicalFourCC(src_fourcc) == libyuv::CanonicalFourCC(dst_fourcc)) {
+        return find_output_converter(src_fourcc, dst_fourcc);
+    }
+    return find_converter(src_fourcc, dst_fourcc, matrix);
+}
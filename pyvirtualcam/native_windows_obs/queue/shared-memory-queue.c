@@ -177,6 +177,29 @@ void video_queue_write(video_queue_t *vq, uint8_t **data, uint32_t *linesize,
 	qh->state = SHARED_QUEUE_STATE_READY;
 }
 
+/* Returns the slot the next video_queue_commit() publishes, laid out as
+ * contiguous NV12. The reader only uses the slot of read_idx, which
+ * is a different one, so the slot can be filled in place. */
+uint8_t *video_queue_acquire(video_queue_t *vq)
+{
+	struct queue_header *qh = vq->header;
+	unsigned long idx = get_idx(qh->write_idx + 1);
+	return vq->frame[idx];
+}
+
+void video_queue_commit(video_queue_t *vq, uint64_t timestamp)
+{
+	struct queue_header *qh = vq->header;
+	long inc = ++qh->write_idx;
+
+	unsigned long idx = get_idx(inc);
+
+	*vq->ts[idx] = timestamp;
+
+	qh->read_idx = inc;
+	qh->state = SHARED_QUEUE_STATE_READY;
+}
+
 enum queue_state video_queue_state(video_queue_t *vq)
 {
 	if (!vq) {
@@ -2,9 +2,42 @@
 
 #include <stdio.h>
 #include <Windows.h>
+#include <memory>
+#include <string>
 #include <vector>
 #include "queue/shared-memory-queue.h"
+#include "../native_shared/frame_changes.h"
 #include "../native_shared/image_formats.h"
+#include "../native_shared/pacer.h"
+#include "../native_shared/stats.h"
+#include "../native_shared/trace.h"
+#include "../native_shared/yuv_matrix.h"
+
+// What send() does with a frame that would replace the previous one
+// before the DirectShow filter, which reads the queue once per frame
+// interval, could have picked it up.
+enum class Backpressure {
+    // Replace the previous frame, which the filter then never shows.
+    None,
+    // Wait until the previous frame had one frame interval in the queue.
+    Wait,
+    // Drop the new frame instead, which is counted in the stats.
+    Drop,
+};
+
+static Backpressure parse_backpressure(const std::string& name) {
+    if (name == "none") {
+        return Backpressure::None;
+    } else if (name == "wait") {
+        return Backpressure::Wait;
+    } else if (name == "drop") {
+        return Backpressure::Drop;
+    }
+    throw std::invalid_argument(
+        "Unknown backpressure '" + name + "', "
+        "must be 'none', 'wait' or 'drop'."
+    );
+}
 
 class VirtualOutput {
   private:
@@ -13,30 +46,69 @@ class VirtualOutput {
     uint32_t _frame_width;
     uint32_t _frame_height;
     uint32_t _frame_fourcc;
-    std::vector<uint8_t> _buffer_tmp;
-    std::vector<uint8_t> _buffer_output;
-    bool _have_clockfreq = false;
+    // Picked once, nullptr for NV12 input which is copied as is.
+    Converter _convert = nullptr;
+    // Only changed rows are converted again if set, into `_cached`,
+    // which is then copied into the queue.
+    std::unique_ptr<FrameChanges> _changes;
+    std::vector<uint8_t> _cached;
+    std::unique_ptr<ThreadPool> _pool;
     LARGE_INTEGER _clock_freq;
+    SendStats _stats;
+    FrameSequence _frames;
+    Backpressure _backpressure;
+    int64_t _interval_ns;
+    // QPC time at which the last frame passed make_room(), 0 before the
+    // first one. Taken before converting, so that the conversion time does
+    // not delay the next frame of a producer sending at the frame rate.
+    int64_t _last_send_ns = 0;
+    // How much earlier than one interval after the previous frame a frame
+    // may come, as producers pacing at the frame rate jitter that much.
+    static constexpr int64_t BACKPRESSURE_JITTER_NS = 1000000;
+    // Precise waits for Backpressure::Wait.
+    std::unique_ptr<FramePacer> _pacer;
 
-    uint64_t get_timestamp_ns()
+    // Nanoseconds on the QPC clock, like time.perf_counter_ns() in Python.
+    // Exact in integers, as doubles lose nanoseconds after a few months of uptime.
+    int64_t get_timestamp_ns()
     {
-        if (!_have_clockfreq) {
-            QueryPerformanceFrequency(&_clock_freq);
-            _have_clockfreq = true;
-        }
-
         LARGE_INTEGER current_time;
         QueryPerformanceCounter(&current_time);
-        double time_val = (double)current_time.QuadPart;
-        time_val *= 1000000000.0;
-        time_val /= (double)_clock_freq.QuadPart;
+        int64_t seconds = current_time.QuadPart / _clock_freq.QuadPart;
+        int64_t rest = current_time.QuadPart % _clock_freq.QuadPart;
+        return seconds * 1000000000 + rest * 1000000000 / _clock_freq.QuadPart;
+    }
 
-        return static_cast<uint64_t>(time_val);
+    // Applies the backpressure policy before a frame is written
+    // into the queue, returns false if the frame should be dropped.
+    bool make_room()
+    {
+        int64_t now = get_timestamp_ns();
+        if (_last_send_ns != 0 && _backpressure != Backpressure::None) {
+            int64_t readable_ns = _last_send_ns + _interval_ns - BACKPRESSURE_JITTER_NS;
+            if (now < readable_ns) {
+                if (_backpressure == Backpressure::Drop) {
+                    return false;
+                }
+                // FramePacer uses QPC on Windows as well.
+                now = _pacer->wait_until(readable_ns);
+            }
+        }
+        _last_send_ns = now;
+        return true;
+    }
+
+    // Publishes the next slot, with the caller's timestamp if not 0.
+    void commit(uint64_t timestamp_ns)
+    {
+        video_queue_commit(_vq, timestamp_ns ? timestamp_ns : static_cast<uint64_t>(get_timestamp_ns()));
     }
 
   public:
     VirtualOutput(uint32_t width, uint32_t height, double fps, uint32_t fourcc,
-                  std::optional<std::string> device_) {
+                  std::optional<std::string> device_, uint32_t threads = 1,
+                  Backpressure backpressure = Backpressure::None,
+                  bool skip_unchanged = false, YuvMatrix matrix = YuvMatrix::BT601Limited) {
         // https://github.com/obsproject/obs-studio/blob/9da6fc67/.github/workflows/main.yml#L484
         LPCWSTR guid = L"CLSID\\{A3FCE0F5-3493-419F-958A-ABA1250EC20B}";
         HKEY key = nullptr;
@@ -57,34 +129,33 @@ class VirtualOutput {
         _frame_width = width;
         _frame_height = height;
 
-        uint32_t out_frame_size = nv12_frame_size(width, height);
-
-        switch (_frame_fourcc) {
-            case libyuv::FOURCC_RAW:
-            case libyuv::FOURCC_24BG:
-                // RGB|BGR -> I420 -> NV12
-                _buffer_tmp.resize(i420_frame_size(width, height));
-                _buffer_output.resize(out_frame_size);
-                break;
-            case libyuv::FOURCC_J400:
-                // GRAY -> BGRA -> NV12
-                _buffer_tmp.resize(bgra_frame_size(width, height));
-                _buffer_output.resize(out_frame_size);
-                break;
-            case libyuv::FOURCC_I420:
-            case libyuv::FOURCC_YUY2:
-            case libyuv::FOURCC_UYVY:
-                // I420|YUYV|UYVY -> NV12
-                _buffer_output.resize(out_frame_size);
-                break;
-            case libyuv::FOURCC_NV12:
-                break;
-            default:
+        if (_frame_fourcc != libyuv::FOURCC_NV12) {
+            // RGB|BGR|BGRA|GRAY|I420|YUYV|UYVY -> NV12
+            // The queue has no colorimetry fields, consumers have to be set to `matrix`.
+            _convert = find_output_converter(_frame_fourcc, libyuv::FOURCC_NV12, matrix);
+            if (!_convert) {
                 throw std::runtime_error(
                     "Unsupported image format."
                 );
+            }
         }
-        
+
+        // NV12 input is only copied, which it would be from `_cached` as well.
+        if (skip_unchanged && _convert) {
+            _changes = std::make_unique<FrameChanges>(_frame_fourcc, width, height);
+            _cached.resize(nv12_frame_size(width, height));
+        }
+
+        _pool = make_thread_pool(threads);
+
+        QueryPerformanceFrequency(&_clock_freq);
+        _backpressure = backpressure;
+        _interval_ns = static_cast<int64_t>(1e9 / fps);
+        if (backpressure == Backpressure::Wait) {
+            _pacer = std::make_unique<FramePacer>(fps);
+        }
+
+        // In 100 ns units.
         uint64_t interval = (uint64_t)(10000000.0 / fps);
 
         _vq = video_queue_create(width, height, interval);
@@ -105,60 +176,99 @@ class VirtualOutput {
         _output_running = false;
     }
 
-    void send(const uint8_t *frame)
+    // `timestamp_ns` is the presentation time on the QPC clock,
+    // or 0 to stamp the frame with the current time.
+    // `dirty` lists the rectangles that changed since the previous
+    // frame if frames are only converted where they changed.
+    void send(const Planes& frame, uint64_t timestamp_ns = 0,
+              const std::vector<DirtyRect>* dirty = nullptr)
     {
         if (!_output_running)
             return;
-
-        uint8_t* tmp = _buffer_tmp.data();
-        uint8_t* out_frame;
-        
-        switch (_frame_fourcc) {
-            case libyuv::FOURCC_RAW:
-                out_frame = _buffer_output.data();
-                rgb_to_i420(frame, tmp, _frame_width, _frame_height);
-                i420_to_nv12(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_24BG:
-                out_frame = _buffer_output.data();
-                bgr_to_i420(frame, tmp, _frame_width, _frame_height);
-                i420_to_nv12(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_J400:
-                out_frame = _buffer_output.data();
-                gray_to_bgra(frame, tmp, _frame_width, _frame_height);
-                bgra_to_nv12(tmp, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_I420:
-                out_frame = _buffer_output.data();
-                i420_to_nv12(frame, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_NV12:
-                out_frame = const_cast<uint8_t*>(frame);
-                break;
-            case libyuv::FOURCC_YUY2:
-                out_frame = _buffer_output.data();
-                yuyv_to_nv12(frame, out_frame, _frame_width, _frame_height);
-                break;
-            case libyuv::FOURCC_UYVY:
-                out_frame = _buffer_output.data();
-                uyvy_to_nv12(frame, out_frame, _frame_width, _frame_height);
-                break;
-            default:
-                throw std::logic_error("not implemented");
+        uint64_t frame_number = _frames.next();
+        if (!make_room()) {
+            if (_changes) {
+                _changes->skip(dirty);
+            }
+            _stats.record_dropped();
+            return;
         }
 
-        // NV12 has two planes
-        uint8_t* y = out_frame;
-        uint8_t* uv = out_frame + _frame_width * _frame_height;
-
-        // One entry per plane
-        uint32_t linesize[2] = { _frame_width, _frame_width / 2 };
-        uint8_t* data[2] = { y, uv };
+        // Frames are converted or copied straight into the next slot
+        // of the shared queue, which the reader does not use until
+        // it is committed.
+        Planes slot = fourcc_planes(libyuv::FOURCC_NV12, video_queue_acquire(_vq),
+                                    _frame_width, _frame_height);
+        if (_changes) {
+            Planes cached = fourcc_planes(libyuv::FOURCC_NV12, _cached.data(),
+                                          _frame_width, _frame_height);
+            {
+                ScopedTimer timer {_stats.convert};
+                TRACE_SPAN(convert, frame_number);
+                const std::vector<RowBand>& bands = _changes->update(frame, dirty);
+                if (bands.empty()) {
+                    _stats.record_unchanged();
+                }
+                convert_bands(_convert,
+                    _frame_fourcc, frame, libyuv::FOURCC_NV12, cached,
+                    _frame_width, bands, _pool.get());
+            }
+            {
+                ScopedTimer timer {_stats.output};
+                TRACE_SPAN(output, frame_number);
+                // Slots are reused round-robin, so each one needs the whole frame.
+                copy_frame(libyuv::FOURCC_NV12, cached, slot, _frame_width, _frame_height);
+                commit(timestamp_ns);
+            }
+            _stats.record_output(nv12_frame_size(_frame_width, _frame_height));
+            return;
+        }
+        if (_convert) {
+            ScopedTimer timer {_stats.convert};
+            TRACE_SPAN(convert, frame_number);
+            convert_frame(_convert,
+                _frame_fourcc, frame, libyuv::FOURCC_NV12, slot,
+                _frame_width, _frame_height, _pool.get());
+        }
+        {
+            ScopedTimer timer {_stats.output};
+            TRACE_SPAN(output, frame_number);
+            if (!_convert) {
+                // NV12 is copied once, from the caller's memory into the queue.
+                copy_frame(libyuv::FOURCC_NV12, frame, slot, _frame_width, _frame_height);
+            }
+            commit(timestamp_ns);
+        }
+        _stats.record_output(nv12_frame_size(_frame_width, _frame_height));
+    }
 
-        uint64_t timestamp = get_timestamp_ns();
+    // Native-format memory to fill before calling commit_frame().
+    // This is the next slot of the shared queue itself.
+    Planes acquire_frame()
+    {
+        if (!_output_running) {
+            throw std::runtime_error("virtual camera output is not running");
+        }
+        uint8_t* slot = video_queue_acquire(_vq);
+        return fourcc_planes(libyuv::FOURCC_NV12, slot, _frame_width, _frame_height);
+    }
 
-        video_queue_write(_vq, data, linesize, timestamp);
+    void commit_frame(uint64_t timestamp_ns = 0)
+    {
+        if (!_output_running)
+            return;
+        uint64_t frame_number = _frames.next();
+        if (!make_room()) {
+            // The acquired slot is filled again for the next frame.
+            _stats.record_dropped();
+            return;
+        }
+        {
+            ScopedTimer timer {_stats.output};
+            TRACE_SPAN(output, frame_number);
+            commit(timestamp_ns);
+        }
+        _stats.record_output(nv12_frame_size(_frame_width, _frame_height));
     }
 
     std::string device()
@@ -170,4 +280,8 @@ class VirtualOutput {
     uint32_t native_fourcc() {
         return libyuv::FOURCC_NV12;
     }
+
+    SendStats& send_stats() {
+        return _stats;
+    }
 };
@@ -1,22 +1,81 @@
+#include <algorithm>
 #include <stdexcept>
 #include <optional>
+#include <memory>
+#include <mutex>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
 #include "virtual_output.h"
+#include "../native_shared/async_sender.h"
+#include "../native_shared/py_batch.h"
+#include "../native_shared/input_scaler.h"
+#include "../native_shared/py_frame.h"
+#include "../native_shared/py_stats.h"
 
 namespace py = pybind11;
 
 class UnityCaptureCamera {
   private:
+    // Constructed first so that invalid options fail before the output starts.
+    std::unique_ptr<InputScaler> input_scaler;
     VirtualOutput virtual_output;
+    std::unique_ptr<AsyncSender> async_sender;
+    // Held while sending without the GIL, so that close() on another
+    // thread does not tear down the output in the middle of a frame.
+    std::mutex output_mutex;
+    uint32_t frame_fourcc;
+    uint32_t frame_width;
+    uint32_t frame_height;
+    // Size of frames passed to send(), which are scaled by `input_scaler`
+    // to the camera size if it differs.
+    uint32_t input_width;
+    uint32_t input_height;
 
   public:
-    UnityCaptureCamera(uint32_t width, uint32_t height, double fps, uint32_t fourcc, std::optional<std::string> device) 
-        : virtual_output {width, height, fps, fourcc, device} {
+    UnityCaptureCamera(uint32_t width, uint32_t height, double fps, uint32_t fourcc, std::optional<std::string> device,
+                       bool asynchronous, uint32_t queue_size, const std::string& queue_policy,
+                       uint32_t threads, uint32_t input_width_, uint32_t input_height_,
+                       const std::string& scale_filter, bool on_demand, bool in_place,
+                       bool skip_unchanged, const std::string& colorspace, const std::string& color_range)
+        : input_scaler {make_input_scaler(fourcc, width, height,
+                                         input_width_, input_height_, scale_filter, skip_unchanged)},
+          virtual_output {width, height, fps,
+              backend_fourcc(fourcc, width, height, input_width_, input_height_),
+              device, threads, on_demand, in_place, skip_unchanged,
+              parse_yuv_matrix(colorspace, color_range)} {
+        frame_fourcc = fourcc;
+        frame_width = width;
+        frame_height = height;
+        input_width = input_width_ ? input_width_ : width;
+        input_height = input_height_ ? input_height_ : height;
+        if (asynchronous) {
+            async_sender = std::make_unique<AsyncSender>(
+                fourcc, input_width, input_height, queue_size,
+                AsyncSender::parse_policy(queue_policy),
+                [this](const Planes& frame, uint64_t) {
+                    const std::vector<DirtyRect>* dirty = nullptr;
+                    Planes planes = scaled(frame, dirty);
+                    virtual_output.send(planes, dirty);
+                });
+        }
+    }
+
+    // The frame to hand to the backend for a frame of the input size,
+    // with `dirty` updated for it, see InputScaler::scale().
+    Planes scaled(const Planes& frame, const std::vector<DirtyRect>*& dirty) {
+        return input_scaler ? input_scaler->scale(frame, nullptr, dirty) : frame;
     }
 
     void close() {
+        {
+            // Joining the sender threads does not need the GIL.
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock {output_mutex};
+            async_sender.reset();
+        }
+        // stop() changes ACTIVE_DEVICES, which the GIL guards.
+        std::lock_guard<std::mutex> lock {output_mutex};
         virtual_output.stop();
     }
 
@@ -28,20 +87,86 @@ class UnityCaptureCamera {
         return virtual_output.native_fourcc();
     }
 
-    void send(py::array_t<uint8_t, py::array::c_style> frame) {
-        py::buffer_info buf = frame.request();
-        virtual_output.send(static_cast<uint8_t*>(buf.ptr));
+    void send(py::object frame, std::optional<std::vector<DirtyRect>> dirty_rects) {
+        Planes planes = planes_of(frame);
+        // `frame` keeps the buffers alive while the GIL is released.
+        py::gil_scoped_release release;
+        send_planes(planes, dirty_rects ? &*dirty_rects : nullptr);
+    }
+
+    // Planes of a frame passed to send().
+    Planes planes_of(const py::object& frame) {
+        return frame_planes(frame_fourcc, frame, input_width, input_height);
+    }
+
+    // Called without the GIL. Frames sent asynchronously may be dropped
+    // from the queue, so their changes are found by hashing instead of `dirty`.
+    void send_planes(const Planes& planes, const std::vector<DirtyRect>* dirty = nullptr) {
+        std::lock_guard<std::mutex> lock {output_mutex};
+        ScopedTimer timer {virtual_output.send_stats().send};
+        if (async_sender) {
+            async_sender->push(planes);
+        } else {
+            Planes frame = scaled(planes, dirty);
+            virtual_output.send(frame, dirty);
+        }
+    }
+
+    // `timeout` in seconds, or None to wait without a timeout.
+    bool wait_for_demand(std::optional<double> timeout) {
+        DWORD timeout_ms = INFINITE;
+        if (timeout.has_value()) {
+            timeout_ms = static_cast<DWORD>(std::clamp(*timeout * 1000, 0.0, INFINITE - 1.0));
+        }
+        py::gil_scoped_release release;
+        return virtual_output.wait_for_demand(timeout_ms);
+    }
+
+    py::array acquire_frame() {
+        if (async_sender) {
+            throw std::runtime_error("acquire_frame() cannot be used with asynchronous=True.");
+        }
+        Planes planes = virtual_output.acquire_frame();
+        return frame_view(virtual_output.native_fourcc(), planes, frame_width, frame_height);
+    }
+
+    py::dict stats() {
+        return stats_dict(virtual_output.send_stats(), async_sender ? async_sender->frames_dropped() : 0);
+    }
+
+    void commit_frame() {
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock {output_mutex};
+        virtual_output.commit_frame();
     }
 };
 
 PYBIND11_MODULE(_native_windows_unity_capture, n) {
     py::class_<UnityCaptureCamera>(n, "Camera")
-        .def(py::init<uint32_t, uint32_t, double, uint32_t, std::optional<std::string>>(),
+        .def(py::init<uint32_t, uint32_t, double, uint32_t, std::optional<std::string>,
+                      bool, uint32_t, const std::string&, uint32_t,
+                      uint32_t, uint32_t, const std::string&, bool, bool, bool,
+                      const std::string&, const std::string&>(),
              py::kw_only(),
              py::arg("width"), py::arg("height"), py::arg("fps"),
-             py::arg("fourcc"), py::arg("device"))
+             py::arg("fourcc"), py::arg("device"),
+             py::arg("asynchronous") = false, py::arg("queue_size") = 2,
+             py::arg("queue_policy") = "drop_oldest",
+             py::arg("threads") = 1,
+             py::arg("input_width") = 0, py::arg("input_height") = 0,
+             py::arg("scale_filter") = "box",
+             py::arg("on_demand") = false,
+             py::arg("in_place") = false,
+             py::arg("skip_unchanged") = false,
+             py::arg("colorspace") = "bt601", py::arg("color_range") = "limited")
         .def("close", &UnityCaptureCamera::close)
-        .def("send", &UnityCaptureCamera::send)
+        .def("send", &UnityCaptureCamera::send, py::arg("frame"), py::arg("dirty_rects") = py::none())
+        .def_property_readonly_static("accepts_strided_frames", [](py::object) { return true; })
+        .def("wait_for_demand", &UnityCaptureCamera::wait_for_demand, py::arg("timeout") = py::none())
+        .def("acquire_frame", &UnityCaptureCamera::acquire_frame)
+        .def("commit_frame", &UnityCaptureCamera::commit_frame)
+        .def("stats", &UnityCaptureCamera::stats)
+        .def_static("send_batch", &send_batch<UnityCaptureCamera>, py::arg("cameras"), py::arg("frames"))
         .def("device", &UnityCaptureCamera::device)
         .def("native_fourcc", &UnityCaptureCamera::native_fourcc);
 }
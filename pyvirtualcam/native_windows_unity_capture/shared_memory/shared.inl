@@ -66,6 +66,14 @@ struct SharedImageMemory
 		return Open(false);
 	}
 
+	// pyvirtualcam: Waits until the receiver asks for a new frame and consumes the request,
+	// so that a following Send() reports SENDRES_WARN_FRAMESKIP unless the receiver asked again.
+	bool WaitForWant(DWORD TimeoutMs)
+	{
+		if (!Open(false)) return false;
+		return (WaitForSingleObject(m_hWantFrameEvent, TimeoutMs) == WAIT_OBJECT_0);
+	}
+
 	enum ESendResult { SENDRES_TOOLARGE, SENDRES_WARN_FRAMESKIP, SENDRES_OK };
 	ESendResult Send(int width, int height, int stride, DWORD DataSize, EFormat format, EResizeMode resizemode, EMirrorMode mirrormode, int timeout, const uint8_t* buffer)
 	{
@@ -90,6 +98,33 @@ struct SharedImageMemory
 		return (DidSkipFrame ? SENDRES_WARN_FRAMESKIP : SENDRES_OK);
 	}
 
+	// pyvirtualcam: Like Send(), but Fill(uint8_t* data) writes the image straight into the shared buffer
+	// while the mutex is held, instead of it being copied there from a separate buffer.
+	template <typename FillFunc>
+	ESendResult SendInPlace(int width, int height, int stride, DWORD DataSize, EFormat format, EResizeMode resizemode, EMirrorMode mirrormode, int timeout, FillFunc Fill)
+	{
+		UCASSERT(m_pSharedBuf);
+		if (m_pSharedBuf->maxSize < DataSize) return SENDRES_TOOLARGE;
+
+		{
+			WaitForSingleObject(m_hMutex, INFINITE); //lock mutex
+			struct UnlockAtReturn { ~UnlockAtReturn() { ReleaseMutex(m); }; HANDLE m; } cs = { m_hMutex };
+			m_pSharedBuf->width = width;
+			m_pSharedBuf->height = height;
+			m_pSharedBuf->stride = stride;
+			m_pSharedBuf->format = format;
+			m_pSharedBuf->resizemode = resizemode;
+			m_pSharedBuf->mirrormode = mirrormode;
+			m_pSharedBuf->timeout = timeout;
+			Fill(m_pSharedBuf->data);
+		}
+
+		SetEvent(m_hSentFrameEvent);
+		bool DidSkipFrame = (WaitForSingleObject(m_hWantFrameEvent, 0) != WAIT_OBJECT_0);
+
+		return (DidSkipFrame ? SENDRES_WARN_FRAMESKIP : SENDRES_OK);
+	}
+
 private:
 	bool Open(bool ForReceiving)
 	{
@@ -3,9 +3,15 @@
 #include <stdio.h>
 #define NOMINMAX
 #include <Windows.h>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <limits>
+#include "../native_shared/frame_changes.h"
 #include "../native_shared/image_formats.h"
+#include "../native_shared/stats.h"
+#include "../native_shared/trace.h"
+#include "../native_shared/yuv_matrix.h"
 #include "shared_memory/shared.inl"
 
 #ifdef _WIN64
@@ -39,25 +45,149 @@ static bool get_name(int num, std::string& str) {
 
 // Unity Capture does not have an exclusive access / locking mechanism.
 // To avoid selecting the same device more than once,
-// we keep track of the ones we use ourselves.
-// Obviously, this won't help if multiple processes are used
-// or if devices are used by other tools.
+// we keep track of the ones we use ourselves,
+// and reserve them across processes with named mutexes, see reserve_device().
+// Obviously, this won't help if devices are used by other tools.
 // In this case, explicitly specifying the device seems the only solution.
 static std::set<std::string> ACTIVE_DEVICES;
 
+using DeviceReservation = std::unique_ptr<void, BOOL (WINAPI*)(HANDLE)>;
+
+// Reserves the device with number `num` for this process, or returns
+// an empty reservation if another pyvirtualcam process has reserved it.
+// The named mutex exists as long as a process has a handle to it, which
+// Windows closes when the process exits, so it is never locked itself.
+static DeviceReservation reserve_device(int num) {
+    char name[64];
+    snprintf(name, sizeof(name), "pyvirtualcam_UnityCapture_%d", num);
+    HANDLE mutex = CreateMutexA(NULL, FALSE, name);
+    if (mutex && GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mutex);
+        mutex = NULL;
+    }
+    return DeviceReservation(mutex, CloseHandle);
+}
+
 class VirtualOutput {
   private:
     uint32_t _width;
     uint32_t _height;
     uint32_t _fourcc;
     std::string _device;
-    std::vector<uint8_t> _tmp;
+    DeviceReservation _reservation {nullptr, CloseHandle};
+    // Only allocated for acquire_frame() and for conversions that
+    // are not done in the shared buffer, see `_in_place`.
     std::vector<uint8_t> _out;
+    // Rows of `_out` in reverse order, as Unity Capture expects frames bottom-up.
+    Planes _out_planes;
+    // Picked once for the input format.
+    Converter _convert = nullptr;
+    // Only changed rows are converted again into `_out` if set.
+    std::unique_ptr<FrameChanges> _changes;
+    // Whether send() writes frames straight into the shared buffer,
+    // with the receiver locked out meanwhile.
+    bool _in_place = false;
     std::unique_ptr<SharedImageMemory> _shm;
+    std::unique_ptr<ThreadPool> _pool;
+    SendStats _stats;
+    FrameSequence _frames;
     bool _running = false;
+    // Only send frames that the receiver asked for.
+    bool _on_demand = false;
+    // A request of the receiver consumed by wait_for_demand()
+    // that no frame was sent for yet.
+    std::atomic<bool> _demanded {false};
+
+    // Shared-memory parameters of our frames.
+    static constexpr auto FORMAT = SharedImageMemory::FORMAT_UINT8;
+    // Note: RESIZEMODE_LINEAR means nearest neighbor scaling.
+    static constexpr auto RESIZE_MODE = SharedImageMemory::RESIZEMODE_LINEAR;
+    static constexpr auto MIRROR_MODE = SharedImageMemory::MIRRORMODE_DISABLED;
+    // Keep showing last received frame after stopping while receiving app is still capturing.
+    static constexpr int TIMEOUT = std::numeric_limits<int>::max() - SharedImageMemory::RECEIVE_MAX_WAIT;
+
+    // Whether the receiver asked for a frame since the last one was sent.
+    bool take_demand() {
+        return _demanded.exchange(false) || _shm->WaitForWant(0);
+    }
+
+    void allocate_out() {
+        _out.resize(rgba_frame_size(_width, _height));
+        _out_planes = flip_planes(libyuv::FOURCC_ABGR,
+            fourcc_planes(libyuv::FOURCC_ABGR, _out.data(), _width, _height), _height);
+    }
+
+    // `wanted` is true if the receiver's request for this frame was
+    // already consumed, then Send() reports a skip for it regardless.
+    // `frame` is the sequence number of the frame for trace events.
+    void send_output(uint64_t frame, bool wanted = false) {
+        SharedImageMemory::ESendResult result;
+        {
+            ScopedTimer timer {_stats.output};
+            TRACE_SPAN(output, frame);
+            result = _shm->Send(_width, _height, _width, _out.size(), FORMAT, RESIZE_MODE, MIRROR_MODE, TIMEOUT, _out.data());
+        }
+        record_result(result, wanted);
+    }
+
+    // Converts `frame` straight into the shared buffer, bottom-up,
+    // which for RGBA input is a single copy of each row.
+    void send_in_place(const Planes& frame, uint64_t frame_number, bool wanted) {
+        uint32_t size = rgba_frame_size(_width, _height);
+        SharedImageMemory::ESendResult result;
+        {
+            // Includes the conversion, which is also timed on its own.
+            ScopedTimer timer {_stats.output};
+            TRACE_SPAN(output, frame_number);
+            result = _shm->SendInPlace(_width, _height, _width, size, FORMAT, RESIZE_MODE, MIRROR_MODE, TIMEOUT,
+                [&](uint8_t* data) {
+                    ScopedTimer timer {_stats.convert};
+                    TRACE_SPAN(convert, frame_number);
+                    Planes dst = flip_planes(libyuv::FOURCC_ABGR,
+                        fourcc_planes(libyuv::FOURCC_ABGR, data, _width, _height), _height);
+                    convert_frame(_convert,
+                        _fourcc, frame, libyuv::FOURCC_ABGR, dst,
+                        _width, _height, _pool.get());
+                });
+        }
+        record_result(result, wanted);
+    }
+
+    // For a frame that is not converted.
+    void skip_changes(const std::vector<DirtyRect>* dirty) {
+        if (_changes) {
+            _changes->skip(dirty);
+        }
+    }
+
+    void record_result(SharedImageMemory::ESendResult result, bool wanted) {
+        uint32_t size = rgba_frame_size(_width, _height);
+        switch (result) {
+            case SharedImageMemory::SENDRES_OK:
+                if (_on_demand) {
+                    // Send() consumed the request that the receiver
+                    // made meanwhile, which asks for the next frame.
+                    _demanded = true;
+                }
+                _stats.record_output(size);
+                break;
+            case SharedImageMemory::SENDRES_WARN_FRAMESKIP:
+                // The receiver missed the previous frame, this one was sent.
+                if (!wanted) {
+                    _stats.record_dropped();
+                }
+                _stats.record_output(size);
+                break;
+            case SharedImageMemory::SENDRES_TOOLARGE:
+                _stats.record_dropped();
+                break;
+        }
+    }
 
   public:
-    VirtualOutput(uint32_t width, uint32_t height, double fps, uint32_t fourcc, std::optional<std::string> device) {
+    VirtualOutput(uint32_t width, uint32_t height, double fps, uint32_t fourcc, std::optional<std::string> device,
+                  uint32_t threads = 1, bool on_demand = false, bool in_place = false,
+                  bool skip_unchanged = false, YuvMatrix matrix = YuvMatrix::BT601Limited) {
         int i;
         if (device.has_value()) {
             std::string name = *device;
@@ -73,12 +203,18 @@ class VirtualOutput {
             if (i == MAX_CAPNUM) {
                 throw std::runtime_error("No camera registered with this name.");
             }
+            _reservation = reserve_device(i);
+            if (!_reservation) {
+                throw std::invalid_argument(
+                    "Device " + name + " is already in use by another process."
+                );
+            }
         } else {
             bool found_one = false;
             for (i = 0; i < MAX_CAPNUM; i++) {
                 if (get_name(i, _device)) {
                     found_one = true;
-                    if (!ACTIVE_DEVICES.count(_device))
+                    if (!ACTIVE_DEVICES.count(_device) && (_reservation = reserve_device(i)))
                         break;
                 }
             }
@@ -94,27 +230,27 @@ class VirtualOutput {
         _width = width;
         _height = height;
         _fourcc = libyuv::CanonicalFourCC(fourcc);
-        _out.resize(rgba_frame_size(width, height));
-        switch(_fourcc) {
-            case libyuv::FOURCC_ABGR:
-            case libyuv::FOURCC_I420:
-            case libyuv::FOURCC_NV12:
-                // RGBA|I420|NV12 -> RGBA
-                // Note: RGBA -> RGBA is needed for vertical flipping.
-                break;
-            case libyuv::FOURCC_RAW:
-            case libyuv::FOURCC_24BG:
-            case libyuv::FOURCC_J400:
-            case libyuv::FOURCC_YUY2:
-            case libyuv::FOURCC_UYVY:
-                // RGB|BGR|GRAY|YUYV|UYVY -> BGRA -> RGBA
-                _tmp.resize(bgra_frame_size(width, height));
-                break;
-            default:
-                throw std::runtime_error(
-                    "Unsupported image format."
-                );
+        // RGBA|BGRA|RGB|BGR|GRAY|I420|NV12|YUYV|UYVY -> RGBA
+        // Note: RGBA -> RGBA is needed for vertical flipping.
+        // YUV input is read in `matrix`.
+        _convert = find_output_converter(_fourcc, libyuv::FOURCC_ABGR, matrix);
+        if (!_convert) {
+            throw std::runtime_error(
+                "Unsupported image format."
+            );
+        }
+        // RGBA input is only copied, which takes as long as copying from `_out`
+        // would, so it is always written in place.
+        // Other input is converted into `_out` to keep the previous output.
+        if (skip_unchanged && _fourcc != libyuv::FOURCC_ABGR) {
+            _changes = std::make_unique<FrameChanges>(_fourcc, width, height);
+        }
+        _in_place = !_changes && (in_place || _fourcc == libyuv::FOURCC_ABGR);
+        if (!_in_place) {
+            allocate_out();
         }
+        _pool = make_thread_pool(threads);
+        _on_demand = on_demand;
         ACTIVE_DEVICES.insert(_device);
         _running = true;
     }
@@ -123,66 +259,107 @@ class VirtualOutput {
         if (!_running)
             return;
         _shm = nullptr;
+        _reservation = nullptr;
         _running = false;
         ACTIVE_DEVICES.erase(_device);
     }
 
-    void send(const uint8_t *frame) {
+    // `dirty` lists the rectangles that changed since the previous
+    // frame if frames are only converted where they changed.
+    void send(const Planes& frame, const std::vector<DirtyRect>* dirty = nullptr) {
         if (!_running)
             return;
+        uint64_t frame_number = _frames.next();
         if (!_shm->SendIsReady()) {
             // happens when no app is capturing the camera yet
+            skip_changes(dirty);
+            _stats.record_dropped();
             return;
         }
+        bool wanted = false;
+        if (_on_demand) {
+            wanted = take_demand();
+            if (!wanted) {
+                // The receiver still has the previous frame,
+                // converting this one would be wasted.
+                skip_changes(dirty);
+                _stats.record_skipped();
+                return;
+            }
+        }
 
-        uint8_t* tmp = _tmp.data();
-        uint8_t* out = _out.data();
+        if (_in_place) {
+            send_in_place(frame, frame_number, wanted);
+            return;
+        }
 
-        // vertical flip
-        int32_t height_invert = -static_cast<int32_t>(_height);
+        {
+            ScopedTimer timer {_stats.convert};
+            TRACE_SPAN(convert, frame_number);
+            if (_changes) {
+                const std::vector<RowBand>& bands = _changes->update(frame, dirty);
+                if (bands.empty()) {
+                    _stats.record_unchanged();
+                }
+                convert_bands(_convert,
+                    _fourcc, frame, libyuv::FOURCC_ABGR, _out_planes,
+                    _width, bands, _pool.get());
+            } else {
+                convert_frame(_convert,
+                    _fourcc, frame, libyuv::FOURCC_ABGR, _out_planes,
+                    _width, _height, _pool.get());
+            }
+        }
 
-        switch (_fourcc) {
-            case libyuv::FOURCC_RAW:
-                rgb_to_bgra(frame, tmp, _width, _height);
-                bgra_to_rgba(tmp, out, _width, height_invert);
-                break;
-            case libyuv::FOURCC_24BG:
-                bgr_to_bgra(frame, tmp, _width, _height);
-                bgra_to_rgba(tmp, out, _width, height_invert);
-                break;
-            case libyuv::FOURCC_J400:
-                gray_to_bgra(frame, tmp, _width, _height);
-                bgra_to_rgba(tmp, out, _width, height_invert);
-                break;
-            case libyuv::FOURCC_I420:
-                i420_to_rgba(frame, out, _width, height_invert);
-                break;
-            case libyuv::FOURCC_NV12:
-                nv12_to_rgba(frame, out, _width, height_invert);
-                break;
-            case libyuv::FOURCC_YUY2:
-                yuyv_to_bgra(frame, tmp, _width, _height);
-                bgra_to_rgba(tmp, out, _width, height_invert);
-                break;
-            case libyuv::FOURCC_UYVY:
-                uyvy_to_bgra(frame, tmp, _width, _height);
-                bgra_to_rgba(tmp, out, _width, height_invert);
-                break;
-            case libyuv::FOURCC_ABGR:
-                rgba_to_rgba(frame, out, _width, height_invert);
-                break;
-            default:
-                throw std::logic_error("not implemented");
+        send_output(frame_number, wanted);
+    }
+
+    // Waits until the receiver asks for a new frame, for at most
+    // `timeout_ms` milliseconds. Returns false on timeout or if
+    // no app is capturing the camera.
+    bool wait_for_demand(DWORD timeout_ms) {
+        if (!_running)
+            return false;
+        if (_demanded) {
+            return true;
+        }
+        if (!_shm->WaitForWant(timeout_ms)) {
+            return false;
         }
-        
-        int stride = _width;
-        auto format = SharedImageMemory::FORMAT_UINT8;
-        // Note: RESIZEMODE_LINEAR means nearest neighbor scaling.
-        auto resize_mode = SharedImageMemory::RESIZEMODE_LINEAR;
-        auto mirror_mode = SharedImageMemory::MIRRORMODE_DISABLED;
-        // Keep showing last received frame after stopping while receiving app is still capturing.
-        constexpr int timeout = std::numeric_limits<int>::max() - SharedImageMemory::RECEIVE_MAX_WAIT;
-        _shm->Send(_width, _height, stride, _out.size(), format, resize_mode, mirror_mode, timeout, out);
+        _demanded = true;
+        return true;
+    }
+
+    // Native-format memory to fill before calling commit_frame().
+    // Rows are in reverse order as Unity Capture expects frames bottom-up.
+    Planes acquire_frame() {
+        if (!_running) {
+            throw std::runtime_error("virtual camera output is not running");
+        }
+        // The caller fills the frame without holding the shared mutex,
+        // so it goes through `_out` even if send() works in place.
+        if (_out.empty()) {
+            allocate_out();
+        }
+        if (_changes) {
+            // `_out` no longer holds the conversion of the previous frame.
+            _changes->invalidate();
+        }
+        return _out_planes;
+    }
+
+    void commit_frame() {
+        if (!_running)
+            return;
+        uint64_t frame_number = _frames.next();
+        if (!_shm->SendIsReady()) {
+            // happens when no app is capturing the camera yet
+            _stats.record_dropped();
+            return;
+        }
+        // The frame is already filled, so it is sent even if
+        // the receiver did not ask for it in on-demand mode.
+        send_output(frame_number, _on_demand && take_demand());
     }
 
     std::string device() {
@@ -192,4 +369,8 @@ class VirtualOutput {
     uint32_t native_fourcc() {
         return libyuv::FOURCC_ABGR;
     }
+
+    SendStats& send_stats() {
+        return _stats;
+    }
 };
@@ -1,5 +1,6 @@
 # https://github.com/pybind/python_example/blob/master/setup.py
 
+import os
 import platform
 import sys
 import glob
@@ -34,7 +35,7 @@ if platform.system() == 'Windows':
                 'pyvirtualcam/native_windows_obs/queue/shared-memory-queue.c',
             ] + common_src),
             include_dirs=['pyvirtualcam/native_windows_obs'] + common_inc,
-            extra_link_args=["/DEFAULTLIB:advapi32.lib"],
+            extra_link_args=["/DEFAULTLIB:advapi32.lib", "/DEFAULTLIB:winmm.lib"],
             language='c++'
         )
     )
@@ -86,6 +87,27 @@ elif platform.system() == 'Linux':
 else:
     raise NotImplementedError('unsupported OS')
 
+# Backend-independent helpers like the frame pacer.
+ext_modules.append(
+    Extension('pyvirtualcam._native_common',
+        ['pyvirtualcam/native_common/main.cpp'],
+        include_dirs=[get_pybind_include()],
+        # timeBeginPeriod() of the frame pacer
+        extra_link_args=["/DEFAULTLIB:winmm.lib"] if platform.system() == 'Windows' else [],
+        language='c++'
+    )
+)
+
+# Conversion microbenchmarks, see test/benchmark_conversions.py.
+if os.environ.get('PYVIRTUALCAM_BUILD_BENCHMARKS') == '1':
+    ext_modules.append(
+        Extension('pyvirtualcam._native_bench',
+            sorted(['pyvirtualcam/native_bench/main.cpp'] + common_src),
+            include_dirs=common_inc,
+            language='c++'
+        )
+    )
+
 # cf http://bugs.python.org/issue26689
 def has_flag(compiler, flagname):
     """Return a boolean indicating whether a flag name is supported on
@@ -137,6 +159,9 @@ class BuildExt(build_ext):
 
         for ext in self.extensions:
             ext.define_macros = [('VERSION_INFO', '"{}"'.format(self.distribution.get_version()))]
+            # Frame-level trace points, see pyvirtualcam/native_shared/trace.h.
+            if os.environ.get('PYVIRTUALCAM_TRACE') == '1':
+                ext.define_macros.append(('PYVIRTUALCAM_TRACE', '1'))
             ext.extra_compile_args += opts
             ext.extra_link_args += link_opts
         build_ext.build_extensions(self)
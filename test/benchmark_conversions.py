@@ -0,0 +1,141 @@
+# This script measures the per-call cost of the native pixel format
+# conversions for every input format each backend accepts, so that the
+# cheapest input format can be chosen per backend and CPU.
+#
+# The conversions run in a separate native module, which is only built with:
+#   PYVIRTUALCAM_BUILD_BENCHMARKS=1 pip install -e .
+#
+# The benchmark does not need a virtual camera, all backends' conversions
+# can be measured on any platform. Results are printed along with the CPU
+# features that libyuv detected, and written as JSON with --output.
+#
+# Conversions between RGB and YUV default to BT.601 limited range, which
+# libyuv implements with SIMD kernels. Other matrices, selected with
+# --colorspace and --color-range, use the portable kernels of yuv_matrix.h,
+# so running both shows what they cost compared to libyuv.
+#
+# Example:
+#   python test/benchmark_conversions.py --resolution 1920x1080 --output conversions.json
+#   python test/benchmark_conversions.py --resolution 1920x1080 --colorspace bt709
+
+import json
+import platform
+import argparse
+from pathlib import Path
+
+import pyvirtualcam
+from pyvirtualcam import PixelFormat
+from pyvirtualcam.util import encode_fourcc
+
+try:
+    from pyvirtualcam import _native_bench
+except ImportError:
+    raise SystemExit('Build pyvirtualcam with PYVIRTUALCAM_BUILD_BENCHMARKS=1 first')
+
+INPUTS = [fmt.value for fmt in PixelFormat]
+
+# The native format of each backend's VirtualOutput, and whether
+# it converts into vertically flipped planes.
+BACKENDS = {
+    'obs (Windows)': ('NV12', False),
+    'unitycapture': ('ABGR', True),
+    'obs (macOS)': ('UYVY', False),
+    'v4l2loopback': (None, False),
+}
+
+def v4l2loopback_output(src: str) -> str:
+    # Devices default to I420 for RGB input, NV12 for NV21 and P010 input,
+    # and to the input format otherwise.
+    if src in ['raw ', '24BG', 'ABGR', 'ARGB']:
+        return 'I420'
+    if src in ['NV21', 'P010']:
+        return 'NV12'
+    return src
+
+def format_name(fourcc: str) -> str:
+    return PixelFormat(fourcc).name
+
+def parse_resolution(s: str):
+    w, h = s.lower().split('x')
+    return int(w), int(h)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--backend', nargs='+', choices=list(BACKENDS),
+                        default=list(BACKENDS))
+    parser.add_argument('--resolution', nargs='+', type=parse_resolution,
+                        default=[(640, 480), (1280, 720), (1920, 1080), (3840, 2160)])
+    parser.add_argument('--all-pairs', action='store_true',
+                        help='also measure every pair of formats, like v4l2loopback devices with own formats')
+    parser.add_argument('--flip', action='store_true',
+                        help='also measure flipped variants of all conversions')
+    parser.add_argument('--colorspace', choices=['bt601', 'bt709', 'bt2020'], default='bt601')
+    parser.add_argument('--color-range', choices=['limited', 'full'], default='limited')
+    parser.add_argument('--min-iterations', type=int, default=20)
+    parser.add_argument('--min-seconds', type=float, default=0.5)
+    parser.add_argument('--output', type=Path, help='JSON report path')
+    args = parser.parse_args()
+
+    cpu_features = _native_bench.cpu_features()
+    print('libyuv CPU features: ' + ', '.join(name for name, on in cpu_features.items() if on))
+    print(f'Color matrix: {args.colorspace} {args.color_range} range')
+
+    # (backend, src, dst, flip), backend is None for --all-pairs.
+    cases = []
+    for backend in args.backend:
+        native, flip = BACKENDS[backend]
+        for src in INPUTS:
+            dst = native or v4l2loopback_output(src)
+            flips = [flip, not flip] if args.flip else [flip]
+            cases += [(backend, src, dst, f) for f in flips]
+    if args.all_pairs:
+        for src in INPUTS:
+            for dst in INPUTS:
+                flips = [False, True] if args.flip else [False]
+                cases += [(None, src, dst, f) for f in flips]
+
+    results = []
+    for w, h in args.resolution:
+        for backend, src, dst, flip in cases:
+            name = f'{format_name(src)} -> {format_name(dst)}{" flipped" if flip else ""} {w}x{h}'
+            result = {
+                'backend': backend,
+                'src': format_name(src),
+                'dst': format_name(dst),
+                'flip': flip,
+                'width': w,
+                'height': h,
+                'colorspace': args.colorspace,
+                'color_range': args.color_range,
+            }
+            try:
+                result.update(_native_bench.bench_conversion(
+                    encode_fourcc(src), encode_fourcc(dst), w, h, flip,
+                    args.min_iterations, args.min_seconds,
+                    args.colorspace, args.color_range))
+            except ValueError:
+                # Pairs that no backend converts between.
+                if backend is None:
+                    continue
+                raise
+            results.append(result)
+            print(f'{backend or "":14} {name:36} {result["path"]:8} '
+                  f'{result["median_ns"] / 1e6:8.3f} ms {result["ns_per_pixel"]:7.3f} ns/px '
+                  f'{result["gb_per_s"]:6.2f} GB/s')
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({
+                'system': {
+                    'platform': platform.platform(),
+                    'machine': platform.machine(),
+                    'processor': platform.processor(),
+                    'pyvirtualcam': pyvirtualcam.__version__,
+                    'cpu_features': cpu_features,
+                },
+                'results': results,
+            }, f, indent=2)
+        print(f'Report written to {args.output}')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,307 @@
+# This script measures the latency from sending a frame to capturing it
+# in another process, for every backend, pixel format and resolution.
+#
+# Each frame carries its ID as black and white blocks in the top rows, which
+# the capturing process decodes. Both processes timestamp frames with the
+# monotonic clock of the system, so latencies are exact up to the time of
+# decoding a captured frame. Results are printed, and written as JSON with
+# --output so that runs can be compared across machines and changes.
+#
+# Capturing uses OpenCV with V4L2 on Linux and AVFoundation on macOS, and
+# a persistent DirectShow session on Windows (see win-dshow-capture/).
+#
+# Example:
+#   python test/benchmark_latency.py --resolution 1280x720 --fmt RGB NV12 --output latency.json
+
+import sys
+import json
+import time
+import platform
+import argparse
+import subprocess
+import tempfile
+from pathlib import Path
+from typing import Dict, List, Optional
+
+import numpy as np
+
+import pyvirtualcam
+from pyvirtualcam import PixelFormat
+
+BLOCK = 16
+ID_BITS = 16
+
+def luma(frame: np.ndarray, fmt: PixelFormat, w: int, h: int) -> np.ndarray:
+    """ View of the pixels that carry the frame ID. """
+    if fmt in [PixelFormat.RGB, PixelFormat.BGR]:
+        return frame
+    elif fmt == PixelFormat.RGBA:
+        return frame[:, :, :3]
+    elif fmt == PixelFormat.GRAY:
+        return frame
+    elif fmt in [PixelFormat.I420, PixelFormat.NV12]:
+        return frame[:h]
+    elif fmt == PixelFormat.YUYV:
+        return frame.reshape(-1)[::2].reshape(h, w)
+    elif fmt == PixelFormat.UYVY:
+        return frame.reshape(-1)[1::2].reshape(h, w)
+    assert False, fmt
+
+def get_black_frame(w: int, h: int, fmt: PixelFormat) -> np.ndarray:
+    if fmt in [PixelFormat.RGB, PixelFormat.BGR]:
+        return np.zeros((h, w, 3), np.uint8)
+    elif fmt == PixelFormat.RGBA:
+        frame = np.zeros((h, w, 4), np.uint8)
+        frame[:, :, 3] = 255
+        return frame
+    elif fmt == PixelFormat.GRAY:
+        return np.zeros((h, w), np.uint8)
+    elif fmt in [PixelFormat.I420, PixelFormat.NV12]:
+        frame = np.full((h + h // 2, w), 128, np.uint8)
+        frame[:h] = 0
+        return frame
+    elif fmt in [PixelFormat.YUYV, PixelFormat.UYVY]:
+        frame = np.full((h, w, 2), 128, np.uint8)
+        luma(frame, fmt, w, h)[:] = 0
+        return frame
+    assert False, fmt
+
+def id_bits(frame_id: int) -> List[int]:
+    # The complement detects torn or blended frames.
+    value = (frame_id << ID_BITS) | (~frame_id & ((1 << ID_BITS) - 1))
+    return [(value >> i) & 1 for i in range(2 * ID_BITS)]
+
+def block_origins(w: int):
+    per_row = w // BLOCK
+    for i in range(2 * ID_BITS):
+        yield (i // per_row) * BLOCK, (i % per_row) * BLOCK
+
+def write_frame_id(frame: np.ndarray, fmt: PixelFormat, w: int, h: int, frame_id: int):
+    pixels = luma(frame, fmt, w, h)
+    for bit, (y, x) in zip(id_bits(frame_id), block_origins(w)):
+        pixels[y:y+BLOCK, x:x+BLOCK] = 255 * bit
+
+def read_frame_id(rgb: np.ndarray) -> Optional[int]:
+    """ Frame ID of a captured frame, or None if it is not readable. """
+    h, w = rgb.shape[:2]
+    bits = []
+    for y, x in block_origins(w):
+        center = rgb[y + BLOCK // 2, x + BLOCK // 2]
+        bits.append(1 if int(np.mean(center)) > 128 else 0)
+    value = sum(bit << i for i, bit in enumerate(bits))
+    frame_id = value >> ID_BITS
+    if (value & ((1 << ID_BITS) - 1)) != (~frame_id & ((1 << ID_BITS) - 1)):
+        return None
+    return frame_id
+
+def open_reader(device: str, w: int, h: int):
+    """ Returns a function that blocks until a new RGB frame is available,
+    and a function that closes the device. """
+    if platform.system() == 'Windows':
+        import pyvirtualcam_win_dshow_capture as dshow
+        session = dshow.Session(device, w, h, delay_ms=0)
+        def read():
+            # The sample grabber returns the latest frame without waiting.
+            time.sleep(0.0005)
+            rgb, _ = session.read()
+            return rgb
+        return read, session.close
+
+    import cv2
+    if platform.system() == 'Darwin':
+        vc = cv2.VideoCapture(0, cv2.CAP_AVFOUNDATION)
+    else:
+        vc = cv2.VideoCapture(device, cv2.CAP_V4L2)
+    if not vc.isOpened():
+        raise RuntimeError(f'Could not open {device} for capture')
+    vc.set(cv2.CAP_PROP_FRAME_WIDTH, w)
+    vc.set(cv2.CAP_PROP_FRAME_HEIGHT, h)
+    # Queued frames would add up to the measured latency.
+    vc.set(cv2.CAP_PROP_BUFFERSIZE, 1)
+    def read():
+        ret, bgr = vc.read()
+        if not ret:
+            raise RuntimeError(f'Could not read from {device}')
+        return bgr[:, :, ::-1]
+    return read, vc.release
+
+def capture(device: str, w: int, h: int, duration: float, out_path: Path):
+    read, close = open_reader(device, w, h)
+    try:
+        # Wait until frames of the sender arrive, the first frames of
+        # some devices are placeholders or come from a previous sender.
+        deadline = time.monotonic() + 30
+        while read_frame_id(read()) is None:
+            if time.monotonic() > deadline:
+                raise RuntimeError('No frame with an ID was captured')
+        t_start = time.perf_counter_ns()
+        t_end = t_start + int(duration * 1e9)
+        frames = []
+        unreadable = 0
+        last_id = None
+        while True:
+            rgb = read()
+            t = time.perf_counter_ns()
+            if t > t_end:
+                break
+            frame_id = read_frame_id(rgb)
+            if frame_id is None:
+                unreadable += 1
+            elif frame_id != last_id:
+                frames.append([frame_id, t])
+                last_id = frame_id
+    finally:
+        close()
+    with open(out_path, 'w') as f:
+        json.dump({
+            't_start': t_start,
+            't_end': t_end,
+            'frames': frames,
+            'unreadable': unreadable,
+        }, f)
+
+def summarize_ms(values_ns: List[int]) -> Dict[str, float]:
+    if not values_ns:
+        return {'count': 0}
+    a = np.array(values_ns, np.float64) / 1e6
+    return {
+        'count': len(a),
+        'mean': round(float(a.mean()), 3),
+        'p50': round(float(np.percentile(a, 50)), 3),
+        'p90': round(float(np.percentile(a, 90)), 3),
+        'p99': round(float(np.percentile(a, 99)), 3),
+        'max': round(float(a.max()), 3),
+    }
+
+def run(backend: str, fmt: PixelFormat, w: int, h: int, fps: float,
+        duration: float, asynchronous: bool) -> dict:
+    frame = get_black_frame(w, h, fmt)
+    send_times: Dict[int, int] = {}
+    with pyvirtualcam.Camera(w, h, fps, fmt=fmt, backend=backend,
+                             asynchronous=asynchronous) as cam:
+        device = cam.device[0] if isinstance(cam.device, list) else cam.device
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            out_path = Path(tmp_dir) / 'capture.json'
+            p = subprocess.Popen([
+                sys.executable, __file__,
+                '--action', 'capture',
+                '--device', device,
+                '--resolution', f'{w}x{h}',
+                '--duration', str(duration),
+                '--capture-output', str(out_path)])
+            frame_id = 0
+            timeout = time.monotonic() + duration + 60
+            while p.poll() is None:
+                if time.monotonic() > timeout:
+                    p.kill()
+                    raise RuntimeError('Capture did not finish in time')
+                frame_id = (frame_id + 1) % (1 << ID_BITS)
+                write_frame_id(frame, fmt, w, h, frame_id)
+                send_times[frame_id] = time.perf_counter_ns()
+                cam.send(frame)
+                cam.wait_for_next_slot()
+            if p.returncode != 0:
+                raise RuntimeError(f'Capture failed with exit code {p.returncode}')
+            with open(out_path) as f:
+                captured = json.load(f)
+        try:
+            stats = cam.stats()
+        except NotImplementedError:
+            stats = None
+
+    t_start, t_end = captured['t_start'], captured['t_end']
+    latencies = []
+    received = set()
+    for frame_id, t in captured['frames']:
+        t_sent = send_times.get(frame_id)
+        # IDs wrap around, which only matters for very long runs.
+        if t_sent is not None and t_sent <= t:
+            latencies.append(t - t_sent)
+            received.add(frame_id)
+    # Frames sent right before the end may still have been in flight.
+    tail = int(0.5e9)
+    sent = [i for i, t in send_times.items() if t_start <= t <= t_end - tail]
+    dropped = sum(1 for i in sent if i not in received)
+    window_s = (t_end - t_start) / 1e9
+    return {
+        'latency_ms': summarize_ms(latencies),
+        'send_fps': round(len([t for t in send_times.values() if t_start <= t <= t_end]) / window_s, 2),
+        'capture_fps': round(len(captured['frames']) / window_s, 2),
+        'drop_rate': round(dropped / len(sent), 4) if sent else None,
+        'unreadable_frames': captured['unreadable'],
+        'stats': stats,
+    }
+
+def parse_resolution(s: str):
+    w, h = s.lower().split('x')
+    return int(w), int(h)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--action', choices=['run', 'capture'], default='run')
+    parser.add_argument('--backend', nargs='+', choices=list(pyvirtualcam.camera.BACKENDS),
+                        help='default: all backends of the platform')
+    parser.add_argument('--fmt', nargs='+', type=lambda fmt: PixelFormat[fmt],
+                        default=list(PixelFormat), help='default: all pixel formats')
+    parser.add_argument('--resolution', nargs='+', type=parse_resolution,
+                        default=[(640, 480), (1280, 720), (1920, 1080)])
+    parser.add_argument('--fps', type=float, default=30)
+    parser.add_argument('--duration', type=float, default=10,
+                        help='seconds of capturing per measurement')
+    parser.add_argument('--asynchronous', action='store_true')
+    parser.add_argument('--output', type=Path, help='JSON report path')
+    # Internal, for the capturing process.
+    parser.add_argument('--device', help=argparse.SUPPRESS)
+    parser.add_argument('--capture-output', type=Path, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.action == 'capture':
+        w, h = args.resolution[0]
+        capture(args.device, w, h, args.duration, args.capture_output)
+        return
+
+    backends = args.backend or list(pyvirtualcam.camera.BACKENDS)
+    results = []
+    for backend in backends:
+        for fmt in args.fmt:
+            for w, h in args.resolution:
+                result = {
+                    'backend': backend,
+                    'fmt': fmt.name,
+                    'width': w,
+                    'height': h,
+                    'fps': args.fps,
+                    'asynchronous': args.asynchronous,
+                }
+                name = f'{backend} {fmt.name} {w}x{h}'
+                try:
+                    result.update(run(backend, fmt, w, h, args.fps,
+                                      args.duration, args.asynchronous))
+                    result['status'] = 'ok'
+                    latency = result['latency_ms']
+                    print(f'{name}: p50 {latency.get("p50")} ms, p99 {latency.get("p99")} ms, '
+                          f'{result["capture_fps"]} fps captured, drop rate {result["drop_rate"]}')
+                except Exception as e:
+                    # Like formats that a backend or the capture API does not support.
+                    result['status'] = 'failed'
+                    result['error'] = str(e)
+                    print(f'{name}: failed: {e}')
+                results.append(result)
+
+    report = {
+        'system': {
+            'platform': platform.platform(),
+            'machine': platform.machine(),
+            'python': platform.python_version(),
+            'pyvirtualcam': pyvirtualcam.__version__,
+        },
+        'duration_s': args.duration,
+        'results': results,
+    }
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+        print(f'Report written to {args.output}')
+
+if __name__ == '__main__':
+    main()
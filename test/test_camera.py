@@ -1,6 +1,10 @@
 from typing import Any, Dict, Tuple
 import os
+import sys
 import platform
+import subprocess
+import threading
+import time
 import pytest
 import numpy as np
 import pyvirtualcam
@@ -45,6 +49,85 @@ def test_multiple_cameras_are_supported(backend: str):
     frame = np.zeros((cam2.height, cam2.width, 3), np.uint8) # RGB
     cam2.send(frame)
 
+@pytest.mark.skipif(
+    platform.system() == 'Darwin',
+    reason='multiple cameras not supported on macOS (obs backend)')
+@pytest.mark.parametrize("backend", 
+    ['unitycapture'] if platform.system() == 'Windows' else ['v4l2loopback'])
+def test_devices_are_reserved_across_processes(backend: str):
+    code = (
+        'import sys, pyvirtualcam\n'
+        f'cam = pyvirtualcam.Camera(width=640, height=480, fps=20, backend="{backend}")\n'
+        'print(cam.device, flush=True)\n'
+        'sys.stdin.read()\n')
+    p = subprocess.Popen([sys.executable, '-c', code],
+                         stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+    try:
+        other_device = p.stdout.readline().strip()
+        assert other_device
+        # Auto-detection skips the device of the other process.
+        with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend) as cam:
+            assert cam.device != other_device
+        with pytest.raises(RuntimeError):
+            pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend,
+                                device=other_device)
+    finally:
+        p.stdin.close()
+        p.wait()
+
+@pytest.mark.skipif(
+    platform.system() == 'Darwin',
+    reason='multiple cameras not supported on macOS (obs backend)')
+@pytest.mark.parametrize("backend", 
+    ['unitycapture'] if platform.system() == 'Windows' else ['v4l2loopback'])
+def test_camera_group(backend: str):
+    cams = [pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend),
+            pyvirtualcam.Camera(width=640, height=480, fps=20, backend=backend,
+                                fmt=PixelFormat.I420)]
+    with pyvirtualcam.CameraGroup(cams) as group:
+        frames = [np.zeros((720, 1280, 3), np.uint8),
+                  np.zeros(pyvirtualcam.camera.FrameShapes[PixelFormat.I420](640, 480), np.uint8)]
+        for _ in range(5):
+            group.send(frames)
+            group.wait_for_next_slot()
+        for cam in cams:
+            assert cam.frames_sent == 5
+            assert cam.stats()['send']['count'] == 5
+        with pytest.raises(ValueError):
+            group.send(frames[:1])
+        # Frames are checked before any is sent.
+        with pytest.raises(ValueError):
+            group.send([frames[0], frames[0]])
+        assert cams[0].frames_sent == 5
+
+def test_camera_group_without_send_batch():
+    class RecordingBackend:
+        sent = []
+        def __init__(self, **kw):
+            pass
+        def close(self):
+            pass
+        def send(self, frame):
+            RecordingBackend.sent.append(self)
+        def device(self):
+            return 'recording'
+        def native_fourcc(self):
+            return None
+
+    pyvirtualcam.register_backend('recording', RecordingBackend)
+    try:
+        cams = [pyvirtualcam.Camera(width=64, height=48, fps=20, backend='recording')
+                for _ in range(2)]
+        backends = [cam._backend for cam in cams]
+        with pyvirtualcam.CameraGroup(cams) as group:
+            frame = np.zeros((48, 64, 3), np.uint8)
+            group.send([frame, frame])
+        assert RecordingBackend.sent == backends
+        with pytest.raises(ValueError):
+            pyvirtualcam.CameraGroup([cams[0], cams[0]])
+    finally:
+        del pyvirtualcam.camera.BACKENDS['recording']
+
 @pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
 def test_select_camera_device(backend: str):
     if backend == 'obs':
@@ -90,12 +173,62 @@ def test_invalid_frame_dtype():
         with pytest.raises(TypeError):
             cam.send(np.zeros((cam.height, cam.width, 3), np.uint16))
 
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+def test_strided_frames(backend: str):
+    w, h = 1280, 720
+    with pyvirtualcam.Camera(width=w, height=h, fps=20, backend=backend) as cam:
+        # cropped view with padded rows
+        cam.send(np.zeros((h + 8, w + 64, 3), np.uint8)[4:4 + h, 32:32 + w])
+        # flipped view with negative row stride
+        cam.send(np.zeros((h, w, 3), np.uint8)[::-1])
+        # buffer protocol
+        cam.send(memoryview(np.zeros((h, w, 3), np.uint8)))
+
+    with pyvirtualcam.Camera(width=w, height=h, fps=20, fmt=PixelFormat.YUYV, backend=backend) as cam:
+        cam.send(np.zeros((h, w * 2 + 128), np.uint8)[:, :w * 2])
+
+    with pyvirtualcam.Camera(width=w, height=h, fps=20, fmt=PixelFormat.I420, backend=backend) as cam:
+        y = np.zeros((h, w + 64), np.uint8)[:, :w]
+        u = np.zeros((h // 2, w // 2 + 32), np.uint8)[:, :w // 2]
+        v = np.zeros((h // 2, w // 2), np.uint8)
+        cam.send((y, u, v))
+
+    with pyvirtualcam.Camera(width=w, height=h, fps=20, fmt=PixelFormat.NV12, backend=backend) as cam:
+        padded = np.zeros((h * 3 // 2, w + 64), np.uint8)[:, :w]
+        cam.send(padded)
+        cam.send((padded[:h], padded[h:]))
+        cam.send((np.zeros((h, w), np.uint8), np.zeros((h // 2, w // 2, 2), np.uint8)))
+
+def test_invalid_frame_planes():
+    w, h = 1280, 720
+    with pyvirtualcam.Camera(width=w, height=h, fps=20) as cam:
+        with pytest.raises(ValueError):
+            cam.send((np.zeros((h, w, 3), np.uint8),))
+    with pyvirtualcam.Camera(width=w, height=h, fps=20, fmt=PixelFormat.I420) as cam:
+        with pytest.raises(ValueError):
+            cam.send((np.zeros((h, w), np.uint8), np.zeros((h // 2, w // 2), np.uint8)))
+        with pytest.raises(ValueError):
+            cam.send((np.zeros((h, w), np.uint8), np.zeros((h, w // 4), np.uint8),
+                      np.zeros((h // 2, w // 2), np.uint8)))
+        with pytest.raises(TypeError):
+            cam.send((np.zeros((h, w), np.uint8), np.zeros((h // 2, w // 2), np.uint16),
+                      np.zeros((h // 2, w // 2), np.uint8)))
+
+def test_non_packed_frame():
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam:
+        # pixels within rows are not adjacent
+        with pytest.raises(ValueError):
+            cam.send(np.zeros((720, 2560, 3), np.uint8)[:, ::2])
+
 EXPECTED_NATIVE_FMTS: Dict[Tuple[str,str],Any] = {
     ('Windows', 'obs'): lambda _: PixelFormat.NV12,
     ('Windows', 'unitycapture'): lambda _: PixelFormat.RGBA,
     ('Darwin', 'obs'): lambda _: PixelFormat.UYVY,
     ('Linux', 'v4l2loopback'): lambda fmt: PixelFormat.I420 
-                                 if fmt in [PixelFormat.RGB, PixelFormat.BGR]
+                                 if fmt in [PixelFormat.RGB, PixelFormat.BGR,
+                                            PixelFormat.RGBA, PixelFormat.BGRA]
+                                 else PixelFormat.NV12
+                                 if fmt in [PixelFormat.NV21, PixelFormat.P010]
                                  else fmt,
 }
 
@@ -104,8 +237,8 @@ def test_alternative_pixel_formats(backend: str):
     def check_native_fmt(cam):
         assert cam.native_fmt == EXPECTED_NATIVE_FMTS[(platform.system(), backend)](cam.fmt)
     
-    if backend == 'unitycapture':
-        with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=PixelFormat.RGBA, backend=backend) as cam:
+    for fmt in [PixelFormat.RGBA, PixelFormat.BGRA]:
+        with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=fmt, backend=backend) as cam:
             check_native_fmt(cam)
             cam.send(np.zeros((cam.height, cam.width, 4), np.uint8))
     
@@ -125,6 +258,17 @@ def test_alternative_pixel_formats(backend: str):
         check_native_fmt(cam)
         cam.send(np.zeros(cam.height * cam.width + cam.height * (cam.width // 2), np.uint8))
     
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=PixelFormat.NV21, backend=backend) as cam:
+        check_native_fmt(cam)
+        cam.send(np.zeros(cam.height * cam.width + cam.height * (cam.width // 2), np.uint8))
+
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=PixelFormat.P010, backend=backend) as cam:
+        check_native_fmt(cam)
+        cam.send(np.zeros((cam.height * 3 // 2, cam.width), np.uint16))
+        cam.send(np.zeros(cam.height * cam.width * 3, np.uint8))
+        cam.send((np.zeros((cam.height, cam.width), np.uint16),
+                  np.zeros((cam.height // 2, cam.width), np.uint16)))
+    
     with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=PixelFormat.YUYV, backend=backend) as cam:
         check_native_fmt(cam)
         cam.send(np.zeros(cam.height * cam.width * 2, np.uint8))
@@ -147,6 +291,16 @@ def test_sleep_until_next_frame():
         actual_fps = cam.current_fps
         assert abs(target_fps - actual_fps) < 1.5
 
+def test_wait_for_next_slot():
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        for _ in range(5):
+            cam.send(frame)
+            assert cam.wait_for_next_slot() == 0
+        time.sleep(0.2)
+        assert cam.wait_for_next_slot() > 0
+        assert cam.missed_slots > 0
+
 @pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
 def test_device_name(backend: str):
     with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend) as cam:
@@ -158,3 +312,652 @@ def test_device_name(backend: str):
             assert cam.device.startswith('/dev/video')
         else:
             raise NotImplementedError
+
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+@pytest.mark.parametrize("queue_policy", ['drop_oldest', 'block'])
+def test_asynchronous(backend: str, queue_policy: str):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend,
+                             asynchronous=True, queue_size=2, queue_policy=queue_policy) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        for i in range(10):
+            frame[:] = i
+            cam.send(frame)
+
+def test_invalid_queue_policy():
+    with pytest.raises(RuntimeError):
+        pyvirtualcam.Camera(width=1280, height=720, fps=20,
+                            asynchronous=True, queue_policy='foo')
+
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+@pytest.mark.parametrize("fmt", [PixelFormat.RGB, PixelFormat.NV12, PixelFormat.YUYV])
+def test_threads(backend: str, fmt: PixelFormat):
+    with pyvirtualcam.Camera(width=3840, height=2160, fps=20, fmt=fmt, backend=backend,
+                             threads=4) as cam:
+        if fmt == PixelFormat.RGB:
+            frame = np.zeros((cam.height, cam.width, 3), np.uint8)
+        elif fmt == PixelFormat.NV12:
+            frame = np.zeros(cam.height * cam.width + cam.height * (cam.width // 2), np.uint8)
+        else:
+            frame = np.zeros(cam.height * cam.width * 2, np.uint8)
+        for _ in range(5):
+            cam.send(frame)
+
+def test_invalid_threads():
+    with pytest.raises(RuntimeError):
+        pyvirtualcam.Camera(width=1280, height=720, fps=20, threads=0)
+
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+@pytest.mark.parametrize("fmt", [PixelFormat.RGB, PixelFormat.NV12, PixelFormat.YUYV])
+@pytest.mark.parametrize("asynchronous", [False, True])
+def test_input_size(backend: str, fmt: PixelFormat, asynchronous: bool):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=fmt, backend=backend,
+                             input_size=(1920, 1080), scale_filter='bilinear',
+                             asynchronous=asynchronous) as cam:
+        assert cam.input_size == (1920, 1080)
+        assert (cam.width, cam.height) == (1280, 720)
+        frame_shape = pyvirtualcam.camera.FrameShapes[fmt](1920, 1080)
+        frame = np.zeros(frame_shape, np.uint8)
+        for _ in range(5):
+            cam.send(frame)
+        with pytest.raises(ValueError):
+            cam.send(np.zeros(pyvirtualcam.camera.FrameShapes[fmt](1280, 720), np.uint8))
+
+def test_invalid_scale_filter():
+    with pytest.raises(RuntimeError):
+        pyvirtualcam.Camera(width=1280, height=720, fps=20,
+                            input_size=(640, 360), scale_filter='foo')
+
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+@pytest.mark.parametrize("fmt", [PixelFormat.RGB, PixelFormat.NV12])
+@pytest.mark.parametrize("colorspace,color_range", [('bt709', 'limited'), ('bt709', 'full'), ('bt2020', 'limited')])
+def test_colorspace(backend: str, fmt: PixelFormat, colorspace: str, color_range: str):
+    if backend == 'obs' and platform.system() == 'Darwin' and color_range == 'full':
+        with pytest.raises(RuntimeError):
+            pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=fmt, backend=backend,
+                                colorspace=colorspace, color_range=color_range)
+        return
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=fmt, backend=backend,
+                             colorspace=colorspace, color_range=color_range) as cam:
+        frame = np.zeros(pyvirtualcam.camera.FrameShapes[fmt](cam.width, cam.height), np.uint8)
+        frame[:100] = 255
+        cam.send(frame)
+
+def yuv_of_2x2(fmt: PixelFormat, frame: np.ndarray) -> Tuple[int, int, int]:
+    # Y of the first pixel and the chroma shared by all four.
+    if fmt == PixelFormat.UYVY:
+        return int(frame[1]), int(frame[0]), int(frame[2])
+    # I420 has one byte per chroma plane, NV12 one UV pair.
+    return int(frame[0]), int(frame[4]), int(frame[5])
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='the conversion test hook is in the v4l2loopback module')
+@pytest.mark.parametrize("fmt", [PixelFormat.I420, PixelFormat.NV12, PixelFormat.UYVY])
+@pytest.mark.parametrize("colorspace,color_range,rgb,yuv", [
+    ('bt601', 'limited', (255, 255, 255), (235, 128, 128)),
+    ('bt601', 'full', (255, 255, 255), (255, 128, 128)),
+    ('bt709', 'limited', (255, 255, 255), (235, 128, 128)),
+    ('bt709', 'full', (255, 255, 255), (255, 128, 128)),
+    ('bt2020', 'limited', (255, 255, 255), (235, 128, 128)),
+    ('bt601', 'limited', (255, 0, 0), (82, 90, 240)),
+    ('bt601', 'full', (255, 0, 0), (76, 85, 255)),
+    ('bt709', 'limited', (255, 0, 0), (63, 102, 240)),
+    ('bt709', 'full', (255, 0, 0), (54, 99, 255)),
+    ('bt2020', 'limited', (255, 0, 0), (74, 97, 240)),
+])
+def test_colorspace_values(fmt: PixelFormat, colorspace: str, color_range: str,
+                           rgb: Tuple[int, int, int], yuv: Tuple[int, int, int]):
+    from pyvirtualcam import _native_linux_v4l2loopback
+    from pyvirtualcam.util import encode_fourcc
+    frame = np.empty((2, 2, 3), np.uint8)
+    frame[:] = rgb
+    out = _native_linux_v4l2loopback._convert_frame(
+        frame, encode_fourcc(PixelFormat.RGB.value), encode_fourcc(fmt.value), 2, 2,
+        colorspace=colorspace, color_range=color_range)
+    # libyuv's BT.601 limited range kernels round slightly differently.
+    assert np.abs(np.subtract(yuv_of_2x2(fmt, out), yuv)).max() <= 1
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='the conversion test hook is in the v4l2loopback module')
+@pytest.mark.parametrize("fmt", [PixelFormat.I420, PixelFormat.NV12, PixelFormat.UYVY])
+@pytest.mark.parametrize("colorspace", ['bt601', 'bt709', 'bt2020'])
+@pytest.mark.parametrize("color_range,black,white", [('limited', 16, 235), ('full', 0, 255)])
+def test_gray_range_values(fmt: PixelFormat, colorspace: str, color_range: str, black: int, white: int):
+    from pyvirtualcam import _native_linux_v4l2loopback
+    from pyvirtualcam.util import encode_fourcc
+    # GRAY is full range luma, rescaled for limited range output.
+    for gray, y in [(0, black), (255, white)]:
+        frame = np.full((2, 2), gray, np.uint8)
+        out = _native_linux_v4l2loopback._convert_frame(
+            frame, encode_fourcc(PixelFormat.GRAY.value), encode_fourcc(fmt.value), 2, 2,
+            colorspace=colorspace, color_range=color_range)
+        assert yuv_of_2x2(fmt, out) == (y, 128, 128)
+
+def convert_frame_hook(frame: np.ndarray, src: PixelFormat, dst: PixelFormat,
+                       width: int, height: int, threads: int = 1) -> np.ndarray:
+    from pyvirtualcam import _native_linux_v4l2loopback
+    from pyvirtualcam.util import encode_fourcc
+    return _native_linux_v4l2loopback._convert_frame(
+        frame, encode_fourcc(src.value), encode_fourcc(dst.value), width, height,
+        threads=threads)
+
+def random_frame(fmt: PixelFormat, width: int, height: int) -> np.ndarray:
+    rng = np.random.default_rng(width * height)
+    shape = pyvirtualcam.camera.FrameShapes[fmt](width, height)
+    return rng.integers(0, 256, shape, np.uint8)
+
+# Sizes whose rows span several bands of the row-tiled kernels and of the
+# split over threads, with a short last band. Widths are even as UYVY and
+# 4:2:0 formats need them.
+BAND_SIZES = [(642, 482), (98, 1030)]
+# Odd heights for formats without vertical chroma subsampling.
+PACKED_BAND_SIZES = BAND_SIZES + [(642, 483), (98, 1031)]
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='the conversion test hook is in the v4l2loopback module')
+@pytest.mark.parametrize("src,mid,dst,sizes", [
+    # via_bgra_rows
+    (PixelFormat.RGB, PixelFormat.BGRA, PixelFormat.UYVY, PACKED_BAND_SIZES),
+    (PixelFormat.RGBA, PixelFormat.BGRA, PixelFormat.UYVY, PACKED_BAND_SIZES),
+    (PixelFormat.UYVY, PixelFormat.BGRA, PixelFormat.RGBA, PACKED_BAND_SIZES),
+    # via_i420_chroma_rows
+    (PixelFormat.RGB, PixelFormat.I420, PixelFormat.NV12, BAND_SIZES),
+    (PixelFormat.BGR, PixelFormat.I420, PixelFormat.NV12, BAND_SIZES),
+    # semi_planar_to_uyvy
+    (PixelFormat.NV12, PixelFormat.I420, PixelFormat.UYVY, BAND_SIZES),
+    (PixelFormat.NV21, PixelFormat.I420, PixelFormat.UYVY, BAND_SIZES),
+    # via_nv12_rows
+    (PixelFormat.P010, PixelFormat.NV12, PixelFormat.I420, BAND_SIZES),
+    (PixelFormat.P010, PixelFormat.NV12, PixelFormat.UYVY, BAND_SIZES),
+    (PixelFormat.P010, PixelFormat.NV12, PixelFormat.RGBA, BAND_SIZES),
+])
+def test_row_tiled_values(src: PixelFormat, mid: PixelFormat, dst: PixelFormat, sizes):
+    # Row-tiled conversions give the same result as their two steps over whole frames,
+    # and frames split over threads the same as converted in one go.
+    for width, height in sizes:
+        frame = random_frame(src, width, height)
+        fused = convert_frame_hook(frame, src, dst, width, height)
+        two_step = convert_frame_hook(
+            convert_frame_hook(frame, src, mid, width, height), mid, dst, width, height)
+        assert np.array_equal(fused, two_step), (width, height)
+        threaded = convert_frame_hook(frame, src, dst, width, height, threads=4)
+        assert np.array_equal(threaded, fused), (width, height)
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='the conversion test hook is in the v4l2loopback module')
+@pytest.mark.parametrize("src", [PixelFormat.NV12, PixelFormat.NV21, PixelFormat.P010])
+@pytest.mark.parametrize("threads", [1, 4])
+def test_semi_planar_to_uyvy_reference(src: PixelFormat, threads: int):
+    for width, height in BAND_SIZES:
+        frame = random_frame(src, width, height)
+        if src == PixelFormat.P010:
+            # Samples reduced to their top 8 bits.
+            frame8 = frame.view('<u2') >> 8
+        else:
+            frame8 = frame
+        y = frame8[:width * height].reshape(height, width)
+        uv = frame8[width * height:].reshape(height // 2, width // 2, 2)
+        if src == PixelFormat.NV21:
+            uv = uv[..., ::-1]
+        uv = np.repeat(uv, 2, axis=0)
+        expected = np.empty((height, width // 2, 4), np.uint8)
+        expected[..., 0] = uv[..., 0]
+        expected[..., 1] = y[:, 0::2]
+        expected[..., 2] = uv[..., 1]
+        expected[..., 3] = y[:, 1::2]
+        out = convert_frame_hook(frame, src, PixelFormat.UYVY, width, height, threads=threads)
+        assert np.array_equal(out, expected.ravel()), (width, height)
+
+def test_invalid_colorspace():
+    with pytest.raises(RuntimeError):
+        pyvirtualcam.Camera(width=1280, height=720, fps=20, colorspace='srgb')
+    with pytest.raises(RuntimeError):
+        pyvirtualcam.Camera(width=1280, height=720, fps=20, color_range='studio')
+
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+def test_acquire_commit_frame(backend: str):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend) as cam:
+        for i in range(10):
+            frame = cam.acquire_frame()
+            assert frame.dtype == np.uint8
+            assert frame.flags.writeable
+            shape = pyvirtualcam.camera.FrameShapes[cam.native_fmt](cam.width, cam.height)
+            if isinstance(shape, int):
+                assert frame.size == shape
+            else:
+                assert frame.shape == shape
+            frame[:] = i
+            cam.commit_frame()
+        assert cam.frames_sent == 10
+
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+def test_stats(backend: str):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        for _ in range(5):
+            cam.send(frame)
+        stats = cam.stats()
+        assert stats['send']['count'] == 5
+        assert stats['frames_output'] + stats['frames_dropped'] + stats['frames_skipped'] >= 5
+        # Only counted by backends that output from a pool of buffers.
+        assert 0 <= stats['pool_exhausted'] <= 5
+        if stats['frames_output'] > 0:
+            assert stats['bytes_output'] > 0
+            assert stats['output']['count'] >= stats['frames_output']
+        for stage in ['convert', 'output', 'send']:
+            summary = stats[stage]
+            assert summary['p50_ms'] <= summary['p99_ms'] <= summary['max_ms']
+
+@pytest.mark.parametrize("backend", list(pyvirtualcam.camera.BACKENDS))
+def test_skip_unchanged(backend: str):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend=backend,
+                             skip_unchanged=True) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        cam.send(frame)
+        cam.send(frame)
+        frame[100:120, 200:300] = 255
+        cam.send(frame, dirty_rects=[(200, 100, 100, 20)])
+        frame[500:510] = 128
+        cam.send(frame)
+        cam.send(frame, dirty_rects=[])
+        with pytest.raises(ValueError):
+            cam.send(frame, dirty_rects=[(0, 0, cam.width + 1, 1)])
+        stats = cam.stats()
+    # unitycapture drops frames before comparing them if no app is capturing.
+    if backend != 'unitycapture':
+        assert stats['frames_unchanged'] == 2
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='the conversion test hook is in the v4l2loopback module')
+@pytest.mark.parametrize("src,dst", [
+    (PixelFormat.RGB, PixelFormat.UYVY),
+    # through an I420 frame, whose chroma rows are converted in bands too
+    (PixelFormat.RGB, PixelFormat.YUYV),
+    (PixelFormat.NV12, PixelFormat.I420),
+    (PixelFormat.NV12, PixelFormat.RGBA),
+])
+@pytest.mark.parametrize("width,height", [(642, 482), (98, 1030)])
+@pytest.mark.parametrize("use_dirty_rects", [False, True])
+@pytest.mark.parametrize("threads", [1, 4])
+def test_skip_unchanged_values(src: PixelFormat, dst: PixelFormat, width: int, height: int,
+                               use_dirty_rects: bool, threads: int):
+    # Outputs where only the changed bands were converted again are the same
+    # as converting each frame in full. Heights are not a multiple of the
+    # 16-row bands, and changes are on either side of band boundaries, which
+    # share no chroma rows, and in the short last band.
+    from pyvirtualcam import _native_linux_v4l2loopback
+    from pyvirtualcam.util import encode_fourcc
+    rgb = random_frame(PixelFormat.RGB, width, height)
+    rgb_frames = [rgb.copy()]
+    changes = [
+        [(0, 15, width, 1)],
+        [(10, 16, 20, 2)],
+        [(2, 30, 4, 4), (0, height - 1, width, 1)],
+        [],
+        [(0, 0, width, height)],
+    ]
+    rng = np.random.default_rng(0)
+    for rects in changes:
+        for x, y, w, h in rects:
+            rgb[y:y+h, x:x+w] = rng.integers(0, 256, (h, w, 3), np.uint8)
+        rgb_frames.append(rgb.copy())
+    if src == PixelFormat.RGB:
+        frames = rgb_frames
+    else:
+        frames = [convert_frame_hook(f, PixelFormat.RGB, src, width, height) for f in rgb_frames]
+    # The first frame is hashed.
+    dirty_rects = [None] + changes
+
+    def convert_changes(frames, dirty_rects=None):
+        return _native_linux_v4l2loopback._convert_changes(
+            frames, encode_fourcc(src.value), encode_fourcc(dst.value), width, height,
+            dirty_rects=dirty_rects, threads=threads)
+
+    outputs = convert_changes(frames, dirty_rects if use_dirty_rects else None)
+    assert len(outputs) == len(frames)
+    for i, (frame, out) in enumerate(zip(frames, outputs)):
+        assert np.array_equal(out, convert_changes([frame])[0]), i
+
+def test_acquire_frame_not_supported():
+    class SendOnlyBackend:
+        def __init__(self, **kw):
+            pass
+        def close(self):
+            pass
+        def send(self, frame):
+            pass
+        def device(self):
+            return 'send-only'
+        def native_fourcc(self):
+            return None
+
+    pyvirtualcam.register_backend('send-only', SendOnlyBackend)
+    try:
+        with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend='send-only') as cam:
+            with pytest.raises(NotImplementedError):
+                cam.acquire_frame()
+            with pytest.raises(NotImplementedError):
+                cam.commit_frame()
+            with pytest.raises(NotImplementedError):
+                cam.stats()
+            with pytest.raises(NotImplementedError):
+                cam.wait_for_demand(timeout=0)
+            with pytest.raises(NotImplementedError):
+                cam.send_cvpixelbuffer(0)
+            with pytest.raises(NotImplementedError):
+                cam.send_iosurface(0)
+            with pytest.raises(NotImplementedError):
+                cam.start_relay('/dev/video0')
+            with pytest.raises(NotImplementedError):
+                pyvirtualcam.list_devices(backend='send-only')
+            frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+            with pytest.raises(NotImplementedError):
+                cam.send(frame, timestamp_ns=time.perf_counter_ns())
+            with pytest.raises(ValueError):
+                cam.send(frame, dirty_rects=[])
+    finally:
+        del pyvirtualcam.camera.BACKENDS['send-only']
+
+@pytest.mark.skipif(
+    platform.system() != 'Darwin',
+    reason='pixel buffers are specific to the macOS obs backend')
+def test_send_cvpixelbuffer_invalid():
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam:
+        with pytest.raises(ValueError):
+            cam.send_cvpixelbuffer(0)
+        with pytest.raises(ValueError):
+            cam.send_iosurface(0)
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, asynchronous=True) as cam:
+        with pytest.raises(RuntimeError):
+            cam.send_cvpixelbuffer(0)
+
+@pytest.mark.skipif(
+    platform.system() != 'Windows',
+    reason='timestamps and backpressure are specific to the Windows obs backend')
+@pytest.mark.parametrize("backpressure", ['none', 'wait', 'drop'])
+@pytest.mark.parametrize("asynchronous", [False, True])
+def test_windows_obs_backpressure(backpressure: str, asynchronous: bool):
+    fps = 20
+    with pyvirtualcam.Camera(width=1280, height=720, fps=fps, backend='obs',
+                             asynchronous=asynchronous, backpressure=backpressure) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        t_start = time.perf_counter()
+        # A burst of frames, faster than the frame rate.
+        for i in range(5):
+            cam.send(frame, timestamp_ns=time.perf_counter_ns())
+        elapsed = time.perf_counter() - t_start
+    stats = cam.stats()
+    if backpressure == 'wait' and not asynchronous:
+        assert elapsed >= 4 / fps * 0.9
+    if backpressure == 'drop':
+        assert stats['frames_dropped'] >= 1
+
+@pytest.mark.skipif(
+    platform.system() != 'Windows',
+    reason='backpressure is specific to the Windows obs backend')
+@pytest.mark.parametrize("backpressure", ['wait', 'drop'])
+def test_windows_obs_backpressure_paced(backpressure: str):
+    fps = 20
+    with pyvirtualcam.Camera(width=1280, height=720, fps=fps, backend='obs',
+                             backpressure=backpressure) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        max_send = 0
+        for i in range(20):
+            cam.wait_for_next_slot()
+            t = time.perf_counter()
+            cam.send(frame)
+            max_send = max(max_send, time.perf_counter() - t)
+        missed_slots = cam.missed_slots
+    # Frames at the frame rate are neither dropped nor held back.
+    assert cam.stats()['frames_dropped'] == 0
+    assert missed_slots == 0
+    assert max_send < 0.5 / fps
+
+@pytest.mark.skipif(
+    platform.system() != 'Windows',
+    reason='frame demand is specific to unitycapture')
+def test_unitycapture_on_demand():
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend='unitycapture',
+                             on_demand=True) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        for _ in range(5):
+            cam.wait_for_demand(timeout=0.1)
+            cam.send(frame)
+        stats = cam.stats()
+    # Without a capturing app, frames are dropped before checking for demand.
+    assert stats['frames_output'] + stats['frames_dropped'] + stats['frames_skipped'] == 5
+
+class UnityCaptureReceiver:
+    """Stands in for an app capturing the first Unity Capture device,
+    asking for a new frame as soon as it got the previous one."""
+
+    def __init__(self):
+        import ctypes
+        from ctypes import wintypes
+        self._kernel32 = k = ctypes.WinDLL('kernel32', use_last_error=True)
+        k.CreateMutexA.restype = wintypes.HANDLE
+        k.CreateEventA.restype = wintypes.HANDLE
+        k.OpenEventA.restype = wintypes.HANDLE
+        k.CreateFileMappingA.restype = wintypes.HANDLE
+        k.CreateFileMappingA.argtypes = [wintypes.HANDLE, ctypes.c_void_p, wintypes.DWORD,
+                                         wintypes.DWORD, wintypes.DWORD, ctypes.c_char_p]
+        k.MapViewOfFile.restype = ctypes.c_void_p
+        k.MapViewOfFile.argtypes = [wintypes.HANDLE, wintypes.DWORD, wintypes.DWORD,
+                                    wintypes.DWORD, ctypes.c_size_t]
+        k.SetEvent.argtypes = [wintypes.HANDLE]
+        k.WaitForSingleObject.argtypes = [wintypes.HANDLE, wintypes.DWORD]
+        k.UnmapViewOfFile.argtypes = [ctypes.c_void_p]
+        k.CloseHandle.argtypes = [wintypes.HANDLE]
+        # Objects of the first device have no number suffix, see SharedImageMemory::Open().
+        max_size = 3840 * 2160 * 4 * 2
+        header_size = 8 * 4
+        self._mutex = k.CreateMutexA(None, False, b'UnityCapture_Mutx')
+        self._sent = k.CreateEventA(None, False, False, b'UnityCapture_Sent')
+        self._file = k.CreateFileMappingA(wintypes.HANDLE(-1), None, 0x04, # PAGE_READWRITE
+                                          0, header_size + max_size, b'UnityCapture_Data')
+        self._view = k.MapViewOfFile(self._file, 0x02, 0, 0, 0) # FILE_MAP_WRITE
+        assert self._mutex and self._sent and self._view
+        ctypes.c_uint32.from_address(self._view).value = max_size
+        # Created by the sender when it opens the shared memory.
+        self._want = None
+        self.received = 0
+        self._stop = False
+        self._thread = threading.Thread(target=self._run)
+        self._thread.start()
+
+    def _run(self):
+        k = self._kernel32
+        while not self._stop:
+            if not self._want:
+                self._want = k.OpenEventA(0x0002, False, b'UnityCapture_Want') # EVENT_MODIFY_STATE
+                if not self._want:
+                    time.sleep(0.001)
+                    continue
+            k.SetEvent(self._want)
+            if k.WaitForSingleObject(self._sent, 200) == 0: # WAIT_OBJECT_0
+                self.received += 1
+
+    def close(self):
+        self._stop = True
+        self._thread.join()
+        k = self._kernel32
+        k.UnmapViewOfFile(self._view)
+        for handle in [self._want, self._file, self._sent, self._mutex]:
+            if handle:
+                k.CloseHandle(handle)
+
+@pytest.mark.skipif(
+    platform.system() != 'Windows',
+    reason='frame demand is specific to unitycapture')
+@pytest.mark.parametrize("in_place", [False, True])
+def test_unitycapture_on_demand_receiver(in_place: bool):
+    receiver = UnityCaptureReceiver()
+    try:
+        with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=PixelFormat.RGBA,
+                                 device='Unity Video Capture', backend='unitycapture',
+                                 on_demand=True, in_place=in_place) as cam:
+            frame = np.zeros((cam.height, cam.width, 4), np.uint8)
+            for _ in range(20):
+                assert cam.wait_for_demand(timeout=1)
+                cam.send(frame)
+            stats = cam.stats()
+    finally:
+        receiver.close()
+    # Requests that Send() consumed while checking for a missed frame
+    # are kept, so every frame the receiver asked for is sent.
+    assert stats['frames_skipped'] == 0
+    assert stats['frames_dropped'] == 0
+    assert stats['frames_output'] == 20
+
+@pytest.mark.skipif(
+    platform.system() != 'Windows',
+    reason='in-place conversion is specific to unitycapture')
+@pytest.mark.parametrize("fmt", [PixelFormat.RGBA, PixelFormat.RGB, PixelFormat.NV12])
+@pytest.mark.parametrize("in_place", [False, True])
+def test_unitycapture_in_place(fmt: PixelFormat, in_place: bool):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=fmt, backend='unitycapture',
+                             in_place=in_place) as cam:
+        shape = pyvirtualcam.camera.FrameShapes[fmt](cam.width, cam.height)
+        frame = np.zeros(shape, np.uint8)
+        for _ in range(5):
+            cam.send(frame)
+        # acquire_frame() still works when send() writes in place.
+        cam.acquire_frame()[:] = 0
+        cam.commit_frame()
+
+def test_invalid_backpressure():
+    if platform.system() != 'Windows':
+        pytest.skip('backpressure is specific to the Windows obs backend')
+    with pytest.raises(RuntimeError):
+        pyvirtualcam.Camera(width=1280, height=720, fps=20, backend='obs', backpressure='foo')
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='listing devices is specific to v4l2loopback')
+def test_list_devices():
+    devices = pyvirtualcam.list_devices()
+    assert devices
+    assert all(d['backend'] == 'v4l2loopback' for d in devices)
+    assert not any(d['in_use'] for d in devices)
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam:
+        devices = pyvirtualcam.list_devices(backend='v4l2loopback')
+        in_use = [d['device'] for d in devices if d['in_use']]
+        assert in_use == [cam.device]
+        # Auto-detection picks the first device which is not in use.
+        assert cam.device == devices[0]['device']
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='I/O methods are specific to v4l2loopback')
+@pytest.mark.parametrize("io_method", ['auto', 'mmap', 'write'])
+def test_v4l2loopback_io_method(io_method: str):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, backend='v4l2loopback',
+                             io_method=io_method) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        for _ in range(10):
+            cam.send(frame)
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='multiple devices per camera are specific to v4l2loopback')
+def test_v4l2loopback_device_stats():
+    # Find two free devices.
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam1:
+        with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam2:
+            devices = [cam1.device, cam2.device]
+
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, device=devices) as cam:
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        for _ in range(5):
+            cam.send(frame)
+        stats = cam.device_stats()
+        assert [s['device'] for s in stats] == devices
+        for s in stats:
+            assert s['frames_written'] + s['errors'] >= 5
+            assert s['max_write_ms'] >= s['mean_write_ms'] >= 0
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='native RGB output is specific to v4l2loopback')
+@pytest.mark.parametrize("fmt,native_fmt", [
+    (PixelFormat.RGB, PixelFormat.RGB),
+    (PixelFormat.BGR, PixelFormat.BGR),
+    (PixelFormat.BGRA, PixelFormat.BGRA),
+    (PixelFormat.RGBA, PixelFormat.BGRA),
+    (PixelFormat.NV12, PixelFormat.NV12),
+])
+def test_v4l2loopback_native_rgb(fmt: PixelFormat, native_fmt: PixelFormat):
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=fmt,
+                             backend='v4l2loopback', native_rgb=True) as cam:
+        assert cam.native_fmt == native_fmt
+        frame = np.zeros(pyvirtualcam.camera.FrameShapes[fmt](cam.width, cam.height), np.uint8)
+        cam.send(frame)
+        native_shape = pyvirtualcam.camera.FrameShapes[native_fmt](cam.width, cam.height)
+        frame = cam.acquire_frame()
+        if isinstance(native_shape, tuple):
+            assert frame.shape == native_shape
+        else:
+            assert frame.size == native_shape
+        cam.commit_frame()
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='DMABUFs are specific to v4l2loopback')
+def test_v4l2loopback_send_dmabuf():
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, fmt=PixelFormat.NV12) as cam:
+        fd = os.memfd_create('frame')
+        try:
+            os.ftruncate(fd, cam.width * cam.height * 3 // 2)
+            cam.send_dmabuf(fd)
+            with pytest.raises(ValueError):
+                cam.send_dmabuf(fd, stride=cam.width * 2)
+        finally:
+            os.close(fd)
+        assert cam.frames_sent == 1
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='relays are specific to v4l2loopback')
+def test_v4l2loopback_invalid_relay_source():
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam:
+        with pytest.raises(ValueError):
+            cam.start_relay('/dev/null')
+        with pytest.raises(ValueError):
+            cam.start_relay('/dev/does-not-exist')
+        with pytest.raises(RuntimeError):
+            cam.stop_relay()
+
+@pytest.mark.skipif(
+    platform.system() != 'Linux',
+    reason='per-device formats are specific to v4l2loopback')
+def test_v4l2loopback_device_formats():
+    # Find two free devices.
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam1:
+        with pyvirtualcam.Camera(width=1280, height=720, fps=20) as cam2:
+            devices = [cam1.device, cam2.device]
+
+    specs = [
+        devices[0],
+        {'device': devices[1], 'fmt': PixelFormat.GRAY, 'width': 640, 'height': 360},
+    ]
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20, device=specs) as cam:
+        assert cam.native_fmt == PixelFormat.I420
+        frame = np.zeros((cam.height, cam.width, 3), np.uint8) # RGB
+        for _ in range(5):
+            cam.send(frame)
+        with pytest.raises(RuntimeError):
+            cam.acquire_frame()
+
+    with pyvirtualcam.Camera(width=1280, height=720, fps=20,
+                             device=[{'device': devices[0], 'width': 640, 'height': 360}]) as cam:
+        frame = cam.acquire_frame()
+        assert frame.size == pyvirtualcam.camera.FrameShapes[PixelFormat.I420](640, 360)
+        cam.commit_frame()
+
+    with pytest.raises(RuntimeError):
+        pyvirtualcam.Camera(width=1280, height=720, fps=20,
+                            device=[{'device': devices[0], 'fmt': PixelFormat.RGBA}])
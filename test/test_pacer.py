@@ -0,0 +1,40 @@
+import os
+import platform
+import time
+import pytest
+from pyvirtualcam._native_common import FramePacer
+
+@pytest.mark.skipif(
+    os.environ.get('CI') and platform.system() == 'Darwin',
+    reason='disabled due to high fluctuations in CI, manually verified on MacBook Pro')
+def test_frame_pacer():
+    target_fps = 60
+    pacer = FramePacer(target_fps)
+    assert pacer.interval_ns == int(1e9 / target_fps)
+    pacer.wait_for_next_slot()
+    start = time.perf_counter()
+    missed_total = 0
+    for _ in range(60):
+        missed, waited_ns, late_ns = pacer.wait_for_next_slot()
+        missed_total += missed
+        assert waited_ns >= 0 and late_ns >= 0
+    elapsed = time.perf_counter() - start
+    # Deadlines do not drift, so 60 slots take one second.
+    assert abs(elapsed - 1) < 0.02, elapsed
+    assert missed_total <= 1
+
+def test_frame_pacer_missed_deadlines():
+    pacer = FramePacer(100)
+    pacer.wait_for_next_slot()
+    time.sleep(0.055)
+    missed, waited_ns, _ = pacer.wait_for_next_slot()
+    assert missed >= 5
+    assert waited_ns == 0
+    # The schedule continues from the latest missed deadline.
+    missed, waited_ns, _ = pacer.wait_for_next_slot()
+    assert missed == 0
+    assert 0 < waited_ns <= pacer.interval_ns
+
+def test_frame_pacer_invalid_fps():
+    with pytest.raises(ValueError):
+        FramePacer(0)
@@ -135,6 +135,9 @@ IMediaControl *pMediaControl = NULL;
 char *imgBuffer = NULL;
 char *rgbBuffer = NULL;
 
+// Whether output messages are suppressed
+int quiet = 0;
+
 // YUV color conversions
 // - Recommendation ITU-R BT.601 (CCIR 601, older, SDTV)
 // - Recommendation ITU-R BT.709 (newer, HDTV)
@@ -166,6 +169,22 @@ void exit_message(const char* error_message, int error)
   if (pDevEnum != NULL) pDevEnum->Release();
   CoUninitialize();
 
+  // Allow capturing again with another open()
+  rgbBuffer = imgBuffer = NULL;
+  pMediaControl = NULL;
+  pNullRenderer = NULL;
+  pSampleGrabber = NULL;
+  pSampleGrabberFilter = NULL;
+  pConfig = NULL;
+  pEnumPins = NULL;
+  pCap = NULL;
+  pBuilder = NULL;
+  pGraph = NULL;
+  pPropBag = NULL;
+  pMoniker = NULL;
+  pEnum = NULL;
+  pDevEnum = NULL;
+
   // Exit the program
   //exit(error);
   if (error != 0) {
@@ -512,13 +531,10 @@ char *strupcase(char *s)
 } // strupcase
 
 
-int main(int argc, char **argv,
-         std::vector<uint8_t>& out_img,
-         uint32_t& out_width, uint32_t& out_height,
-         bool& out_is_nv12, uint64_t& timestamp_ms)
+void open(int argc, char **argv)
 {
   // Capture settings
-  int quiet = 0;
+  quiet = 0;
   int snapshot_delay = 2000;
   int show_preview_window = 0;
   int list_devices = 0;
@@ -1051,6 +1067,16 @@ int main(int argc, char **argv,
 
   // Wait for specified time delay (if any)
   Sleep(snapshot_delay);
+} // open
+
+void grab(std::vector<uint8_t>& out_img,
+          uint32_t& out_width, uint32_t& out_height,
+          bool& out_is_nv12, uint64_t& timestamp_ms)
+{
+  // Release the buffers of the previous frame
+  delete[] rgbBuffer;
+  delete[] imgBuffer;
+  rgbBuffer = imgBuffer = NULL;
 
   // Grab a sample
   // First, find the required buffer size
@@ -1087,9 +1113,6 @@ int main(int argc, char **argv,
   timestamp_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
     std::chrono::system_clock::now().time_since_epoch()).count();
 
-  // Stop the graph
-  pMediaControl->Stop();
-
   // Get the media type from the sample grabber filter
   AM_MEDIA_TYPE mt;
 #ifdef __MINGW32__
@@ -1112,7 +1135,7 @@ int main(int argc, char **argv,
     pVih = (VIDEOINFOHEADER*)mt.pbFormat;
 
     long rgbBufferSize = 0;
-    fourcc = pVih->bmiHeader.biCompression;
+    DWORD fourcc = pVih->bmiHeader.biCompression;
     if (fourcc == YUY2) {
       // Convert YUY2 image to RGB image
       yuy2_rgb(pVih->bmiHeader.biWidth, pVih->bmiHeader.biHeight, &rgbBufferSize); // e44
@@ -1175,9 +1198,7 @@ int main(int argc, char **argv,
 
     out_width = pVih->bmiHeader.biWidth;
     out_height = pVih->bmiHeader.biHeight;
-    out_img.resize(rgbBufferSize);
-    out_img.insert(out_img.begin(), rgbBuffer, rgbBuffer + rgbBufferSize);
-    
+    out_img.assign(rgbBuffer, rgbBuffer + rgbBufferSize);
 
     /*
     // Create bitmap structure
@@ -1228,7 +1249,25 @@ int main(int argc, char **argv,
   _FreeMediaType(mt);
 
   //if (!quiet) fprintf(stdout, "Captured image saved to %s\n", filename);
+} // grab
+
+void close()
+{
+  // Stop the graph
+  if (pMediaControl != NULL) pMediaControl->Stop();
+
   exit_message("", 0);
+} // close
+
+int main(int argc, char **argv,
+         std::vector<uint8_t>& out_img,
+         uint32_t& out_width, uint32_t& out_height,
+         bool& out_is_nv12, uint64_t& timestamp_ms)
+{
+  open(argc, argv);
+  grab(out_img, out_width, out_height, out_is_nv12, timestamp_ms);
+  close();
+  return 0;
 } // main
 
 } // namespace commandcam
@@ -4,8 +4,17 @@
 #include <vector>
 
 namespace commandcam {
+  // Captures a single frame, like the CommandCam executable.
   int main(int argc, char **argv,
          std::vector<uint8_t>& out_img,
          uint32_t& out_width, uint32_t& out_height,
          bool& out_is_nv12, uint64_t& timestamp_ms);
-}
\ No newline at end of file
+
+  // Keeps the filter graph running between frames.
+  // Only one device can be open at a time.
+  void open(int argc, char **argv);
+  void grab(std::vector<uint8_t>& out_img,
+            uint32_t& out_width, uint32_t& out_height,
+            bool& out_is_nv12, uint64_t& timestamp_ms);
+  void close();
+}
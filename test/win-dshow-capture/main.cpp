@@ -1,4 +1,6 @@
 #include <stdexcept>
+#include <string>
+#include <vector>
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
 #include "CommandCam.h"
@@ -47,6 +49,75 @@ class DShowCapture {
     }
 };
 
+// Keeps the device open and returns its latest frame on every read(),
+// for measuring latency without reopening the device for each frame.
+class DShowSession {
+  private:
+    static bool _open;
+    bool _is_nv12 = false;
+    uint64_t _timestamp_ms = 0;
+
+  public:
+    DShowSession(const std::string& device, uint32_t width, uint32_t height, int delay_ms) {
+        if (_open) {
+            throw std::runtime_error("Only one DirectShow session can be open at a time");
+        }
+        std::vector<std::string> args {
+            "CommandCam.exe",
+            "/devname", device,
+            "/size", std::to_string(width) + "x" + std::to_string(height),
+            "/delay", std::to_string(delay_ms),
+            "/quiet"
+        };
+        std::vector<char*> argv;
+        for (std::string& arg : args) {
+            argv.push_back((char*) arg.c_str());
+        }
+        commandcam::open((int) argv.size(), argv.data());
+        _open = true;
+    }
+
+    ~DShowSession() {
+        close();
+    }
+
+    py::array_t<uint8_t> read() {
+        if (!_open) {
+            throw std::logic_error("session is closed");
+        }
+        std::vector<uint8_t> img;
+        uint32_t width, height;
+        {
+            py::gil_scoped_release release;
+            try {
+                commandcam::grab(img, width, height, _is_nv12, _timestamp_ms);
+            } catch (...) {
+                // Errors release the graph.
+                _open = false;
+                throw;
+            }
+        }
+        return py::array_t<uint8_t>({height, width, (uint32_t)3}, img.data());
+    }
+
+    void close() {
+        if (_open) {
+            _open = false;
+            commandcam::close();
+        }
+    }
+
+    bool is_nv12() {
+        return _is_nv12;
+    }
+
+    uint64_t timestamp_ms() {
+        return _timestamp_ms;
+    }
+};
+
+bool DShowSession::_open = false;
+
 PYBIND11_MODULE(_win_dshow_capture, m) {
     py::class_<DShowCapture>(m, "DShowCapture")
         .def(py::init<char*, uint32_t, uint32_t>(),
@@ -54,4 +125,13 @@ PYBIND11_MODULE(_win_dshow_capture, m) {
         .def("capture", &DShowCapture::capture)
         .def("is_nv12", &DShowCapture::is_nv12)
         .def("timestamp_ms", &DShowCapture::timestamp_ms);
+
+    py::class_<DShowSession>(m, "DShowSession")
+        .def(py::init<const std::string&, uint32_t, uint32_t, int>(),
+             py::arg("device"), py::arg("width"), py::arg("height"),
+             py::arg("delay_ms") = 2000)
+        .def("read", &DShowSession::read)
+        .def("close", &DShowSession::close)
+        .def("is_nv12", &DShowSession::is_nv12)
+        .def("timestamp_ms", &DShowSession::timestamp_ms);
 }
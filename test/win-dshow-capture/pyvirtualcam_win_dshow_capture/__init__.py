@@ -1,14 +1,37 @@
-from pyvirtualcam_win_dshow_capture._win_dshow_capture import DShowCapture
+from pyvirtualcam_win_dshow_capture._win_dshow_capture import DShowCapture, DShowSession
+
+def _to_rgb(img, is_nv12: bool):
+    if is_nv12:
+        return img
+    img = img[::-1]
+    img_rgb = img.copy()
+    img_rgb[:,:,0] = img[:,:,2]
+    img_rgb[:,:,1] = img[:,:,1]
+    img_rgb[:,:,2] = img[:,:,0]
+    return img_rgb
 
 def capture(device: str, pref_width: int, pref_height: int):
     dshow = DShowCapture(device, pref_width, pref_height)
     img = dshow.capture()
-    if dshow.is_nv12():
-        return img, dshow.timestamp_ms()
-    else:
-        img = img[::-1]
-        img_rgb = img.copy()
-        img_rgb[:,:,0] = img[:,:,2]
-        img_rgb[:,:,1] = img[:,:,1]
-        img_rgb[:,:,2] = img[:,:,0]
-        return img_rgb, dshow.timestamp_ms()
+    return _to_rgb(img, dshow.is_nv12()), dshow.timestamp_ms()
+
+class Session:
+    """ Keeps a device open to read its latest frame repeatedly. """
+
+    def __init__(self, device: str, pref_width: int, pref_height: int, delay_ms: int=2000):
+        self._session = DShowSession(device, pref_width, pref_height, delay_ms)
+
+    def read(self):
+        """ Returns the latest RGB frame of the device, which may be the
+        same frame as in the previous call. """
+        img = self._session.read()
+        return _to_rgb(img, self._session.is_nv12()), self._session.timestamp_ms()
+
+    def close(self):
+        self._session.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()